@@ -2,19 +2,30 @@ PHP_ARG_ENABLE(opa, whether to enable opa support,
 [ --enable-opa   Enable opa support])
 
 if test "$PHP_OPA" != "no"; then
-  # Check for LZ4 library
-  AC_CHECK_HEADER([lz4.h], [
-    AC_CHECK_LIB([lz4], [LZ4_compress], [
+  # Check for LZ4 library (frame API, lz4 >= 1.8)
+  AC_CHECK_HEADER([lz4frame.h], [
+    AC_CHECK_LIB([lz4], [LZ4F_compressBegin], [
       PHP_ADD_LIBRARY_WITH_PATH(lz4, , OPA_SHARED_LIBADD)
       AC_DEFINE(HAVE_LZ4, 1, [Have LZ4 library])
     ])
   ])
   
+  # Check for Zstandard library (streaming API, zstd >= 1.4)
+  AC_CHECK_HEADER([zstd.h], [
+    AC_CHECK_LIB([zstd], [ZSTD_compressStream2], [
+      PHP_ADD_LIBRARY_WITH_PATH(zstd, , OPA_SHARED_LIBADD)
+      AC_DEFINE(HAVE_ZSTD, 1, [Have Zstandard library])
+    ])
+  ])
+  
+  # shm_open lives in librt on older glibc (shared-memory ring transport)
+  AC_SEARCH_LIBS([shm_open], [rt])
+  
   # Check for MySQLi and PDO extensions (for SQL profiling hooks)
   # These are usually built-in, but we check to ensure they're available
   PHP_CHECK_LIBRARY(mysqlclient, mysql_init,
     [AC_DEFINE(HAVE_MYSQLI, 1, [MySQLi support available])], [], [])
   
-  PHP_NEW_EXTENSION(opa, src/opa.c src/span.c src/call_node.c src/transport.c src/serialize.c src/opa_api.c src/error_tracking.c, $ext_shared, , -DZEND_ENABLE_STATIC_TSRMLS_CACHE=1 -DCOMPILE_DL_OPA=1)
+  PHP_NEW_EXTENSION(opa, src/opa.c src/span.c src/call_node.c src/arena.c src/symbol.c src/aggregate.c src/filter.c src/rng.c src/transport.c src/sender.c src/shm_ring.c src/compress.c src/sampler.c src/propagation.c src/spool.c src/resolver.c src/serialize.c src/opa_api.c src/error_tracking.c, $ext_shared, , -DZEND_ENABLE_STATIC_TSRMLS_CACHE=1 -DCOMPILE_DL_OPA=1)
   PHP_SUBST(OPA_SHARED_LIBADD)
 fi
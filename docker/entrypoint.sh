@@ -62,11 +62,20 @@ fi
 # Update INI settings from environment variables (these override any defaults)
 update_ini_setting "OPA_ENABLED" "opa.enabled"
 update_ini_setting "OPA_SAMPLING_RATE" "opa.sampling_rate"
+update_ini_setting "OPA_SAMPLING_TARGET_TPS" "opa.sampling_target_tps"
+update_ini_setting "OPA_SAMPLING_RULES" "opa.sampling_rules"
+update_ini_setting "OPA_TRACE_PROPAGATION" "opa.trace_propagation"
 update_ini_setting "OPA_SOCKET_PATH" "opa.socket_path"
 update_ini_setting "OPA_FULL_CAPTURE_THRESHOLD_MS" "opa.full_capture_threshold_ms"
 update_ini_setting "OPA_STACK_DEPTH" "opa.stack_depth"
+update_ini_setting "OPA_MAX_CALLS" "opa.max_calls"
+update_ini_setting "OPA_MAX_CALL_BYTES" "opa.max_call_bytes"
 update_ini_setting "OPA_BUFFER_SIZE" "opa.buffer_size"
 update_ini_setting "OPA_COLLECT_INTERNAL_FUNCTIONS" "opa.collect_internal_functions"
+update_ini_setting "OPA_CALL_CPU_TIME" "opa.call_cpu_time"
+update_ini_setting "OPA_MODE" "opa.mode"
+update_ini_setting "OPA_INCLUDE" "opa.include"
+update_ini_setting "OPA_EXCLUDE" "opa.exclude"
 update_ini_setting "OPA_DEBUG_LOG" "opa.debug_log"
 update_ini_setting "OPA_ORGANIZATION_ID" "opa.organization_id"
 update_ini_setting "OPA_PROJECT_ID" "opa.project_id"
@@ -76,6 +85,23 @@ update_ini_setting "OPA_LANGUAGE_VERSION" "opa.language_version"
 update_ini_setting "OPA_FRAMEWORK" "opa.framework"
 update_ini_setting "OPA_FRAMEWORK_VERSION" "opa.framework_version"
 update_ini_setting "OPA_EXPAND_SPANS" "opa.expand_spans"
+update_ini_setting "OPA_ASYNC_SEND" "opa.async_send"
+update_ini_setting "OPA_ASYNC_QUEUE_SIZE" "opa.async_queue_size"
+update_ini_setting "OPA_SHM_SIZE" "opa.shm_size"
+update_ini_setting "OPA_COMPRESSION" "opa.compression"
+update_ini_setting "OPA_COMPRESSION_LEVEL" "opa.compression_level"
+update_ini_setting "OPA_COMPRESSION_MIN_SIZE" "opa.compression_min_size"
+update_ini_setting "OPA_ZSTD_DICT_PATH" "opa.zstd_dict_path"
+update_ini_setting "OPA_ZSTD_DICT_MIN_SIZE" "opa.zstd_dict_min_size"
+update_ini_setting "OPA_ZSTD_SAMPLE_DIR" "opa.zstd_sample_dir"
+update_ini_setting "OPA_DNS_REFRESH_SEC" "opa.dns_refresh_sec"
+update_ini_setting "OPA_SEND_TIMEOUT_MS" "opa.send_timeout_ms"
+update_ini_setting "OPA_BREAKER_THRESHOLD" "opa.breaker_threshold"
+update_ini_setting "OPA_BREAKER_BACKOFF_MS" "opa.breaker_backoff_ms"
+update_ini_setting "OPA_BREAKER_MAX_BACKOFF_MS" "opa.breaker_max_backoff_ms"
+update_ini_setting "OPA_SPOOL_DIR" "opa.spool_dir"
+update_ini_setting "OPA_SPOOL_MAX_BYTES" "opa.spool_max_bytes"
+update_ini_setting "OPA_SPOOL_SEGMENT_SIZE" "opa.spool_segment_size"
 
 # Execute the original docker-php-entrypoint (or the command passed)
 if [ "$1" = "php-fpm" ]; then
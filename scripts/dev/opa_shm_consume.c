@@ -0,0 +1,86 @@
+// Minimal consumer for the shared-memory ring transport (opa.socket_path=shm:/name)
+// Used to test the extension without an agent.
+//
+// Build:  cc -O2 -Isrc scripts/dev/opa_shm_consume.c src/shm_ring.c -o opa_shm_consume -lrt
+// Run:    ./opa_shm_consume /opa              # print one line per record
+//         ./opa_shm_consume -c -s 16777216 /opa  # create the ring if missing
+//         ./opa_shm_consume -n 10 -d /opa       # stop after 10 records, dump payloads
+#include "shm_ring.h"
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-c] [-s size] [-n count] [-d] /name\n", prog);
+    fprintf(stderr, "  -c        create the ring if it does not exist\n");
+    fprintf(stderr, "  -s size   capacity in bytes when creating (default %d)\n", OPA_SHM_DEFAULT_CAPACITY);
+    fprintf(stderr, "  -n count  exit after count records\n");
+    fprintf(stderr, "  -d        dump uncompressed payloads to stdout\n");
+}
+
+int main(int argc, char **argv) {
+    int create = 0, dump = 0, opt;
+    long limit = -1;
+    size_t size = OPA_SHM_DEFAULT_CAPACITY;
+
+    while ((opt = getopt(argc, argv, "cs:n:dh")) != -1) {
+        switch (opt) {
+            case 'c': create = 1; break;
+            case 's': size = (size_t)strtoull(optarg, NULL, 10); break;
+            case 'n': limit = atol(optarg); break;
+            case 'd': dump = 1; break;
+            default: usage(argv[0]); return 2;
+        }
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    opa_shm_ring_t *ring = opa_shm_ring_open(argv[optind], size, create);
+    if (!ring) {
+        perror("opa_shm_ring_open");
+        return 1;
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    fprintf(stderr, "consuming %s (capacity %llu bytes)\n", argv[optind], (unsigned long long)ring->hdr->capacity);
+
+    long count = 0;
+    unsigned long long bytes = 0;
+    while (!stop && (limit < 0 || count < limit)) {
+        const void *data;
+        size_t len;
+        if (!opa_shm_ring_read(ring, &data, &len)) {
+            usleep(1000);
+            continue;
+        }
+        int compressed = len > 0 && ((const char *)data)[0] != '{';
+        printf("record %ld: %zu bytes%s\n", count, len, compressed ? " (compressed)" : "");
+        if (dump && !compressed) {
+            fwrite(data, 1, len, stdout);
+            if (len == 0 || ((const char *)data)[len - 1] != '\n') {
+                fputc('\n', stdout);
+            }
+        }
+        fflush(stdout);
+        opa_shm_ring_release(ring);
+        count++;
+        bytes += len;
+    }
+
+    fprintf(stderr, "%ld records, %llu bytes, %llu dropped by producers, %llu abandoned reservations\n", count, bytes,
+            (unsigned long long)__atomic_load_n(&ring->hdr->dropped, __ATOMIC_RELAXED),
+            (unsigned long long)__atomic_load_n(&ring->hdr->abandoned, __ATOMIC_RELAXED));
+    opa_shm_ring_close(ring);
+    return 0;
+}
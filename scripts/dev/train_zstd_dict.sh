@@ -0,0 +1,37 @@
+#!/bin/bash
+# Train a zstd dictionary from payloads captured with opa.zstd_sample_dir
+#
+# Usage: scripts/dev/train_zstd_dict.sh <sample_dir> <dict_file> [max_dict_bytes]
+#
+# Point opa.zstd_dict_path (extension) and the agent at the resulting file.
+
+set -e
+
+SAMPLE_DIR="$1"
+DICT_FILE="$2"
+MAX_DICT="${3:-112640}"
+
+if [ -z "$SAMPLE_DIR" ] || [ -z "$DICT_FILE" ]; then
+    echo "usage: $0 <sample_dir> <dict_file> [max_dict_bytes]" >&2
+    exit 2
+fi
+
+if ! command -v zstd >/dev/null 2>&1; then
+    echo "zstd command not found (apt-get install zstd)" >&2
+    exit 1
+fi
+
+SAMPLES=$(find "$SAMPLE_DIR" -type f -name 'opa-*.json' | wc -l)
+if [ "$SAMPLES" -lt 100 ]; then
+    echo "Only $SAMPLES samples in $SAMPLE_DIR, capture more traffic first (at least 100)" >&2
+    exit 1
+fi
+
+echo "Training on $SAMPLES samples..."
+zstd --train -r "$SAMPLE_DIR" -o "$DICT_FILE" --maxdict="$MAX_DICT"
+
+# Report the gain on the captured samples
+RAW=$(find "$SAMPLE_DIR" -type f -name 'opa-*.json' -exec cat {} + | wc -c)
+PLAIN=$(find "$SAMPLE_DIR" -type f -name 'opa-*.json' -exec sh -c 'for f; do zstd -q -c "$f" | wc -c; done' _ {} + | awk '{s+=$1} END {print s}')
+WITH_DICT=$(find "$SAMPLE_DIR" -type f -name 'opa-*.json' -exec sh -c 'd="$1"; shift; for f; do zstd -q -D "$d" -c "$f" | wc -c; done' _ "$DICT_FILE" {} + | awk '{s+=$1} END {print s}')
+echo "Samples: $RAW bytes raw, $PLAIN bytes zstd, $WITH_DICT bytes zstd with dictionary"
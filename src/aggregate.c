@@ -0,0 +1,196 @@
+#include "aggregate.h"
+
+typedef struct {
+    uint32_t edge;           // Index into edges + 1
+    unsigned int generation; // Slot is live only in the current generation
+} edge_slot_t;
+
+// Time spent in the tracked callees of the call at each stack position
+typedef struct {
+    int64_t child_wall_ns;
+    int64_t child_cpu_ns;
+} frame_t;
+
+// Edges of the current request in first-seen order (malloc'd, reused across requests)
+static opa_edge_t *edges = NULL;
+static uint32_t edge_count = 0;
+static uint32_t edge_capacity = 0;
+
+// Open addressing, capacity is a power of two, kept at most half full.
+// Reset bumps the generation instead of clearing the slots.
+static edge_slot_t *slots = NULL;
+static size_t slot_capacity = 0;
+static unsigned int generation = 1;
+
+static frame_t *frames = NULL;
+static uint32_t frame_capacity = 0;
+
+// Network bytes of the completed top-level calls
+static size_t top_bytes_sent = 0;
+static size_t top_bytes_received = 0;
+
+int opa_mode_from_name(const char *name) {
+    if (!name || !*name || strcasecmp(name, "tree") == 0) {
+        return OPA_MODE_TREE;
+    }
+    if (strcasecmp(name, "aggregate") == 0) {
+        return OPA_MODE_AGGREGATE;
+    }
+    return -1;
+}
+
+static size_t edge_hash(uint32_t caller_class, uint32_t caller_function, uint32_t class_name, uint32_t function_name, size_t mask) {
+    uint64_t h = ((uint64_t)caller_class << 32 | caller_function) * 0x9E3779B97F4A7C15ULL;
+    h ^= ((uint64_t)class_name << 32 | function_name) + (h >> 29);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h & mask;
+}
+
+static int grow_slots(void) {
+    size_t new_capacity = slot_capacity ? slot_capacity * 2 : OPA_EDGE_TABLE_MIN;
+    edge_slot_t *new_slots = calloc(new_capacity, sizeof(edge_slot_t));
+    if (!new_slots) {
+        return -1;
+    }
+    size_t mask = new_capacity - 1;
+    for (size_t i = 0; i < slot_capacity; i++) {
+        if (slots[i].generation != generation) {
+            continue;
+        }
+        opa_edge_t *e = &edges[slots[i].edge - 1];
+        size_t j = edge_hash(e->caller_class, e->caller_function, e->class_name, e->function_name, mask);
+        while (new_slots[j].generation == generation) {
+            j = (j + 1) & mask;
+        }
+        new_slots[j] = slots[i];
+    }
+    free(slots);
+    slots = new_slots;
+    slot_capacity = new_capacity;
+    return 0;
+}
+
+static opa_edge_t *find_edge(uint32_t caller_class, uint32_t caller_function, uint32_t class_name, uint32_t function_name) {
+    if ((size_t)(edge_count + 1) * 2 > slot_capacity && grow_slots() < 0 && (size_t)edge_count + 1 >= slot_capacity) {
+        return NULL; // Table full, the call is dropped from the graph
+    }
+    size_t mask = slot_capacity - 1;
+    size_t i = edge_hash(caller_class, caller_function, class_name, function_name, mask);
+    while (slots[i].generation == generation) {
+        opa_edge_t *e = &edges[slots[i].edge - 1];
+        if (e->function_name == function_name && e->class_name == class_name &&
+            e->caller_function == caller_function && e->caller_class == caller_class) {
+            return e;
+        }
+        i = (i + 1) & mask;
+    }
+
+    if (edge_count == edge_capacity) {
+        uint32_t new_capacity = edge_capacity ? edge_capacity * 2 : OPA_EDGE_TABLE_MIN;
+        opa_edge_t *new_edges = realloc(edges, new_capacity * sizeof(opa_edge_t));
+        if (!new_edges) {
+            return NULL;
+        }
+        edges = new_edges;
+        edge_capacity = new_capacity;
+    }
+    opa_edge_t *e = &edges[edge_count++];
+    memset(e, 0, sizeof(*e));
+    e->caller_class = caller_class;
+    e->caller_function = caller_function;
+    e->class_name = class_name;
+    e->function_name = function_name;
+    slots[i].edge = edge_count;
+    slots[i].generation = generation;
+    return e;
+}
+
+void opa_aggregate_enter(call_node_t *call) {
+    if (call->index >= frame_capacity) {
+        uint32_t new_capacity = frame_capacity ? frame_capacity * 2 : 64;
+        while (new_capacity <= call->index) {
+            new_capacity *= 2;
+        }
+        frame_t *new_frames = realloc(frames, new_capacity * sizeof(frame_t));
+        if (!new_frames) {
+            return; // Exit checks the capacity again
+        }
+        frames = new_frames;
+        frame_capacity = new_capacity;
+    }
+    frames[call->index].child_wall_ns = 0;
+    frames[call->index].child_cpu_ns = 0;
+}
+
+void opa_aggregate_exit(call_node_t *call, call_node_t *caller) {
+    int64_t wall_ns = call->end_ns - call->start_ns;
+    int64_t cpu_ns = call->end_cpu_ns - call->start_cpu_ns;
+    int64_t child_wall_ns = 0, child_cpu_ns = 0;
+    if (call->index < frame_capacity) {
+        child_wall_ns = frames[call->index].child_wall_ns;
+        child_cpu_ns = frames[call->index].child_cpu_ns;
+    }
+
+    if (caller) {
+        if (caller->index < frame_capacity) {
+            frames[caller->index].child_wall_ns += wall_ns;
+            frames[caller->index].child_cpu_ns += cpu_ns;
+        }
+    } else {
+        if (call->bytes_sent > 0) top_bytes_sent += (size_t)call->bytes_sent;
+        if (call->bytes_received > 0) top_bytes_received += (size_t)call->bytes_received;
+    }
+
+    opa_edge_t *e = find_edge(caller ? caller->class_name : 0, caller ? caller->function_name : 0,
+                              call->class_name, call->function_name);
+    if (!e) {
+        return;
+    }
+    e->count++;
+    e->wall_ns += wall_ns;
+    e->excl_wall_ns += wall_ns - child_wall_ns;
+    e->cpu_ns += cpu_ns;
+    e->excl_cpu_ns += cpu_ns - child_cpu_ns;
+    e->memory += call->memory;
+}
+
+uint32_t opa_aggregate_edge_count(void) {
+    return edge_count;
+}
+
+const opa_edge_t *opa_aggregate_edge(uint32_t i) {
+    return i < edge_count ? &edges[i] : NULL;
+}
+
+void opa_aggregate_net(size_t *sent, size_t *received) {
+    *sent = top_bytes_sent;
+    *received = top_bytes_received;
+}
+
+void opa_aggregate_reset(void) {
+    edge_count = 0;
+    top_bytes_sent = 0;
+    top_bytes_received = 0;
+    if (++generation == 0) {
+        // Wrapped: stale slots could look live again
+        if (slots) {
+            memset(slots, 0, slot_capacity * sizeof(edge_slot_t));
+        }
+        generation = 1;
+    }
+}
+
+void opa_aggregate_shutdown(void) {
+    free(edges);
+    edges = NULL;
+    edge_count = 0;
+    edge_capacity = 0;
+    free(slots);
+    slots = NULL;
+    slot_capacity = 0;
+    free(frames);
+    frames = NULL;
+    frame_capacity = 0;
+}
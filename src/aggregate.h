@@ -0,0 +1,42 @@
+#ifndef AGGREGATE_H
+#define AGGREGATE_H
+
+#include "opa.h"
+
+// Aggregated call graph (opa.mode=aggregate)
+// Tree mode keeps one call record per invocation until the end of the request.
+// In aggregate mode the collector reuses records as a stack (record index =
+// stack position) and folds every exiting call into the edge from its caller,
+// xhprof style: one entry per distinct (caller, callee) pair, keyed by their
+// class and function symbol ids. Memory is O(distinct edges + stack depth)
+// instead of O(calls). The edges are sent as the root span's "call_graph".
+
+#define OPA_MODE_TREE 0
+#define OPA_MODE_AGGREGATE 1
+
+#define OPA_EDGE_TABLE_MIN 256
+
+typedef struct {
+    uint32_t caller_class;    // Symbol ids of the caller, 0/0 = top level of the request
+    uint32_t caller_function;
+    uint32_t class_name;      // Symbol ids of the callee
+    uint32_t function_name;
+    uint64_t count;           // Completed calls
+    int64_t wall_ns;          // Inclusive wall time
+    int64_t excl_wall_ns;     // Wall time minus the time spent in tracked callees
+    int64_t cpu_ns;           // Inclusive CPU time (0 with opa.call_cpu_time=0)
+    int64_t excl_cpu_ns;
+    int64_t memory;           // Sum of memory deltas
+} opa_edge_t;
+
+// Aggregate functions
+int opa_mode_from_name(const char *name); // OPA_MODE_*, -1 if unknown
+void opa_aggregate_enter(call_node_t *call); // Call pushed at record index call->index
+void opa_aggregate_exit(call_node_t *call, call_node_t *caller); // Call ended (deltas set); caller NULL at top level
+uint32_t opa_aggregate_edge_count(void);
+const opa_edge_t *opa_aggregate_edge(uint32_t i);
+void opa_aggregate_net(size_t *sent, size_t *received); // Network bytes of the top-level calls
+void opa_aggregate_reset(void); // End of request
+void opa_aggregate_shutdown(void);
+
+#endif /* AGGREGATE_H */
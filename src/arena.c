@@ -0,0 +1,80 @@
+#include "arena.h"
+
+// Chunk header size, rounded so the first allocation stays aligned
+#define ARENA_HEADER_SIZE ((sizeof(opa_arena_chunk_t) + OPA_ARENA_ALIGN - 1) & ~(size_t)(OPA_ARENA_ALIGN - 1))
+
+opa_arena_t opa_request_arena = {0};
+
+static void start_chunk(opa_arena_t *arena, opa_arena_chunk_t *chunk) {
+    chunk->next = arena->chunks;
+    arena->chunks = chunk;
+    arena->pos = (char *)chunk + ARENA_HEADER_SIZE;
+    arena->end = arena->pos + chunk->size;
+}
+
+void *opa_arena_alloc_slow(opa_arena_t *arena, size_t size) {
+    // Reuse a chunk kept from an earlier request when it is large enough
+    opa_arena_chunk_t *chunk = arena->spare;
+    if (chunk && chunk->size >= size) {
+        arena->spare = chunk->next;
+    } else {
+        size_t chunk_size = size > OPA_ARENA_CHUNK_SIZE ? size : OPA_ARENA_CHUNK_SIZE;
+        chunk = malloc(ARENA_HEADER_SIZE + chunk_size);
+        if (!chunk) {
+            debug_log("[ARENA] Failed to allocate a %zu byte chunk", chunk_size);
+            return NULL;
+        }
+        chunk->size = chunk_size;
+    }
+    start_chunk(arena, chunk);
+
+    void *ptr = arena->pos;
+    arena->pos += size;
+    arena->used += size;
+    return ptr;
+}
+
+char *opa_arena_strdup(opa_arena_t *arena, const char *s) {
+    size_t len = strlen(s);
+    char *copy = opa_arena_alloc(arena, len + 1);
+    if (copy) {
+        memcpy(copy, s, len + 1);
+    }
+    return copy;
+}
+
+void opa_arena_reset(opa_arena_t *arena) {
+    size_t retained = 0;
+    for (opa_arena_chunk_t *chunk = arena->spare; chunk; chunk = chunk->next) {
+        retained += chunk->size;
+    }
+
+    // Standard-size chunks go back on the spare list up to the retention cap;
+    // oversized chunks and anything beyond the cap are released
+    opa_arena_chunk_t *chunk = arena->chunks;
+    while (chunk) {
+        opa_arena_chunk_t *next = chunk->next;
+        if (chunk->size == OPA_ARENA_CHUNK_SIZE && retained + chunk->size <= OPA_ARENA_RETAIN) {
+            chunk->next = arena->spare;
+            arena->spare = chunk;
+            retained += chunk->size;
+        } else {
+            free(chunk);
+        }
+        chunk = next;
+    }
+
+    arena->chunks = NULL;
+    arena->pos = NULL;
+    arena->end = NULL;
+    arena->used = 0;
+}
+
+void opa_arena_destroy(opa_arena_t *arena) {
+    opa_arena_reset(arena);
+    while (arena->spare) {
+        opa_arena_chunk_t *next = arena->spare->next;
+        free(arena->spare);
+        arena->spare = next;
+    }
+}
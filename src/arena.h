@@ -0,0 +1,51 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "opa.h"
+
+// Per-request bump allocator
+// Call nodes, their names and the containers of their SQL/HTTP/cache/Redis
+// records are carved out of large malloc'd chunks instead of being emalloc'd
+// one by one. Nothing is freed individually: opa_arena_reset() rewinds the
+// arena at the end of the request, keeping up to OPA_ARENA_RETAIN bytes of
+// chunks for the next request and returning the rest to the system.
+
+#define OPA_ARENA_ALIGN 16
+#define OPA_ARENA_CHUNK_SIZE (64 * 1024)
+#define OPA_ARENA_RETAIN (1024 * 1024)
+
+typedef struct opa_arena_chunk {
+    struct opa_arena_chunk *next;
+    size_t size; // Usable bytes after the header
+} opa_arena_chunk_t;
+
+typedef struct {
+    opa_arena_chunk_t *chunks; // Chunks in use, newest (current) first
+    opa_arena_chunk_t *spare;  // Chunks kept by the last reset
+    char *pos;                 // Next free byte of the current chunk
+    char *end;                 // End of the current chunk
+    size_t used;               // Bytes handed out since the last reset
+} opa_arena_t;
+
+// Arena backing the call tree of the current request
+extern opa_arena_t opa_request_arena;
+
+// Arena functions
+void *opa_arena_alloc_slow(opa_arena_t *arena, size_t size); // Starts a new chunk
+char *opa_arena_strdup(opa_arena_t *arena, const char *s);
+void opa_arena_reset(opa_arena_t *arena); // Invalidates everything allocated from the arena
+void opa_arena_destroy(opa_arena_t *arena);
+
+// Uninitialized, OPA_ARENA_ALIGN-aligned memory; NULL if a chunk cannot be allocated
+static inline void *opa_arena_alloc(opa_arena_t *arena, size_t size) {
+    size = (size + OPA_ARENA_ALIGN - 1) & ~(size_t)(OPA_ARENA_ALIGN - 1);
+    if ((size_t)(arena->end - arena->pos) < size) {
+        return opa_arena_alloc_slow(arena, size);
+    }
+    void *ptr = arena->pos;
+    arena->pos += size;
+    arena->used += size;
+    return ptr;
+}
+
+#endif /* ARENA_H */
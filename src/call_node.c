@@ -1,4 +1,41 @@
 #include "call_node.h"
+#include "arena.h"
+#include <stddef.h>
+
+// I/O side-table entry of a call, created on its first record
+opa_call_io_t *opa_call_io_ensure(call_node_t *call) {
+    opa_collector_t *collector = global_collector;
+    if (call->io) {
+        return opa_call_io(collector, call);
+    }
+    if (collector->call_io_count == collector->call_io_capacity) {
+        uint32_t capacity = collector->call_io_capacity ? collector->call_io_capacity * 2 : 16;
+        collector->call_io = erealloc(collector->call_io, capacity * sizeof(opa_call_io_t));
+        collector->call_io_capacity = capacity;
+    }
+    opa_call_io_t *io = &collector->call_io[collector->call_io_count++];
+    memset(io, 0, sizeof(opa_call_io_t));
+    call->io = collector->call_io_count;
+    return io;
+}
+
+// Lazily create one of a call's record arrays (zval holder in the request arena)
+static zval *record_array(call_node_t *call, size_t field) {
+    opa_call_io_t *io = opa_call_io_ensure(call);
+    if (!io) {
+        return NULL;
+    }
+    zval **slot = (zval **)((char *)io + field);
+    if (!*slot) {
+        zval *array = opa_arena_alloc(&opa_request_arena, sizeof(zval));
+        if (!array) {
+            return NULL;
+        }
+        array_init(array);
+        *slot = array;
+    }
+    return *slot;
+}
 
 // Records a SQL query execution in the current function call's context
 // Tracks query text, duration, type, affected rows, database hostname, database system, and DSN for performance analysis
@@ -27,24 +64,15 @@ void record_sql_query(const char *sql, double duration, zval *params, const char
         // No active call stack - SQL queries executed at top level
         // Create a root call node to attach SQL queries to
         debug_log("[record_sql_query] No call stack, creating root call node for SQL query");
-        char *root_call_id = opa_enter_function("__root__", NULL, __FILE__, __LINE__, 0);
-        if (root_call_id) {
-            efree(root_call_id);
+        if (opa_enter_root(__FILE__, __LINE__)) {
             current_call = global_collector->call_stack_top;
         }
     }
     
     // Lazily allocate sql_queries array when first SQL query is recorded
-    if (current_call) {
-        if (!current_call->sql_queries) {
-            current_call->sql_queries = ecalloc(1, sizeof(zval));
-            if (current_call->sql_queries) {
-                array_init(current_call->sql_queries);
-            }
-        }
-    }
+    zval *sql_queries = current_call ? record_array(current_call, offsetof(opa_call_io_t, sql_queries)) : NULL;
     
-    if (current_call && current_call->sql_queries) {
+    if (sql_queries) {
         zval query_data;
         array_init(&query_data);
         
@@ -108,13 +136,13 @@ void record_sql_query(const char *sql, double duration, zval *params, const char
             add_assoc_string(&query_data, "db_dsn", (char *)db_dsn);
         }
         
-        add_next_index_zval(current_call->sql_queries, &query_data);
+        add_next_index_zval(sql_queries, &query_data);
         // query_data is copied by add_next_index_zval
         // Don't destroy or modify query_data - it's stack-allocated and will be cleaned up automatically
         // The zval contents are now owned by sql_queries array
         // Just let it go out of scope naturally
-        debug_log("[record_sql_query] SQL query added to call node: call_id=%s, sql=%s", 
-            current_call->call_id ? current_call->call_id : "NULL", sql ? sql : "NULL");
+        debug_log("[record_sql_query] SQL query added to call %u, sql=%s", 
+            current_call->index, sql ? sql : "NULL");
     } else {
         debug_log("[record_sql_query] WARNING: No current_call or sql_queries array available");
     }
@@ -226,24 +254,15 @@ void record_http_request(const char *url, const char *method, int status_code, s
     } else {
         // No active call stack - HTTP requests executed at top level
         // Create a root call node to attach HTTP requests to
-        char *root_call_id = opa_enter_function("__root__", NULL, __FILE__, __LINE__, 0);
-        if (root_call_id) {
-            efree(root_call_id);
+        if (opa_enter_root(__FILE__, __LINE__)) {
             current_call = global_collector->call_stack_top;
         }
     }
     
     // Lazily allocate http_requests array when first HTTP request is recorded
-    if (current_call) {
-        if (!current_call->http_requests) {
-            current_call->http_requests = ecalloc(1, sizeof(zval));
-            if (current_call->http_requests) {
-                array_init(current_call->http_requests);
-            }
-        }
-    }
+    zval *http_requests = current_call ? record_array(current_call, offsetof(opa_call_io_t, http_requests)) : NULL;
     
-    if (current_call && current_call->http_requests) {
+    if (http_requests) {
         zval request_data;
         array_init(&request_data);
         
@@ -268,7 +287,7 @@ void record_http_request(const char *url, const char *method, int status_code, s
         }
         add_assoc_string(&request_data, "type", "curl");
         
-        add_next_index_zval(current_call->http_requests, &request_data);
+        add_next_index_zval(http_requests, &request_data);
     }
 }
 
@@ -290,16 +309,14 @@ void record_http_request_enhanced(const char *url, const char *method, int statu
         return;
     }
     
-    call_node_t *current_call = NULL;
-    if (global_collector->call_stack_top) {
-        current_call = global_collector->call_stack_top;
-    }
+    opa_call_io_t *io = opa_call_io(global_collector, global_collector->call_stack_top);
+    zval *http_requests = io ? io->http_requests : NULL;
     
-    if (current_call && current_call->http_requests) {
+    if (http_requests) {
         // Get the last added request (most recent)
-        zend_ulong num_requests = zend_hash_num_elements(Z_ARRVAL_P(current_call->http_requests));
+        zend_ulong num_requests = zend_hash_num_elements(Z_ARRVAL_P(http_requests));
         if (num_requests > 0) {
-            zval *last_request = zend_hash_index_find(Z_ARRVAL_P(current_call->http_requests), num_requests - 1);
+            zval *last_request = zend_hash_index_find(Z_ARRVAL_P(http_requests), num_requests - 1);
             if (last_request && Z_TYPE_P(last_request) == IS_ARRAY) {
                 // Use response_size as fallback for bytes_received if bytes_received is 0
                 if (bytes_received == 0 && response_size > 0) {
@@ -366,16 +383,9 @@ void record_cache_operation(const char *key, const char *operation, int hit, dou
     }
     
     // Lazily allocate cache_operations array when first cache operation is recorded
-    if (current_call) {
-        if (!current_call->cache_operations) {
-            current_call->cache_operations = ecalloc(1, sizeof(zval));
-            if (current_call->cache_operations) {
-                array_init(current_call->cache_operations);
-            }
-        }
-    }
+    zval *cache_operations = current_call ? record_array(current_call, offsetof(opa_call_io_t, cache_operations)) : NULL;
     
-    if (current_call && current_call->cache_operations) {
+    if (cache_operations) {
         zval operation_data;
         array_init(&operation_data);
         
@@ -398,7 +408,7 @@ void record_cache_operation(const char *key, const char *operation, int hit, dou
             add_assoc_string(&operation_data, "cache_type", "apcu");
         }
         
-        add_next_index_zval(current_call->cache_operations, &operation_data);
+        add_next_index_zval(cache_operations, &operation_data);
     }
 }
 
@@ -419,16 +429,9 @@ void record_redis_operation(const char *command, const char *key, int hit, doubl
     }
     
     // Lazily allocate redis_operations array when first Redis operation is recorded
-    if (current_call) {
-        if (!current_call->redis_operations) {
-            current_call->redis_operations = ecalloc(1, sizeof(zval));
-            if (current_call->redis_operations) {
-                array_init(current_call->redis_operations);
-            }
-        }
-    }
+    zval *redis_operations = current_call ? record_array(current_call, offsetof(opa_call_io_t, redis_operations)) : NULL;
     
-    if (current_call && current_call->redis_operations) {
+    if (redis_operations) {
         zval operation_data;
         array_init(&operation_data);
         
@@ -453,7 +456,7 @@ void record_redis_operation(const char *command, const char *key, int hit, doubl
         }
         add_assoc_string(&operation_data, "type", "redis");
         
-        add_next_index_zval(current_call->redis_operations, &operation_data);
+        add_next_index_zval(redis_operations, &operation_data);
     }
 }
 
@@ -0,0 +1,279 @@
+#include "compress.h"
+#include "transport.h"
+#include "rng.h"
+#include <sys/stat.h>
+
+// Compression runs on the request thread only; contexts are reused for the
+// life of the worker process.
+#if LZ4_ENABLED
+static LZ4F_cctx *lz4_cctx = NULL;
+#endif
+#if ZSTD_ENABLED
+static ZSTD_CCtx *zstd_cctx = NULL;
+static ZSTD_CDict *zstd_cdict = NULL; // Loaded at MINIT, shared by forked workers
+#endif
+
+// Dictionary training samples written by this process
+static int samples_written = 0;
+
+// Adaptive policy state
+static int poor_streak = 0;
+static int backoff_remaining = 0;
+
+static opa_compress_stats_t compress_stats = {0};
+
+int opa_compress_codec_from_name(const char *name) {
+    if (!name || !*name || strcasecmp(name, "none") == 0 || strcmp(name, "0") == 0) {
+        return OPA_CODEC_NONE;
+    }
+    if (strcasecmp(name, "lz4") == 0 || strcmp(name, "1") == 0) {
+        return OPA_CODEC_LZ4;
+    }
+    if (strcasecmp(name, "lz4hc") == 0) {
+        return OPA_CODEC_LZ4HC;
+    }
+    if (strcasecmp(name, "zstd") == 0) {
+        return OPA_CODEC_ZSTD;
+    }
+    return -1;
+}
+
+// Load the trained dictionary named by opa.zstd_dict_path (MINIT)
+void opa_compress_init(void) {
+#if ZSTD_ENABLED
+    const char *path = OPA_G(zstd_dict_path);
+    if (!path || !*path || zstd_cdict) {
+        return;
+    }
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        debug_log("[COMPRESS] Cannot open zstd dictionary %s: errno=%d", path, errno);
+        return;
+    }
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0 || st.st_size <= 0 || st.st_size > 16 * 1024 * 1024) {
+        fclose(f);
+        debug_log("[COMPRESS] Invalid zstd dictionary %s", path);
+        return;
+    }
+    void *buf = malloc((size_t)st.st_size);
+    if (buf && fread(buf, 1, (size_t)st.st_size, f) == (size_t)st.st_size) {
+        int level = OPA_G(compression_level) > 0 ? (int)OPA_G(compression_level) : ZSTD_CLEVEL_DEFAULT;
+        // The CDict keeps its own copy; the file buffer can go
+        zstd_cdict = ZSTD_createCDict(buf, (size_t)st.st_size, level);
+        debug_log("[COMPRESS] Loaded zstd dictionary %s (%lld bytes, id=%u)", path, (long long)st.st_size,
+            zstd_cdict ? ZSTD_getDictID_fromCDict(zstd_cdict) : 0);
+    }
+    free(buf);
+    fclose(f);
+#endif
+}
+
+// Write an uncompressed payload to opa.zstd_sample_dir as one file per sample,
+// the input format of `zstd --train` (see scripts/dev/train_zstd_dict.sh).
+// Synchronous file I/O on the request thread: meant to be switched on briefly.
+// Names carry a timestamp and a random suffix, so a respawned worker that
+// reuses a PID never overwrites earlier samples.
+static void capture_sample(const struct iovec *iov, int iovcnt) {
+    const char *dir = OPA_G(zstd_sample_dir);
+    if (!dir || !*dir || samples_written >= OPA_ZSTD_MAX_SAMPLES) {
+        return;
+    }
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/opa-%ld-%d-%d-%08x.json", dir, get_timestamp_ms(), (int)getpid(),
+        samples_written, (unsigned int)opa_random_u64());
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    ssize_t w = writev(fd, iov, iovcnt > OPA_IOV_MAX ? OPA_IOV_MAX : iovcnt);
+    (void)w;
+    close(fd);
+    samples_written++;
+}
+
+#if LZ4_ENABLED
+// Stream the segments through one LZ4 frame (content size + content checksum).
+// Returns an emalloc'd frame or NULL on error.
+static char *compress_lz4_frame(const struct iovec *iov, int iovcnt, size_t len, int hc, size_t *out_len) {
+    if (!lz4_cctx) {
+        if (LZ4F_isError(LZ4F_createCompressionContext(&lz4_cctx, LZ4F_VERSION))) {
+            lz4_cctx = NULL;
+            return NULL;
+        }
+    }
+
+    LZ4F_preferences_t prefs;
+    memset(&prefs, 0, sizeof(prefs));
+    prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+    prefs.frameInfo.contentSize = len;
+    zend_long level = OPA_G(compression_level);
+    if (hc) {
+        prefs.compressionLevel = level > 0 ? (int)level : LZ4HC_CLEVEL_DEFAULT;
+    } else {
+        // Fast mode: level is the acceleration factor (1 = default, higher = faster)
+        prefs.compressionLevel = level > 1 ? (int)(1 - level) : 0;
+    }
+
+    size_t capacity = LZ4F_HEADER_SIZE_MAX + LZ4F_compressBound(0, &prefs);
+    for (int i = 0; i < iovcnt; i++) {
+        capacity += LZ4F_compressBound(iov[i].iov_len, &prefs);
+    }
+    char *dst = emalloc(capacity);
+
+    size_t off = LZ4F_compressBegin(lz4_cctx, dst, capacity, &prefs);
+    if (LZ4F_isError(off)) {
+        efree(dst);
+        return NULL;
+    }
+    for (int i = 0; i < iovcnt; i++) {
+        if (iov[i].iov_len == 0) {
+            continue;
+        }
+        size_t n = LZ4F_compressUpdate(lz4_cctx, dst + off, capacity - off, iov[i].iov_base, iov[i].iov_len, NULL);
+        if (LZ4F_isError(n)) {
+            efree(dst);
+            return NULL;
+        }
+        off += n;
+    }
+    size_t n = LZ4F_compressEnd(lz4_cctx, dst + off, capacity - off, NULL);
+    if (LZ4F_isError(n)) {
+        efree(dst);
+        return NULL;
+    }
+    *out_len = off + n;
+    return dst;
+}
+#endif
+
+#if ZSTD_ENABLED
+// Stream the segments through one zstd frame (content size + checksum, dictionary if loaded).
+// Returns an emalloc'd frame or NULL on error.
+static char *compress_zstd_frame(const struct iovec *iov, int iovcnt, size_t len, size_t *out_len) {
+    if (!zstd_cctx) {
+        zstd_cctx = ZSTD_createCCtx();
+        if (!zstd_cctx) {
+            return NULL;
+        }
+    }
+
+    ZSTD_CCtx_reset(zstd_cctx, ZSTD_reset_session_and_parameters);
+    ZSTD_CCtx_setParameter(zstd_cctx, ZSTD_c_checksumFlag, 1);
+    if (zstd_cdict) {
+        // Level and parameters come from the dictionary
+        ZSTD_CCtx_refCDict(zstd_cctx, zstd_cdict);
+    } else {
+        ZSTD_CCtx_setParameter(zstd_cctx, ZSTD_c_compressionLevel,
+            OPA_G(compression_level) > 0 ? (int)OPA_G(compression_level) : ZSTD_CLEVEL_DEFAULT);
+    }
+    ZSTD_CCtx_setPledgedSrcSize(zstd_cctx, len);
+
+    size_t capacity = ZSTD_compressBound(len);
+    char *dst = emalloc(capacity);
+    ZSTD_outBuffer out = { dst, capacity, 0 };
+    for (int i = 0; i <= iovcnt; i++) {
+        int last = (i == iovcnt);
+        ZSTD_inBuffer in = { last ? NULL : iov[i].iov_base, last ? 0 : iov[i].iov_len, 0 };
+        ZSTD_EndDirective mode = last ? ZSTD_e_end : ZSTD_e_continue;
+        size_t remaining;
+        do {
+            remaining = ZSTD_compressStream2(zstd_cctx, &out, &in, mode);
+            if (ZSTD_isError(remaining) || (out.pos == out.size && remaining != 0)) {
+                efree(dst);
+                return NULL;
+            }
+        } while (last ? remaining != 0 : in.pos < in.size);
+    }
+    *out_len = out.pos;
+    return dst;
+}
+#endif
+
+// Compress a payload given as segments with the configured codec.
+// Returns NULL when the payload should be sent raw: codec off or unavailable,
+// below opa.compression_min_size, backing off after poor ratios, or not worth it.
+char *opa_compress_iov(const struct iovec *iov, int iovcnt, size_t len, size_t *out_len) {
+    capture_sample(iov, iovcnt);
+    
+    int codec = (int)OPA_G(compression_codec);
+    if (codec == OPA_CODEC_NONE) {
+        return NULL;
+    }
+    
+    // A dictionary makes even small spans compress well
+    size_t min_size = (size_t)OPA_G(compression_min_size);
+#if ZSTD_ENABLED
+    if (codec == OPA_CODEC_ZSTD && zstd_cdict) {
+        min_size = (size_t)OPA_G(zstd_dict_min_size);
+    }
+#endif
+    if (len < min_size) {
+        return NULL;
+    }
+
+    // Incompressible traffic (already-compressed dumps, random IDs): stop paying for it for a while
+    if (backoff_remaining > 0) {
+        backoff_remaining--;
+        compress_stats.skipped_adaptive++;
+        return NULL;
+    }
+
+    char *out = NULL;
+    size_t n = 0;
+#if LZ4_ENABLED
+    if (codec == OPA_CODEC_LZ4 || codec == OPA_CODEC_LZ4HC) {
+        out = compress_lz4_frame(iov, iovcnt, len, codec == OPA_CODEC_LZ4HC, &n);
+    }
+#endif
+#if ZSTD_ENABLED
+    if (codec == OPA_CODEC_ZSTD) {
+        out = compress_zstd_frame(iov, iovcnt, len, &n);
+    }
+#endif
+    if (!out) {
+        return NULL;
+    }
+
+    if (n * 100 > len * (100 - OPA_COMPRESS_MIN_SAVING_PCT)) {
+        efree(out);
+        compress_stats.skipped_ratio++;
+        if (++poor_streak >= OPA_COMPRESS_POOR_STREAK) {
+            poor_streak = 0;
+            backoff_remaining = OPA_COMPRESS_BACKOFF;
+            debug_log("[COMPRESS] Poor ratio %d times in a row, skipping compression for %d messages",
+                OPA_COMPRESS_POOR_STREAK, OPA_COMPRESS_BACKOFF);
+        }
+        return NULL;
+    }
+
+    poor_streak = 0;
+    compress_stats.compressed++;
+    compress_stats.bytes_in += len;
+    compress_stats.bytes_out += n;
+    *out_len = n;
+    return out;
+}
+
+void opa_compress_get_stats(opa_compress_stats_t *stats) {
+    *stats = compress_stats;
+}
+
+void opa_compress_shutdown(void) {
+#if LZ4_ENABLED
+    if (lz4_cctx) {
+        LZ4F_freeCompressionContext(lz4_cctx);
+        lz4_cctx = NULL;
+    }
+#endif
+#if ZSTD_ENABLED
+    if (zstd_cctx) {
+        ZSTD_freeCCtx(zstd_cctx);
+        zstd_cctx = NULL;
+    }
+    if (zstd_cdict) {
+        ZSTD_freeCDict(zstd_cdict);
+        zstd_cdict = NULL;
+    }
+#endif
+}
@@ -0,0 +1,38 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "opa.h"
+#include <sys/uio.h>
+
+// Codecs selected by opa.compression
+#define OPA_CODEC_NONE 0
+#define OPA_CODEC_LZ4 1   // LZ4 frame, fast mode (opa.compression_level = acceleration)
+#define OPA_CODEC_LZ4HC 2 // LZ4 frame, high compression (opa.compression_level = HC level)
+#define OPA_CODEC_ZSTD 3  // zstd frame, with the dictionary from opa.zstd_dict_path if set
+
+// Samples written to opa.zstd_sample_dir per worker process (dictionary training input)
+#define OPA_ZSTD_MAX_SAMPLES 2000
+
+// A compressed payload that saves less than this (percent) is sent uncompressed
+#define OPA_COMPRESS_MIN_SAVING_PCT 10
+// After this many poor results in a row, compression is not attempted for the next OPA_COMPRESS_BACKOFF messages
+#define OPA_COMPRESS_POOR_STREAK 4
+#define OPA_COMPRESS_BACKOFF 64
+
+// Counters reported by opa_transport_stats()
+typedef struct {
+    uint64_t compressed;       // Payloads sent compressed
+    uint64_t skipped_ratio;    // Compressed but sent raw because the saving was too small
+    uint64_t skipped_adaptive; // Not attempted while backing off after poor ratios
+    uint64_t bytes_in;         // Raw bytes of compressed payloads
+    uint64_t bytes_out;        // Compressed bytes of compressed payloads
+} opa_compress_stats_t;
+
+// Compression functions
+void opa_compress_init(void); // Load the zstd dictionary (MINIT)
+int opa_compress_codec_from_name(const char *name); // -1 if unknown
+char *opa_compress_iov(const struct iovec *iov, int iovcnt, size_t len, size_t *out_len); // emalloc'd, or NULL = send raw
+void opa_compress_get_stats(opa_compress_stats_t *stats);
+void opa_compress_shutdown(void); // Free compression contexts and dictionary (MSHUTDOWN)
+
+#endif /* COMPRESS_H */
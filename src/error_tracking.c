@@ -127,9 +127,10 @@ void send_error_to_agent(int error_type, const char *error_message, const char *
     if (!OPA_G(enabled)) {
         return;
     }
+    request_error_tracked = 1; // Keep this request's trace (tail sampling)
     
     // Get current trace/span IDs
-    char *trace_id = root_span_trace_id ? root_span_trace_id : generate_id();
+    char *trace_id = root_span_trace_id ? root_span_trace_id : generate_trace_id();
     char *span_id = root_span_span_id ? root_span_span_id : generate_id();
     
     // Generate error fingerprint
@@ -340,7 +341,7 @@ void send_log_to_agent(const char *level, const char *message, const char *file,
         }
     }
     if (!trace_id) {
-        trace_id = generate_id();
+        trace_id = generate_trace_id();
         trace_id_to_free = trace_id;
     }
     
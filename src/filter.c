@@ -0,0 +1,384 @@
+#include "filter.h"
+#include <ctype.h>
+
+// Compiled opa.include / opa.exclude, read-only after MINIT
+static opa_filter_list_t include_list = {0};
+static opa_filter_list_t exclude_list = {0};
+
+// Names longer than this are lowercased into a malloc'd buffer
+#define FILTER_NAME_BUF 256
+
+static char *lower_dup(const char *s, size_t len) {
+    char *copy = malloc(len + 1);
+    if (!copy) {
+        return NULL;
+    }
+    for (size_t i = 0; i < len; i++) {
+        copy[i] = (char)tolower((unsigned char)s[i]);
+    }
+    copy[len] = '\0';
+    return copy;
+}
+
+static uint64_t name_hash(const char *s, size_t len) {
+    uint64_t h = 0xcbf29ce484222325ULL; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static int exact_insert(opa_filter_list_t *list, char *name) {
+    // Kept at most half full; rules are few and only added at MINIT
+    size_t used = 0;
+    for (size_t i = 0; i < list->exact_capacity; i++) {
+        used += list->exact[i] != NULL;
+    }
+    if ((used + 1) * 2 > list->exact_capacity) {
+        size_t capacity = list->exact_capacity ? list->exact_capacity * 2 : 16;
+        char **slots = calloc(capacity, sizeof(char *));
+        if (!slots) {
+            return -1;
+        }
+        for (size_t i = 0; i < list->exact_capacity; i++) {
+            if (list->exact[i]) {
+                size_t j = name_hash(list->exact[i], strlen(list->exact[i])) & (capacity - 1);
+                while (slots[j]) {
+                    j = (j + 1) & (capacity - 1);
+                }
+                slots[j] = list->exact[i];
+            }
+        }
+        free(list->exact);
+        list->exact = slots;
+        list->exact_capacity = capacity;
+    }
+    size_t mask = list->exact_capacity - 1;
+    size_t i = name_hash(name, strlen(name)) & mask;
+    while (list->exact[i]) {
+        if (strcmp(list->exact[i], name) == 0) {
+            free(name);
+            return 0;
+        }
+        i = (i + 1) & mask;
+    }
+    list->exact[i] = name;
+    return 0;
+}
+
+static int exact_contains(const opa_filter_list_t *list, const char *name, size_t len) {
+    if (!list->exact_capacity) {
+        return 0;
+    }
+    size_t mask = list->exact_capacity - 1;
+    size_t i = name_hash(name, len) & mask;
+    while (list->exact[i]) {
+        if (strncmp(list->exact[i], name, len) == 0 && list->exact[i][len] == '\0') {
+            return 1;
+        }
+        i = (i + 1) & mask;
+    }
+    return 0;
+}
+
+static int trie_node_new(opa_filter_node_t **nodes, int *count, int *capacity, char ch) {
+    if (*count == *capacity) {
+        int new_capacity = *capacity ? *capacity * 2 : 32;
+        opa_filter_node_t *new_nodes = realloc(*nodes, new_capacity * sizeof(opa_filter_node_t));
+        if (!new_nodes) {
+            return -1;
+        }
+        *nodes = new_nodes;
+        *capacity = new_capacity;
+    }
+    opa_filter_node_t *node = &(*nodes)[*count];
+    node->first_child = -1;
+    node->next_sibling = -1;
+    node->ch = ch;
+    node->terminal = 0;
+    return (*count)++;
+}
+
+static int trie_insert(opa_filter_node_t **nodes, int *count, int *capacity, const char *prefix, size_t len) {
+    if (*count == 0 && trie_node_new(nodes, count, capacity, 0) < 0) {
+        return -1;
+    }
+    int node = 0;
+    for (size_t i = 0; i < len; i++) {
+        int child;
+        for (child = (*nodes)[node].first_child; child >= 0; child = (*nodes)[child].next_sibling) {
+            if ((*nodes)[child].ch == prefix[i]) {
+                break;
+            }
+        }
+        if (child < 0) {
+            child = trie_node_new(nodes, count, capacity, prefix[i]);
+            if (child < 0) {
+                return -1;
+            }
+            // nodes may have moved
+            (*nodes)[child].next_sibling = (*nodes)[node].first_child;
+            (*nodes)[node].first_child = child;
+        }
+        node = child;
+    }
+    (*nodes)[node].terminal = 1;
+    return 0;
+}
+
+// Whether some rule is a prefix of s
+static int trie_has_prefix(const opa_filter_node_t *nodes, int count, const char *s, size_t len) {
+    if (count == 0) {
+        return 0;
+    }
+    int node = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (nodes[node].terminal) {
+            return 1;
+        }
+        int child;
+        for (child = nodes[node].first_child; child >= 0; child = nodes[child].next_sibling) {
+            if (nodes[child].ch == s[i]) {
+                break;
+            }
+        }
+        if (child < 0) {
+            return 0;
+        }
+        node = child;
+    }
+    return nodes[node].terminal;
+}
+
+static int list_append(char ***items, int *count, char *item) {
+    char **new_items = realloc(*items, (*count + 1) * sizeof(char *));
+    if (!new_items) {
+        return -1;
+    }
+    new_items[(*count)++] = item;
+    *items = new_items;
+    return 0;
+}
+
+// '*' matches any run of characters, '?' exactly one (iterative, backtracks to the last '*')
+static int glob_match(const char *pattern, const char *s, size_t len) {
+    const char *star = NULL;
+    size_t star_pos = 0, i = 0;
+    while (i < len) {
+        if (*pattern == '?' || (*pattern && *pattern != '*' && *pattern == s[i])) {
+            pattern++;
+            i++;
+        } else if (*pattern == '*') {
+            star = pattern++;
+            star_pos = i;
+        } else if (star) {
+            pattern = star + 1;
+            i = ++star_pos;
+        } else {
+            return 0;
+        }
+    }
+    while (*pattern == '*') {
+        pattern++;
+    }
+    return *pattern == '\0';
+}
+
+static int add_rule(opa_filter_list_t *list, const char *rule, size_t len) {
+    while (len > 1 && *rule == '\\') {
+        rule++; // Leading namespace separator
+        len--;
+    }
+    if (len == 0) {
+        return -1;
+    }
+    int is_method = memchr(rule, ':', len) != NULL;
+    int is_glob = memchr(rule, '*', len) != NULL || memchr(rule, '?', len) != NULL;
+
+    if (!is_method && memchr(rule, '/', len)) {
+        if (rule[0] == '/') {
+            return trie_insert(&list->paths, &list->path_count, &list->path_capacity, rule, len);
+        }
+        // Relative: a run of path segments anywhere in the path
+        char *segment = malloc(len + 3);
+        if (!segment) {
+            return -1;
+        }
+        segment[0] = '/';
+        memcpy(segment + 1, rule, len);
+        len++;
+        if (segment[len - 1] != '/') {
+            segment[len++] = '/';
+        }
+        segment[len] = '\0';
+        if (list_append(&list->segments, &list->segment_count, segment) < 0) {
+            free(segment);
+            return -1;
+        }
+        return 0;
+    }
+
+    char *name = lower_dup(rule, len);
+    if (!name) {
+        return -1;
+    }
+    if (is_glob) {
+        if (list_append(&list->globs, &list->glob_count, name) < 0) {
+            free(name);
+            return -1;
+        }
+        return 0;
+    }
+    if (name[len - 1] == '\\') {
+        int result = trie_insert(&list->names, &list->name_count, &list->name_capacity, name, len);
+        free(name);
+        return result;
+    }
+    return exact_insert(list, name);
+}
+
+static void compile_list(opa_filter_list_t *list, const char *rules, const char *setting) {
+    if (!rules || !*rules) {
+        return;
+    }
+    const char *p = rules;
+    while (*p) {
+        const char *end = strchr(p, ',');
+        if (!end) {
+            end = p + strlen(p);
+        }
+        const char *start = p;
+        const char *stop = end;
+        while (start < stop && isspace((unsigned char)*start)) start++;
+        while (stop > start && isspace((unsigned char)stop[-1])) stop--;
+        if (start < stop) {
+            if (add_rule(list, start, (size_t)(stop - start)) < 0) {
+                debug_log("[FILTER] Ignoring invalid %s rule: %.*s", setting, (int)(stop - start), start);
+            } else {
+                list->rule_count++;
+            }
+        }
+        p = *end ? end + 1 : end;
+    }
+    debug_log("[FILTER] Compiled %d %s rules", list->rule_count, setting);
+}
+
+static void free_list(opa_filter_list_t *list) {
+    for (size_t i = 0; i < list->exact_capacity; i++) {
+        free(list->exact[i]);
+    }
+    free(list->exact);
+    free(list->names);
+    free(list->paths);
+    for (int i = 0; i < list->glob_count; i++) {
+        free(list->globs[i]);
+    }
+    free(list->globs);
+    for (int i = 0; i < list->segment_count; i++) {
+        free(list->segments[i]);
+    }
+    free(list->segments);
+    memset(list, 0, sizeof(*list));
+}
+
+// Lowercased "class::function" (or "function") of one function
+typedef struct {
+    char *full;
+    size_t full_len;
+    size_t class_len; // Leading class name, 0 for plain functions
+} function_names_t;
+
+static int list_matches(const opa_filter_list_t *list, const function_names_t *names, zend_string *file) {
+    if (list->rule_count == 0) {
+        return 0;
+    }
+    // Class::method or function, then the class of a method
+    if (exact_contains(list, names->full, names->full_len) ||
+        (names->class_len && exact_contains(list, names->full, names->class_len))) {
+        return 1;
+    }
+    // Namespaces apply to the class of a method, or to the name of a function
+    size_t owner_len = names->class_len ? names->class_len : names->full_len;
+    if (trie_has_prefix(list->names, list->name_count, names->full, owner_len)) {
+        return 1;
+    }
+    for (int i = 0; i < list->glob_count; i++) {
+        if (glob_match(list->globs[i], names->full, names->full_len)) {
+            return 1;
+        }
+    }
+    if (file) {
+        if (trie_has_prefix(list->paths, list->path_count, ZSTR_VAL(file), ZSTR_LEN(file))) {
+            return 1;
+        }
+        for (int i = 0; i < list->segment_count; i++) {
+            if (strstr(ZSTR_VAL(file), list->segments[i])) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void opa_filter_init(void) {
+    compile_list(&include_list, OPA_G(include), "opa.include");
+    compile_list(&exclude_list, OPA_G(exclude), "opa.exclude");
+}
+
+void opa_filter_shutdown(void) {
+    free_list(&include_list);
+    free_list(&exclude_list);
+}
+
+int opa_filter_active(void) {
+    return include_list.rule_count > 0 || exclude_list.rule_count > 0;
+}
+
+int opa_filter_allows(zend_function *func) {
+    if (!opa_filter_active() || !func || !func->common.function_name) {
+        return 1;
+    }
+
+    zend_string *class_name = func->common.scope ? func->common.scope->name : NULL;
+    zend_string *function_name = func->common.function_name;
+    zend_string *file = func->type == ZEND_USER_FUNCTION ? func->op_array.filename : NULL;
+
+    char buf[FILTER_NAME_BUF];
+    size_t class_len = class_name ? ZSTR_LEN(class_name) : 0;
+    size_t full_len = (class_name ? class_len + 2 : 0) + ZSTR_LEN(function_name);
+    char *full = full_len < sizeof(buf) ? buf : malloc(full_len + 1);
+    if (!full) {
+        return 1;
+    }
+    size_t pos = 0;
+    if (class_name) {
+        for (size_t i = 0; i < class_len; i++) {
+            full[pos++] = (char)tolower((unsigned char)ZSTR_VAL(class_name)[i]);
+        }
+        full[pos++] = ':';
+        full[pos++] = ':';
+    }
+    for (size_t i = 0; i < ZSTR_LEN(function_name); i++) {
+        full[pos++] = (char)tolower((unsigned char)ZSTR_VAL(function_name)[i]);
+    }
+    full[pos] = '\0';
+
+    function_names_t names = {
+        .full = full,
+        .full_len = full_len,
+        .class_len = class_len,
+    };
+
+    int allowed = 1;
+    if (list_matches(&exclude_list, &names, file)) {
+        allowed = 0;
+    } else if (include_list.rule_count > 0 && !list_matches(&include_list, &names, file)) {
+        allowed = 0;
+    }
+
+    if (full != buf) {
+        free(full);
+    }
+    return allowed;
+}
@@ -0,0 +1,50 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "opa.h"
+
+// Function filters (opa.include / opa.exclude)
+// Comma-separated rules, compiled at MINIT and evaluated in the observer init
+// handler, whose result Zend caches per function: a filtered function gets no
+// begin/end handlers and costs nothing at run time.
+//   App\                 namespace prefix (classes and namespaced functions)
+//   App\Kernel           class name or function name
+//   App\Kernel::handle   method
+//   str_*, *::__get      glob ('*' any run, '?' one character) on Class::method or function
+//   vendor/              file path segment ("/vendor/" anywhere in the path)
+//   /srv/app/src/        file path prefix
+// Names are matched case-insensitively, paths case-sensitively. With an include
+// list only matching functions are observed; exclude wins over include.
+// Functions the extension reads I/O from (cURL, PDO, APCu, Redis, Symfony
+// Cache) are always observed.
+
+typedef struct {
+    int first_child;  // Node index, -1 if none
+    int next_sibling; // Node index, -1 if none
+    char ch;
+    char terminal;    // A prefix rule ends here
+} opa_filter_node_t;
+
+typedef struct {
+    char **exact;             // Open addressing set of lowercase names (NULL = empty slot)
+    size_t exact_capacity;    // Power of two, 0 if no exact rules
+    opa_filter_node_t *names; // Namespace prefix trie (lowercase, node 0 is the root)
+    int name_count;
+    int name_capacity;
+    opa_filter_node_t *paths; // File path prefix trie (node 0 is the root)
+    int path_count;
+    int path_capacity;
+    char **globs;             // Lowercase glob patterns
+    int glob_count;
+    char **segments;          // "/segment/" substrings
+    int segment_count;
+    int rule_count;
+} opa_filter_list_t;
+
+// Filter functions
+void opa_filter_init(void); // Compile opa.include and opa.exclude (MINIT)
+void opa_filter_shutdown(void);
+int opa_filter_active(void); // Whether any rule is configured
+int opa_filter_allows(zend_function *func); // 1 = observe the function
+
+#endif /* FILTER_H */
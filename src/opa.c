@@ -12,7 +12,16 @@
 #include "span.h"
 #include "call_node.h"
 #include "transport.h"
+#include "sender.h"
+#include "compress.h"
+#include "sampler.h"
+#include "propagation.h"
+#include "arena.h"
+#include "symbol.h"
 #include "serialize.h"
+#include "rng.h"
+#include "aggregate.h"
+#include "filter.h"
 #include <time.h>
 #include <stdio.h>
 
@@ -28,15 +37,63 @@ PHP_INI_MH(OnUpdateSamplingRate) {
     return SUCCESS;
 }
 
+// INI update handler for opa.sampling_target_tps (traces per second, 0 = off)
+PHP_INI_MH(OnUpdateTargetTps) {
+    double *p;
+    char *base = (char *) mh_arg2;
+    p = (double *) (base + (size_t) mh_arg1);
+    double tps = zend_strtod(ZSTR_VAL(new_value), NULL);
+    if (!(tps >= 0.0) || tps > 1e9) {
+        return FAILURE; // Negative, NaN or absurd
+    }
+    *p = tps;
+    return SUCCESS;
+}
+
+// Custom INI update handler for opa.compression (codec name -> OPA_CODEC_*)
+PHP_INI_MH(OnUpdateCompression) {
+    zend_long *p;
+    char *base = (char *) mh_arg2;
+    p = (zend_long *) (base + (size_t) mh_arg1);
+    int codec = opa_compress_codec_from_name(ZSTR_VAL(new_value));
+    if (codec < 0) {
+        return FAILURE;
+    }
+    *p = codec;
+    return SUCCESS;
+}
+
+// Custom INI update handler for opa.mode (tree/aggregate -> OPA_MODE_*)
+PHP_INI_MH(OnUpdateMode) {
+    zend_long *p;
+    char *base = (char *) mh_arg2;
+    p = (zend_long *) (base + (size_t) mh_arg1);
+    int mode = opa_mode_from_name(ZSTR_VAL(new_value));
+    if (mode < 0) {
+        return FAILURE;
+    }
+    *p = mode;
+    return SUCCESS;
+}
+
 // INI configuration
 PHP_INI_BEGIN()
     STD_PHP_INI_ENTRY("opa.enabled", "0", PHP_INI_ALL, OnUpdateBool, enabled, zend_opa_globals, opa_globals)
     STD_PHP_INI_ENTRY_EX("opa.sampling_rate", "1.0", PHP_INI_ALL, OnUpdateSamplingRate, sampling_rate, zend_opa_globals, opa_globals, NULL)
+    STD_PHP_INI_ENTRY_EX("opa.sampling_target_tps", "0", PHP_INI_SYSTEM, OnUpdateTargetTps, sampling_target_tps, zend_opa_globals, opa_globals, NULL)
+    STD_PHP_INI_ENTRY("opa.sampling_rules", "", PHP_INI_SYSTEM, OnUpdateString, sampling_rules, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.trace_propagation", "1", PHP_INI_ALL, OnUpdateBool, trace_propagation, zend_opa_globals, opa_globals)
     STD_PHP_INI_ENTRY("opa.socket_path", "/var/run/opa.sock", PHP_INI_ALL, OnUpdateString, socket_path, zend_opa_globals, opa_globals)
-    STD_PHP_INI_ENTRY("opa.full_capture_threshold_ms", "100", PHP_INI_ALL, OnUpdateLong, full_capture_threshold_ms, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.full_capture_threshold_ms", "0", PHP_INI_ALL, OnUpdateLong, full_capture_threshold_ms, zend_opa_globals, opa_globals)
     STD_PHP_INI_ENTRY("opa.stack_depth", "20", PHP_INI_ALL, OnUpdateLong, stack_depth, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.max_calls", "100000", PHP_INI_ALL, OnUpdateLong, max_calls, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.max_call_bytes", "33554432", PHP_INI_ALL, OnUpdateLong, max_call_bytes, zend_opa_globals, opa_globals)
     STD_PHP_INI_ENTRY("opa.buffer_size", "65536", PHP_INI_ALL, OnUpdateLong, buffer_size, zend_opa_globals, opa_globals)
     STD_PHP_INI_ENTRY("opa.collect_internal_functions", "0", PHP_INI_ALL, OnUpdateBool, collect_internal_functions, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.call_cpu_time", "1", PHP_INI_ALL, OnUpdateBool, call_cpu_time, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.mode", "tree", PHP_INI_SYSTEM | PHP_INI_PERDIR, OnUpdateMode, mode, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.include", "", PHP_INI_SYSTEM, OnUpdateString, include, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.exclude", "", PHP_INI_SYSTEM, OnUpdateString, exclude, zend_opa_globals, opa_globals)
     STD_PHP_INI_ENTRY("opa.debug_log", "0", PHP_INI_ALL, OnUpdateBool, debug_log_enabled, zend_opa_globals, opa_globals)
     STD_PHP_INI_ENTRY("opa.organization_id", "default-org", PHP_INI_ALL, OnUpdateString, organization_id, zend_opa_globals, opa_globals)
     STD_PHP_INI_ENTRY("opa.project_id", "default-project", PHP_INI_ALL, OnUpdateString, project_id, zend_opa_globals, opa_globals)
@@ -49,6 +106,23 @@ PHP_INI_BEGIN()
     STD_PHP_INI_ENTRY("opa.track_logs", "1", PHP_INI_ALL, OnUpdateBool, track_logs, zend_opa_globals, opa_globals)
     STD_PHP_INI_ENTRY("opa.log_levels", "critical,error", PHP_INI_ALL, OnUpdateString, log_levels, zend_opa_globals, opa_globals)
     STD_PHP_INI_ENTRY("opa.expand_spans", "1", PHP_INI_ALL, OnUpdateBool, expand_spans, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.async_send", "0", PHP_INI_SYSTEM, OnUpdateBool, async_send, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.async_queue_size", "1024", PHP_INI_SYSTEM, OnUpdateLong, async_queue_size, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.shm_size", "8388608", PHP_INI_SYSTEM, OnUpdateLong, shm_size, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.compression", "lz4", PHP_INI_ALL, OnUpdateCompression, compression_codec, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.compression_level", "0", PHP_INI_ALL, OnUpdateLong, compression_level, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.compression_min_size", "1024", PHP_INI_ALL, OnUpdateLong, compression_min_size, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.zstd_dict_path", "", PHP_INI_SYSTEM, OnUpdateString, zstd_dict_path, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.zstd_dict_min_size", "128", PHP_INI_ALL, OnUpdateLong, zstd_dict_min_size, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.zstd_sample_dir", "", PHP_INI_SYSTEM, OnUpdateString, zstd_sample_dir, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.dns_refresh_sec", "30", PHP_INI_SYSTEM, OnUpdateLong, dns_refresh_sec, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.send_timeout_ms", "100", PHP_INI_SYSTEM, OnUpdateLong, send_timeout_ms, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.breaker_threshold", "3", PHP_INI_SYSTEM, OnUpdateLong, breaker_threshold, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.breaker_backoff_ms", "1000", PHP_INI_SYSTEM, OnUpdateLong, breaker_backoff_ms, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.breaker_max_backoff_ms", "60000", PHP_INI_SYSTEM, OnUpdateLong, breaker_max_backoff_ms, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.spool_dir", "", PHP_INI_SYSTEM, OnUpdateString, spool_dir, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.spool_max_bytes", "67108864", PHP_INI_SYSTEM, OnUpdateLong, spool_max_bytes, zend_opa_globals, opa_globals)
+    STD_PHP_INI_ENTRY("opa.spool_segment_size", "4194304", PHP_INI_SYSTEM, OnUpdateLong, spool_segment_size, zend_opa_globals, opa_globals)
 PHP_INI_END()
 
 // Global state (declared in opa.h, defined here)
@@ -58,6 +132,7 @@ pthread_mutex_t active_spans_mutex = PTHREAD_MUTEX_INITIALIZER;
 char *root_span_trace_id = NULL;
 char *root_span_span_id = NULL;
 char *root_span_parent_id = NULL;
+char *root_span_tracestate = NULL; // Incoming W3C tracestate, forwarded on outgoing requests
 char *root_span_name = NULL;
 char *root_span_url_scheme = NULL;
 char *root_span_url_host = NULL;
@@ -72,6 +147,13 @@ int root_span_status = -1;
 zval *root_span_dumps = NULL; // Root span dumps array (emalloc'd, valid until RSHUTDOWN)
 pthread_mutex_t root_span_data_mutex = PTHREAD_MUTEX_INITIALIZER;
 int profiling_active = 0;
+int request_sampled = 1; // Head sampling decision for the current request (RINIT)
+int request_error_tracked = 0; // An error was sent for the current request (keeps the trace in tail sampling)
+double request_sample_rate = 1.0; // Probability the current trace was kept with, reported in the root span
+static double request_route_rate = -1.0; // Rate of the matching opa.sampling_rules entry (-1 = none)
+// Caller's trace context from an incoming traceparent header
+static opa_trace_context_t incoming_trace_ctx;
+static int incoming_trace_valid = 0;
 opa_collector_t *global_collector = NULL; 
 size_t network_bytes_sent_total = 0;
 size_t network_bytes_received_total = 0;
@@ -93,25 +175,17 @@ static __thread int in_opa_observer = 0;
 // static timer_t sampling_timer;
 // static int sampling_enabled = 0;
 
-// Helper: Generate unique ID
-// CRITICAL: This function must NOT call any PHP functions that could trigger observers
-// Use manual hex conversion to avoid any PHP function interception (sprintf/snprintf)
+// Helper: Generate a random 64-bit id (16 hex digits, emalloc'd)
 char* generate_id() {
-    char *id = emalloc(17);
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    // Manual hex conversion to avoid triggering PHP function observers
-    // Format: 16 hex digits + null terminator
-    unsigned long value = (unsigned long)(tv.tv_sec * 1000000 + tv.tv_usec) ^ (unsigned long)pthread_self();
-    
-    // Manual hex conversion - no PHP functions called
-    static const char hex_chars[] = "0123456789abcdef";
-    int i;
-    for (i = 15; i >= 0; i--) {
-        id[i] = hex_chars[value & 0xf];
-        value >>= 4;
-    }
-    id[16] = '\0'; // Ensure null termination
+    char *id = emalloc(OPA_SPAN_ID_HEX_LEN + 1);
+    opa_id_hex64(id, opa_span_id_new());
+    return id;
+}
+
+// Helper: Generate a random 128-bit trace id (32 hex digits, emalloc'd)
+char* generate_trace_id() {
+    char *id = emalloc(OPA_TRACE_ID_HEX_LEN + 1);
+    opa_id_hex128(id, opa_trace_id_new());
     return id;
 }
 
@@ -134,15 +208,47 @@ size_t get_memory_usage() {
     return zend_memory_usage(0);
 }
 
-// Helper: Get current CPU time (user + system) in seconds
-double get_cpu_time() {
-    struct rusage usage;
-    if (getrusage(RUSAGE_SELF, &usage) == 0) {
-        double user_time = (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1000000.0;
-        double system_time = (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1000000.0;
-        return user_time + system_time;
+// Helper: Monotonic time in nanoseconds (call records and durations)
+// Served from the vDSO without a syscall and never steps when the wall clock is adjusted
+int64_t get_time_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Helper: CPU time of the calling thread in nanoseconds
+// Much cheaper than getrusage(), which also gathers every other resource counter
+int64_t get_cpu_time_ns() {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+    return 0;
+}
+
+// Helper: Seconds elapsed since a get_time_ns() reading
+double get_elapsed_seconds(int64_t since_ns) {
+    return (double)(get_time_ns() - since_ns) / 1000000000.0;
+}
+
+// Wall clock anchor of the current request: one wall clock reading paired with a
+// monotonic one. Monotonic call times are converted to epoch milliseconds through it
+static long request_anchor_wall_ms = 0;
+static int64_t request_anchor_mono_ns = 0;
+
+// Take the request's anchor (when the root span starts); returns the wall clock time in ms
+long opa_clock_anchor_request(void) {
+    request_anchor_mono_ns = get_time_ns();
+    request_anchor_wall_ms = get_timestamp_ms();
+    return request_anchor_wall_ms;
+}
+
+// Epoch milliseconds of a get_time_ns() reading taken during the current request
+long opa_clock_wall_ms(int64_t mono_ns) {
+    if (request_anchor_mono_ns == 0) {
+        opa_clock_anchor_request();
     }
-    return 0.0;
+    return request_anchor_wall_ms + (long)((mono_ns - request_anchor_mono_ns) / 1000000);
 }
 
 // Helper: Get network bytes sent
@@ -1447,12 +1553,22 @@ char* serialize_http_response_json(void) {
     return result;
 }
 
+// opa.debug_log as of the last MINIT/RINIT, for threads PHP doesn't know about
+// (OPA_G is not valid there under ZTS, and races with the request thread under NTS)
+static int debug_log_shared = 0;
+static __thread int debug_log_detached = 0;
+
+void opa_debug_log_detach_thread(void) {
+    debug_log_detached = 1;
+}
+
 // Conditional debug logging - only writes when opa.debug_log INI setting is enabled
 // Writes to /tmp/opa_debug.log or /app/logs/opa_debug.log
 // Note: Cannot use php_error_docref() as it causes fatal errors in RSHUTDOWN with Symfony's error handler
 void debug_log(const char *msg, ...) {
     // Early return if debug logging is disabled
-    if (!OPA_G(debug_log_enabled)) {
+    int enabled = debug_log_detached ? __atomic_load_n(&debug_log_shared, __ATOMIC_RELAXED) : OPA_G(debug_log_enabled);
+    if (!enabled) {
         return;
     }
     
@@ -1471,9 +1587,10 @@ void debug_log(const char *msg, ...) {
         if (log) {
             // Get timestamp 
             time_t now = time(NULL);
-            struct tm *tm_info = localtime(&now);
+            struct tm tm_info;
+            localtime_r(&now, &tm_info);
             char timestamp[64];
-            strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", tm_info);
+            strftime(timestamp, sizeof(timestamp), "%Y-%m-%d %H:%M:%S", &tm_info);
             
             fprintf(log, "[%s] [%s:%d:%s] %s\n", timestamp, __FILE__, __LINE__, __FUNCTION__, buffer);
             fflush(log);
@@ -1989,11 +2106,16 @@ opa_collector_t* opa_collector_init(void) {
     }
     
     collector->magic = OPA_COLLECTOR_MAGIC;
-    collector->calls = NULL;
+    collector->call_blocks = NULL;
+    collector->call_block_capacity = 0;
+    collector->call_io = NULL;
+    collector->call_io_count = 0;
+    collector->call_io_capacity = 0;
     collector->call_stack_top = NULL;
     collector->call_stack_depth = 0;
-    collector->call_depth = 0;
     collector->call_count = 0;
+    collector->calls_summarized = 0;
+    collector->summary_depth = 0;
     collector->active = 0;
     collector->global_sql_queries = NULL;
     pthread_mutex_init(&collector->global_sql_mutex, NULL);
@@ -2001,6 +2123,18 @@ opa_collector_t* opa_collector_init(void) {
     return collector;
 }
 
+// Destroy the record arrays of the I/O side table
+static void collector_release_call_io(opa_collector_t *collector) {
+    for (uint32_t i = 0; i < collector->call_io_count; i++) {
+        opa_call_io_t *io = &collector->call_io[i];
+        if (io->sql_queries) zval_ptr_dtor(io->sql_queries);
+        if (io->http_requests) zval_ptr_dtor(io->http_requests);
+        if (io->cache_operations) zval_ptr_dtor(io->cache_operations);
+        if (io->redis_operations) zval_ptr_dtor(io->redis_operations);
+    }
+    collector->call_io_count = 0;
+}
+
 // Activate collector and reset all counters/timers for a new request
 // Must be called at the start of each request to begin profiling
 void opa_collector_start(opa_collector_t *collector) {
@@ -2013,9 +2147,14 @@ void opa_collector_start(opa_collector_t *collector) {
     collector->start_memory = get_memory_usage();
     collector->call_stack_top = NULL;
     collector->call_stack_depth = 0;
-    collector->call_depth = 0;
     collector->call_count = 0;
-    collector->calls = NULL;
+    collector->calls_summarized = 0;
+    collector->summary_depth = 0;
+    collector->aggregate = OPA_G(mode) == OPA_MODE_AGGREGATE;
+    collector_release_call_io(collector);
+    
+    // Call ids are a per-request base plus the record index
+    collector->call_id_base = opa_span_id_new();
     
     // Initialize global SQL queries array
     pthread_mutex_lock(&collector->global_sql_mutex);
@@ -2057,154 +2196,253 @@ void opa_collector_free(opa_collector_t *collector) {
     pthread_mutex_unlock(&collector->global_sql_mutex);
     pthread_mutex_destroy(&collector->global_sql_mutex);
     
-    // Free all calls
-    call_node_t *call = collector->calls;
-    while (call) {
-        call_node_t *next = call->next;
-        if (call->magic == OPA_CALL_NODE_MAGIC) {
-            // Free all estrdup'd strings
-            if (call->call_id) efree(call->call_id);
-            if (call->function_name) efree(call->function_name);
-            if (call->class_name) efree(call->class_name);
-            if (call->file) efree(call->file);
-            if (call->parent_id) efree(call->parent_id);
-            
-            // Free all zval arrays
-            if (call->sql_queries) {
-                zval_ptr_dtor(call->sql_queries);
-                efree(call->sql_queries);
-            }
-            if (call->http_requests) {
-                zval_ptr_dtor(call->http_requests);
-                efree(call->http_requests);
-            }
-            if (call->cache_operations) {
-                zval_ptr_dtor(call->cache_operations);
-                efree(call->cache_operations);
-            }
-            if (call->redis_operations) {
-                zval_ptr_dtor(call->redis_operations);
-                efree(call->redis_operations);
-            }
-            if (call->children) {
-                zval_ptr_dtor(call->children);
-                efree(call->children);
-            }
-            
-            call->magic = 0;
-            efree(call);
-        }
-        call = next;
+    // Records and their blocks live in the request arena; only the I/O side
+    // table holds PHP arrays that need a destructor
+    collector_release_call_io(collector);
+    if (collector->call_io) {
+        efree(collector->call_io);
+        collector->call_io = NULL;
     }
+    collector->call_io_capacity = 0;
+    collector->call_blocks = NULL;
+    collector->call_block_capacity = 0;
+    collector->call_count = 0;
+    collector->call_stack_top = NULL;
+    opa_aggregate_reset();
+    opa_symbol_reset();
+    opa_arena_reset(&opa_request_arena);
     
     collector->magic = 0;
     efree(collector);
 }
 
 // Call tracking functions ()
-char* opa_enter_function(const char *function_name, const char *class_name, const char *file, int line, int function_type) {
-    if (!global_collector || !global_collector->active || global_collector->magic != OPA_COLLECTOR_MAGIC) {
-        return NULL;
+// Record slot for a new call: the next one in call order, or in aggregate mode
+// the one at the current stack position (records are reused as a stack).
+// Blocks are never moved, the block table doubles
+static call_node_t* alloc_call_record(opa_collector_t *collector) {
+    uint32_t index = collector->aggregate ? (uint32_t)collector->call_stack_depth : (uint32_t)collector->call_count;
+    if (index < (uint32_t)collector->call_count) {
+        return OPA_CALL_AT(collector, index);
+    }
+    uint32_t block = index >> OPA_CALL_BLOCK_SHIFT;
+    if ((index & (OPA_CALL_BLOCK_SIZE - 1)) == 0) {
+        if (block == collector->call_block_capacity) {
+            uint32_t capacity = collector->call_block_capacity ? collector->call_block_capacity * 2 : 16;
+            call_node_t **blocks = opa_arena_alloc(&opa_request_arena, capacity * sizeof(call_node_t *));
+            if (!blocks) {
+                return NULL;
+            }
+            if (collector->call_blocks) {
+                memcpy(blocks, collector->call_blocks, collector->call_block_capacity * sizeof(call_node_t *));
+            }
+            collector->call_blocks = blocks;
+            collector->call_block_capacity = capacity;
+        }
+        collector->call_blocks[block] = opa_arena_alloc(&opa_request_arena, OPA_CALL_BLOCK_SIZE * sizeof(call_node_t));
+        if (!collector->call_blocks[block]) {
+            return NULL;
+        }
     }
-    
+    call_node_t *call = OPA_CALL_AT(collector, index);
+    call->index = index;
+    collector->call_count++;
+    return call;
+}
+
+static call_node_t* enter_call(uint32_t function_name, uint32_t class_name, uint32_t file, int line, int function_type) {
     opa_collector_t *collector = global_collector;
     
-    // Create call node
-    call_node_t *call = emalloc(sizeof(call_node_t));
+    call_node_t *call = alloc_call_record(collector);
     if (!call) {
         return NULL;
     }
-    memset(call, 0, sizeof(call_node_t));
-    call->magic = OPA_CALL_NODE_MAGIC;
-    
-    call->call_id = generate_id();
-    call->start_time = get_time_seconds();
-    call->start_cpu_time = get_cpu_time();
-    call->start_memory = get_memory_usage();
-    call->start_bytes_sent = get_bytes_sent();
-    call->start_bytes_received = get_bytes_received();
-    
-    if (function_name) {
-        call->function_name = estrdup(function_name);
-    }
-    if (class_name) {
-        call->class_name = estrdup(class_name);
-    }
-    if (file) {
-        call->file = estrdup(file);
-    }
-    call->line = line;
-    call->function_type = function_type;
-    call->depth = collector->call_depth;
-    
-    // Set parent from call stack (no depth limit)
-    debug_log("[enter_function] call_stack_depth=%d, function=%s", 
-        collector->call_stack_depth, function_name ? function_name : "NULL");
-    if (collector->call_stack_top) {
-        call_node_t *parent = collector->call_stack_top;
-        if (parent && parent->magic == OPA_CALL_NODE_MAGIC && parent->call_id) {
-            call->parent_id = estrdup(parent->call_id);
-            debug_log("[enter_function] Set parent_id=%s for call_id=%s (depth=%d)", 
-                parent->call_id, call->call_id, collector->call_stack_depth);
-        } else {
-            debug_log("[enter_function] No valid parent (parent=%p, magic=%08X)", 
-                parent, parent ? parent->magic : 0);
-        }
-    } else {
-        debug_log("[enter_function] No parent (depth=%d), root call for %s", 
-            collector->call_stack_depth, function_name ? function_name : "NULL");
-    }
-    
-    // Add to list
-    call->next = collector->calls;
-    collector->calls = call;
-    
-    // Push to stack (no depth limit - linked list)
-    call->stack_next = collector->call_stack_top;
+    call->function_name = function_name;
+    call->class_name = class_name;
+    call->file = file;
+    call->line = line > 0 ? (uint32_t)line : 0;
+    call->io = 0;
+    call->depth = collector->call_stack_depth > 0xFFFF ? 0xFFFF : (uint16_t)collector->call_stack_depth;
+    call->function_type = (uint8_t)function_type;
+    call->start_ns = get_time_ns();
+    call->end_ns = 0;
+    call->start_cpu_ns = OPA_G(call_cpu_time) ? get_cpu_time_ns() : 0;
+    call->end_cpu_ns = 0;
+    call->memory = (int64_t)get_memory_usage();
+    call->bytes_sent = (int64_t)get_bytes_sent();
+    call->bytes_received = (int64_t)get_bytes_received();
+    
+    // The caller is the top of the call stack
+    call->parent = collector->call_stack_top ? collector->call_stack_top->index : OPA_CALL_NONE;
     collector->call_stack_top = call;
     collector->call_stack_depth++;
-    debug_log("[enter_function] Pushed to stack: depth=%d, function=%s, call_id=%s", 
-        collector->call_stack_depth, function_name ? function_name : "NULL", call->call_id);
     
-    collector->call_depth++;
-    collector->call_count++;
+    if (collector->aggregate) {
+        opa_aggregate_enter(call);
+    }
     
-    // Return copy of ID for caller to free
-    char *call_id_copy = estrdup(call->call_id);
-    return call_id_copy;
+    return call;
+}
+
+// Handed out for calls past the budget: they get no record and are summarized
+// on the deepest recorded call (opa_call_io_t.truncated_*)
+static call_node_t summarized_call = { .index = OPA_CALL_NONE, .parent = OPA_CALL_NONE };
+
+// Depth, record and byte budgets of the request (opa.stack_depth, opa.max_calls, opa.max_call_bytes).
+// Once a call is summarized, everything it calls is too: none of the budgets can recover before it returns
+static int call_budget_exceeded(opa_collector_t *collector) {
+    if (OPA_G(stack_depth) > 0 && collector->call_stack_depth >= OPA_G(stack_depth)) {
+        return 1;
+    }
+    if (OPA_G(max_calls) > 0 && collector->call_count >= OPA_G(max_calls)) {
+        return 1;
+    }
+    if (OPA_G(max_call_bytes) > 0 &&
+        opa_request_arena.used + (size_t)collector->call_io_capacity * sizeof(opa_call_io_t) >= (size_t)OPA_G(max_call_bytes)) {
+        return 1;
+    }
+    return 0;
+}
+
+static call_node_t* enter_summarized_call(opa_collector_t *collector) {
+    collector->calls_summarized++;
+    if (collector->summary_depth++ == 0) {
+        collector->summary_start_ns = get_time_ns();
+    }
+    if (collector->call_stack_top && !collector->aggregate) {
+        opa_call_io_t *io = opa_call_io_ensure(collector->call_stack_top);
+        if (io) {
+            io->truncated_calls++;
+        }
+    }
+    return &summarized_call;
+}
+
+// Charge the time of the outermost summarized call to the deepest recorded one
+static void end_summarized_calls(opa_collector_t *collector) {
+    int64_t elapsed = get_time_ns() - collector->summary_start_ns;
+    collector->summary_depth = 0;
+    if (collector->call_stack_top && !collector->aggregate) {
+        opa_call_io_t *io = opa_call_io_ensure(collector->call_stack_top);
+        if (io) {
+            io->truncated_ns += elapsed;
+        }
+    }
+}
+
+// Names are referenced through the request's symbol table, not copied
+// Returns the new call record (or the summarized-call marker past the budget),
+// which the caller hands back to opa_exit_function()
+call_node_t* opa_enter_function(zend_string *function_name, zend_string *class_name, zend_string *file, int line, int function_type) {
+    if (!global_collector || !global_collector->active || global_collector->magic != OPA_COLLECTOR_MAGIC) {
+        return NULL;
+    }
+    if (global_collector->summary_depth > 0 || call_budget_exceeded(global_collector)) {
+        return enter_summarized_call(global_collector);
+    }
+    return enter_call(opa_symbol_intern(function_name), opa_symbol_intern(class_name), opa_symbol_intern(file), line, function_type);
 }
 
-void opa_exit_function(const char *call_id) {
-    if (!global_collector || !global_collector->active || !call_id) {
+// Synthetic "__root__" call for records made outside any tracked call (never exits)
+call_node_t* opa_enter_root(const char *file, int line) {
+    if (!global_collector || !global_collector->active || global_collector->magic != OPA_COLLECTOR_MAGIC) {
+        return NULL;
+    }
+    if (call_budget_exceeded(global_collector)) {
+        return NULL; // The I/O record stays in the request-wide arrays only
+    }
+    return enter_call(opa_symbol_from_cstr("__root__"), 0, opa_symbol_from_cstr(file), line, 0);
+}
+
+// Constant time: the exiting call is normally the top of the call stack
+void opa_exit_function(call_node_t *call) {
+    if (!global_collector || !global_collector->active || !call) {
         return;
     }
     
     opa_collector_t *collector = global_collector;
     
-    // Find call by ID
-    call_node_t *call = collector->calls;
-    while (call) {
-        if (call->magic == OPA_CALL_NODE_MAGIC && call->call_id && strcmp(call->call_id, call_id) == 0) {
-            // Update end times
-            call->end_time = get_time_seconds();
-            call->end_cpu_time = get_cpu_time();
-            call->end_memory = get_memory_usage();
-            call->end_bytes_sent = get_bytes_sent();
-            call->end_bytes_received = get_bytes_received();
-            
-            // Pop from stack (no limit - linked list)
-            if (collector->call_stack_top && collector->call_stack_top->magic == OPA_CALL_NODE_MAGIC && 
-                collector->call_stack_top->call_id && strcmp(collector->call_stack_top->call_id, call_id) == 0) {
-                collector->call_stack_top = collector->call_stack_top->stack_next;
-                if (collector->call_stack_depth > 0) {
-                    collector->call_stack_depth--;
-                }
+    if (call == &summarized_call) {
+        if (collector->summary_depth > 0 && --collector->summary_depth == 0) {
+            end_summarized_calls(collector);
+        }
+        return;
+    }
+    if (collector->summary_depth > 0) {
+        // Summarized calls above this one never got their exit
+        end_summarized_calls(collector);
+    }
+    
+    if (collector->call_stack_top != call) {
+        // Calls above it never got their exit (or the record belongs to an earlier collector run).
+        // Compare pointers only: the record is not dereferenced until it is known to be on the stack
+        call_node_t *node = collector->call_stack_top;
+        while (node && node != call) {
+            node = opa_call_get(collector, node->parent);
+        }
+        if (!node) {
+            debug_log("[exit_function] Call %p is not on the call stack, ignoring", call);
+            return;
+        }
+        while (collector->call_stack_top != call) {
+            collector->call_stack_top = opa_call_get(collector, collector->call_stack_top->parent);
+            if (collector->call_stack_depth > 0) {
+                collector->call_stack_depth--;
             }
-            
-            break;
         }
-        call = call->next;
     }
+    
+    // End times; counters become deltas
+    call->end_ns = get_time_ns();
+    call->end_cpu_ns = OPA_G(call_cpu_time) ? get_cpu_time_ns() : 0;
+    call->memory = (int64_t)get_memory_usage() - call->memory;
+    call->bytes_sent = (int64_t)get_bytes_sent() - call->bytes_sent;
+    call->bytes_received = (int64_t)get_bytes_received() - call->bytes_received;
+    
+    // Pop from stack
+    collector->call_stack_top = opa_call_get(collector, call->parent);
+    if (collector->call_stack_depth > 0) {
+        collector->call_stack_depth--;
+    }
+    
+    // Aggregate mode: fold into the caller -> callee edge; the record is reused by the next call
+    if (collector->aggregate) {
+        opa_aggregate_exit(call, collector->call_stack_top);
+    }
+}
+
+// Record at index, NULL if out of range (OPA_CALL_NONE included)
+call_node_t* opa_call_get(opa_collector_t *collector, uint32_t index) {
+    if (!collector || index >= (uint32_t)collector->call_count) {
+        return NULL;
+    }
+    return OPA_CALL_AT(collector, index);
+}
+
+opa_call_io_t* opa_call_io(opa_collector_t *collector, call_node_t *call) {
+    if (!collector || !call || call->io == 0 || call->io > collector->call_io_count) {
+        return NULL;
+    }
+    return &collector->call_io[call->io - 1];
+}
+
+void opa_call_format_id(opa_collector_t *collector, uint32_t index, char *buf) {
+    opa_id_hex64(buf, collector->call_id_base + index);
+}
+
+// Calls with I/O records or longer than 10ms become spans of their own
+int opa_call_is_significant(opa_collector_t *collector, call_node_t *call) {
+    opa_call_io_t *io = opa_call_io(collector, call);
+    if (io) {
+        if ((io->sql_queries && Z_TYPE_P(io->sql_queries) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(io->sql_queries)) > 0) ||
+            (io->http_requests && Z_TYPE_P(io->http_requests) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(io->http_requests)) > 0) ||
+            (io->cache_operations && Z_TYPE_P(io->cache_operations) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(io->cache_operations)) > 0) ||
+            (io->redis_operations && Z_TYPE_P(io->redis_operations) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(io->redis_operations)) > 0)) {
+            return 1;
+        }
+    }
+    int64_t end_ns = call->end_ns > 0 ? call->end_ns : call->start_ns + 1000000; // Unfinished: 1ms
+    return end_ns - call->start_ns > 10000000;
 }
 
 // zend_execute_ex hook ()
@@ -2312,16 +2550,19 @@ void opa_execute_ex(zend_execute_data *execute_data) {
         }
     }
     
-    char *call_id = NULL;
+    call_node_t *call = NULL;
     
     // Only track if we have valid function info
     // NOTE: debug_log calls disabled to prevent segfaults - they may trigger recursion or access unsafe globals
     if (function_name || class_name) {
         // debug_log("[execute_ex] Entering function: %s::%s (type=%d)", 
         //     class_name ? class_name : "NULL", function_name ? function_name : "NULL", function_type);
-        call_id = opa_enter_function(function_name, class_name, file, line, function_type);
-        // if (call_id) {
-        //     debug_log("[execute_ex] Entered function: %s, call_id=%s", function_name ? function_name : "NULL", call_id);
+        call = opa_enter_function(func->common.function_name,
+            class_name ? func->common.scope->name : NULL,
+            file ? func->op_array.filename : NULL,
+            line, function_type);
+        // if (call) {
+        //     debug_log("[execute_ex] Entered function: %s, index=%u", function_name ? function_name : "NULL", call->index);
         // } else {
         //     debug_log("[execute_ex] Failed to enter function: %s", function_name ? function_name : "NULL");
         // }
@@ -2374,10 +2615,10 @@ void opa_execute_ex(zend_execute_data *execute_data) {
     }
     
     char *sql = NULL;
-    double query_start_time = 0.0;
+    int64_t query_start_ns = 0;
     
     if (pdo_method && execute_data) {
-        query_start_time = get_time_seconds();
+        query_start_ns = get_time_ns();
         // debug_log("[execute_ex] PDO method detected BEFORE execution: function_name=%s, class_name=%s", 
         //     function_name ? function_name : "NULL", class_name ? class_name : "NULL");
         
@@ -2436,7 +2677,7 @@ void opa_execute_ex(zend_execute_data *execute_data) {
     // Check for curl_exec in BEFORE section (capture timing and handle before execution)
     int curl_func_before = 0;
     zval *curl_handle_before = NULL;
-    double curl_start_time = 0.0;
+    int64_t curl_start_ns = 0;
     size_t curl_bytes_sent_before = 0;
     size_t curl_bytes_received_before = 0;
     
@@ -2469,7 +2710,7 @@ void opa_execute_ex(zend_execute_data *execute_data) {
                     (class_name_len == sizeof("CurlShareHandle")-1 && memcmp(class_name, "CurlShareHandle", sizeof("CurlShareHandle")-1) == 0)) {
                     curl_func_before = 1;
                     curl_handle_before = arg1_before;
-                    curl_start_time = get_time_seconds();
+                    curl_start_ns = get_time_ns();
                     curl_bytes_sent_before = get_bytes_sent();
                     curl_bytes_received_before = get_bytes_received();
                     debug_log("[execute_ex] BEFORE: Detected curl call, storing handle");
@@ -2481,7 +2722,7 @@ void opa_execute_ex(zend_execute_data *execute_data) {
     // Fallback: function name detection
     if (function_name && strcmp(function_name, "curl_exec") == 0) {
         curl_func_before = 1;
-        curl_start_time = get_time_seconds();
+        curl_start_ns = get_time_ns();
         curl_bytes_sent_before = get_bytes_sent();
         curl_bytes_received_before = get_bytes_received();
     }
@@ -2490,10 +2731,10 @@ void opa_execute_ex(zend_execute_data *execute_data) {
     int apcu_func = is_apcu_function(execute_data);
     char *apcu_key = NULL;
     const char *apcu_operation = NULL;
-    double apcu_start_time = 0.0;
+    int64_t apcu_start_ns = 0;
     
     if (apcu_func && execute_data && function_name) {
-        apcu_start_time = get_time_seconds();
+        apcu_start_ns = get_time_ns();
         apcu_operation = function_name;
         
         // Get key from first argument for fetch/store/delete/exists
@@ -2521,13 +2762,12 @@ void opa_execute_ex(zend_execute_data *execute_data) {
     
     // Capture SQL query AFTER execution if it's a PDO method
     if (pdo_method && sql) {
-        double query_end_time = get_time_seconds();
-        double query_duration = query_end_time - query_start_time;
+        double query_duration = get_elapsed_seconds(query_start_ns);
         const char *query_type = function_name ? function_name : "PDO";
         int rows_affected = -1;
         
-        debug_log("[execute_ex] PDO method detected: pdo_method=%d, sql=%s, call_id=%s, function_name=%s, class_name=%s", 
-            pdo_method, sql ? sql : "NULL", call_id ? call_id : "NULL", 
+        debug_log("[execute_ex] PDO method detected: pdo_method=%d, sql=%s, call=%d, function_name=%s, class_name=%s", 
+            pdo_method, sql ? sql : "NULL", call ? (int)call->index : -1, 
             function_name ? function_name : "NULL", class_name ? class_name : "NULL");
         
         // ALWAYS record SQL query - use global collector's global_sql_queries array
@@ -2547,7 +2787,7 @@ void opa_execute_ex(zend_execute_data *execute_data) {
                 add_assoc_string(&query_data, "query", sql);
                 add_assoc_double(&query_data, "duration", query_duration);
                 add_assoc_double(&query_data, "duration_ms", query_duration * 1000.0);
-                add_assoc_double(&query_data, "timestamp", query_start_time);
+                add_assoc_double(&query_data, "timestamp", get_time_seconds() - query_duration);
                 add_assoc_string(&query_data, "type", (char *)query_type);
                 add_assoc_long(&query_data, "rows_affected", rows_affected);
                 
@@ -2579,14 +2819,12 @@ void opa_execute_ex(zend_execute_data *execute_data) {
         }
         
         // Also try to record via record_sql_query (for call node tracking)
-        if (call_id) {
+        if (call) {
             record_sql_query(sql, query_duration, NULL, query_type, rows_affected, NULL, "mysql", NULL);
-            debug_log("[execute_ex] Also recorded SQL query via record_sql_query: %s, duration=%.6f, call_id=%s", sql, query_duration, call_id);
+            debug_log("[execute_ex] Also recorded SQL query via record_sql_query: %s, duration=%.6f, call=%u", sql, query_duration, call->index);
         } else {
             // Create a root call node if we don't have one
-            char *root_call_id = opa_enter_function("__root__", NULL, __FILE__, __LINE__, 0);
-            if (root_call_id) {
-                efree(root_call_id);
+            if (opa_enter_root(__FILE__, __LINE__)) {
                 record_sql_query(sql, query_duration, NULL, query_type, rows_affected, NULL, "mysql", NULL);
                 debug_log("[execute_ex] Recorded SQL query after creating root call: %s, duration=%.6f", sql, query_duration);
             }
@@ -2645,8 +2883,8 @@ void opa_execute_ex(zend_execute_data *execute_data) {
         }
     }
     
-    debug_log("[execute_ex] AFTER curl check: curl_func_after=%d, curl_func_type_after=%d, call_id=%s", 
-        curl_func_after, curl_func_type_after, call_id ? call_id : "NULL");
+    debug_log("[execute_ex] AFTER curl check: curl_func_after=%d, curl_func_type_after=%d, call=%d", 
+        curl_func_after, curl_func_type_after, call ? (int)call->index : -1);
     
     // Capture HTTP request info AFTER execution if it's curl_exec
     // Declare variables outside the if block so they're accessible
@@ -2660,12 +2898,11 @@ void opa_execute_ex(zend_execute_data *execute_data) {
     
     // Process curl_exec calls and capture HTTP request details
     if (curl_func_after && curl_func_type_after == 1) {
-        debug_log("[execute_ex] Processing curl_exec - curl_func_after=%d, curl_func_type_after=%d, call_id=%s, curl_handle_after=%p", 
-            curl_func_after, curl_func_type_after, call_id ? call_id : "NULL", curl_handle_after);
+        debug_log("[execute_ex] Processing curl_exec - curl_func_after=%d, curl_func_type_after=%d, call=%d, curl_handle_after=%p", 
+            curl_func_after, curl_func_type_after, call ? (int)call->index : -1, curl_handle_after);
         
         // Calculate duration and bytes from BEFORE section
-        double curl_end_time = get_time_seconds();
-        curl_duration = curl_end_time - curl_start_time;
+        curl_duration = get_elapsed_seconds(curl_start_ns);
         size_t curl_bytes_sent_after = get_bytes_sent();
         size_t curl_bytes_received_after = get_bytes_received();
         curl_bytes_sent = curl_bytes_sent_after - curl_bytes_sent_before;
@@ -2875,9 +3112,8 @@ void opa_execute_ex(zend_execute_data *execute_data) {
     }
     
     // Capture cache operation info AFTER execution if it's an APCu function
-    if (apcu_func && call_id && function_name) {
-        double apcu_end_time = get_time_seconds();
-        double apcu_duration = apcu_end_time - apcu_start_time;
+    if (apcu_func && call && function_name) {
+        double apcu_duration = get_elapsed_seconds(apcu_start_ns);
         int hit = 0;
         size_t data_size = 0;
         
@@ -2922,9 +3158,8 @@ void opa_execute_ex(zend_execute_data *execute_data) {
     }
     
     // Exit function tracking only if we entered it
-    if (call_id) {
-        opa_exit_function(call_id);
-        efree(call_id);
+    if (call) {
+        opa_exit_function(call);
     }
     
     // Reset re-entrancy guard at the end of function
@@ -2954,10 +3189,189 @@ static zend_function *curl_error_func = NULL;
 static int pdo_observer_registered = 0;
 static int general_observer_registered = 0;
 
+/* cURL Trace Context Propagation */
+
+// CURLOPT_HTTPHEADER (CURLOPTTYPE_SLISTPOINT + 23), not exported by ext/curl headers
+#define OPA_CURLOPT_HTTPHEADER 10023
+
+static zif_handler orig_curl_setopt_handler = NULL;
+static zif_handler orig_curl_setopt_array_handler = NULL;
+static zif_handler orig_curl_init_handler = NULL;
+static zif_handler orig_curl_copy_handle_handler = NULL;
+static zif_handler orig_curl_reset_handler = NULL;
+static zif_handler orig_curl_multi_add_handle_handler = NULL;
+
+// cURL handles whose header list was set through curl_setopt()/curl_setopt_array() during this
+// request (object handle -> zend_object*). Their headers already carry the trace context;
+// any other handle gets it from curl_exec()/curl_multi_add_handle().
+static HashTable *curl_header_handles = NULL;
+
+// Outgoing traceparent for the current request; 0 if there is no context to propagate
+static int current_traceparent(char *buf, size_t size) {
+    if (!OPA_G(enabled) || !OPA_G(trace_propagation) || !root_span_trace_id || !root_span_span_id) {
+        return 0;
+    }
+    return opa_traceparent_format(buf, size, root_span_trace_id, root_span_span_id, request_sampled) > 0;
+}
+
+// Append traceparent (and tracestate) to a CURLOPT_HTTPHEADER array unless the caller set one
+static void inject_trace_headers(zval *headers, const char *traceparent) {
+    ZVAL_DEREF(headers);
+    if (Z_TYPE_P(headers) != IS_ARRAY) {
+        return;
+    }
+    zval *header;
+    ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(headers), header) {
+        if (Z_TYPE_P(header) == IS_STRING && Z_STRLEN_P(header) >= sizeof("traceparent:") - 1 &&
+            strncasecmp(Z_STRVAL_P(header), "traceparent:", sizeof("traceparent:") - 1) == 0) {
+            return;
+        }
+    } ZEND_HASH_FOREACH_END();
+    
+    SEPARATE_ARRAY(headers);
+    char line[OPA_TRACESTATE_MAX + 16];
+    snprintf(line, sizeof(line), "traceparent: %s", traceparent);
+    add_next_index_string(headers, line);
+    if (root_span_tracestate) {
+        snprintf(line, sizeof(line), "tracestate: %s", root_span_tracestate);
+        add_next_index_string(headers, line);
+    }
+}
+
+static void mark_curl_header_handle(zval *ch, int has_headers) {
+    if (!ch || Z_TYPE_P(ch) != IS_OBJECT) {
+        return;
+    }
+    if (has_headers) {
+        if (!curl_header_handles) {
+            ALLOC_HASHTABLE(curl_header_handles);
+            zend_hash_init(curl_header_handles, 8, NULL, NULL, 0);
+        }
+        zend_hash_index_update_ptr(curl_header_handles, Z_OBJ_HANDLE_P(ch), Z_OBJ_P(ch));
+    } else if (curl_header_handles) {
+        zend_hash_index_del(curl_header_handles, Z_OBJ_HANDLE_P(ch));
+    }
+}
+
+static int curl_handle_has_headers(zval *ch) {
+    if (!curl_header_handles || !ch || Z_TYPE_P(ch) != IS_OBJECT) {
+        return 0;
+    }
+    return zend_hash_index_find_ptr(curl_header_handles, Z_OBJ_HANDLE_P(ch)) == Z_OBJ_P(ch);
+}
+
+// Give a handle without a header list the trace headers (curl_setopt() would replace user headers otherwise)
+static void propagate_to_curl_handle(zval *ch) {
+    char traceparent[OPA_TRACEPARENT_LEN + 1];
+    if (!is_curl_handle(ch) || curl_handle_has_headers(ch) || !current_traceparent(traceparent, sizeof(traceparent))) {
+        return;
+    }
+    
+    zval setopt_func, setopt_args[3], setopt_ret;
+    ZVAL_STRING(&setopt_func, "curl_setopt");
+    ZVAL_COPY(&setopt_args[0], ch);
+    ZVAL_LONG(&setopt_args[1], OPA_CURLOPT_HTTPHEADER);
+    array_init(&setopt_args[2]);
+    inject_trace_headers(&setopt_args[2], traceparent);
+    ZVAL_UNDEF(&setopt_ret);
+    
+    zend_fcall_info fci;
+    zend_fcall_info_cache fcc;
+    if (zend_fcall_info_init(&setopt_func, 0, &fci, &fcc, NULL, NULL) == SUCCESS) {
+        fci.param_count = 3;
+        fci.params = setopt_args;
+        fci.retval = &setopt_ret;
+        zend_call_function(&fci, &fcc); // Marks the handle through zif_opa_curl_setopt
+    }
+    
+    zval_dtor(&setopt_ret);
+    zval_dtor(&setopt_args[2]);
+    zval_dtor(&setopt_args[0]);
+    zval_dtor(&setopt_func);
+}
+
+// curl_setopt($ch, CURLOPT_HTTPHEADER, $headers): add the trace headers to the caller's list
+static void zif_opa_curl_setopt(zend_execute_data *execute_data, zval *return_value) {
+    if (ZEND_CALL_NUM_ARGS(execute_data) >= 3) {
+        zval *ch = ZEND_CALL_ARG(execute_data, 1);
+        zval *option = ZEND_CALL_ARG(execute_data, 2);
+        if (Z_TYPE_P(option) == IS_LONG && Z_LVAL_P(option) == OPA_CURLOPT_HTTPHEADER) {
+            char traceparent[OPA_TRACEPARENT_LEN + 1];
+            if (current_traceparent(traceparent, sizeof(traceparent))) {
+                inject_trace_headers(ZEND_CALL_ARG(execute_data, 3), traceparent);
+            }
+            mark_curl_header_handle(ch, 1);
+        }
+    }
+    orig_curl_setopt_handler(execute_data, return_value);
+}
+
+// curl_setopt_array($ch, [CURLOPT_HTTPHEADER => $headers, ...])
+static void zif_opa_curl_setopt_array(zend_execute_data *execute_data, zval *return_value) {
+    if (ZEND_CALL_NUM_ARGS(execute_data) >= 2) {
+        zval *ch = ZEND_CALL_ARG(execute_data, 1);
+        zval *options = ZEND_CALL_ARG(execute_data, 2);
+        ZVAL_DEREF(options);
+        if (Z_TYPE_P(options) == IS_ARRAY && zend_hash_index_find(Z_ARRVAL_P(options), OPA_CURLOPT_HTTPHEADER)) {
+            char traceparent[OPA_TRACEPARENT_LEN + 1];
+            if (current_traceparent(traceparent, sizeof(traceparent))) {
+                SEPARATE_ARRAY(options);
+                inject_trace_headers(zend_hash_index_find(Z_ARRVAL_P(options), OPA_CURLOPT_HTTPHEADER), traceparent);
+            }
+            mark_curl_header_handle(ch, 1);
+        }
+    }
+    orig_curl_setopt_array_handler(execute_data, return_value);
+}
+
+// curl_init(): object handles are reused, forget whatever a freed handle left behind
+static void zif_opa_curl_init(zend_execute_data *execute_data, zval *return_value) {
+    orig_curl_init_handler(execute_data, return_value);
+    mark_curl_header_handle(return_value, 0);
+}
+
+// curl_copy_handle($ch): the copy inherits the header list of the original
+static void zif_opa_curl_copy_handle(zend_execute_data *execute_data, zval *return_value) {
+    int has_headers = ZEND_CALL_NUM_ARGS(execute_data) >= 1 && curl_handle_has_headers(ZEND_CALL_ARG(execute_data, 1));
+    orig_curl_copy_handle_handler(execute_data, return_value);
+    mark_curl_header_handle(return_value, has_headers);
+}
+
+// curl_reset($ch): drops the header list
+static void zif_opa_curl_reset(zend_execute_data *execute_data, zval *return_value) {
+    if (ZEND_CALL_NUM_ARGS(execute_data) >= 1) {
+        mark_curl_header_handle(ZEND_CALL_ARG(execute_data, 1), 0);
+    }
+    orig_curl_reset_handler(execute_data, return_value);
+}
+
+// curl_multi_add_handle($mh, $ch): transfers run inside curl_multi_exec(), never through curl_exec()
+static void zif_opa_curl_multi_add_handle(zend_execute_data *execute_data, zval *return_value) {
+    if (ZEND_CALL_NUM_ARGS(execute_data) >= 2) {
+        propagate_to_curl_handle(ZEND_CALL_ARG(execute_data, 2));
+    }
+    orig_curl_multi_add_handle_handler(execute_data, return_value);
+}
+
+// Hook a cURL function for trace propagation (MINIT)
+static void hook_curl_propagation(const char *name, zif_handler handler, zif_handler *orig) {
+    zend_function *func = zend_hash_str_find_ptr(CG(function_table), name, strlen(name));
+    if (func && func->type == ZEND_INTERNAL_FUNCTION) {
+        *orig = func->internal_function.handler;
+        func->internal_function.handler = handler;
+        debug_log("[MINIT] Hooked %s for trace propagation", name);
+    }
+}
+
 /* cURL Profiling Hook */
 
 // curl_exec wrapper handler (internal function signature)
 static void zif_opa_curl_exec(zend_execute_data *execute_data, zval *return_value) {
+    // Propagate the trace context even when this request is not profiled (sampled flag 0)
+    if (ZEND_CALL_NUM_ARGS(execute_data) > 0) {
+        propagate_to_curl_handle(ZEND_CALL_ARG(execute_data, 1));
+    }
+    
     // Fast-path: if not actively profiling, call original immediately
     if (!profiling_active) {
         if (orig_curl_exec_handler) {
@@ -2989,7 +3403,7 @@ static void zif_opa_curl_exec(zend_execute_data *execute_data, zval *return_valu
     }
     
     // Record timing before call
-    double start_time = get_time_seconds();
+    int64_t start_ns = get_time_ns();
     size_t bytes_sent_before = get_bytes_sent();
     size_t bytes_received_before = get_bytes_received();
     
@@ -3004,8 +3418,7 @@ static void zif_opa_curl_exec(zend_execute_data *execute_data, zval *return_valu
     }
     
     // Calculate duration and bytes after call
-    double end_time = get_time_seconds();
-    double duration = end_time - start_time;
+    double duration = get_elapsed_seconds(start_ns);
     size_t bytes_sent_after = get_bytes_sent();
     size_t bytes_received_after = get_bytes_received();
     size_t bytes_sent = bytes_sent_after - bytes_sent_before;
@@ -3503,57 +3916,110 @@ static void zif_opa_pdo_stmt_execute(zend_execute_data *execute_data, zval *retu
 }
 
 // Per-call observer data structure
-// Stored in hash table keyed by execute_data pointer to persist between begin/end callbacks
+// One entry per executing frame in observer_frames: pushed on begin, found and removed on end
 typedef struct _opa_observer_data {
-    char *call_id;                    // Function call ID for tracking
-    double start_time;                // Function start time
-    double start_cpu_time;            // CPU time at start
-    size_t start_memory;              // Memory usage at start
-    size_t start_bytes_sent;          // Network bytes sent at start
-    size_t start_bytes_received;      // Network bytes received at start
+    call_node_t *call;                // Call node from opa_enter_function(), handed back on exit
     char *sql;                        // SQL query (for PDO methods)
-    double query_start_time;           // SQL query start time
     zval *curl_handle;                // cURL handle (if curl function)
-    double curl_start_time;            // cURL start time
+    int64_t curl_start_ns;             // cURL start time (monotonic)
     size_t curl_bytes_sent_before;     // Bytes sent before cURL call
     size_t curl_bytes_received_before; // Bytes received before cURL call
     char *apcu_key;                   // APCu cache key
     const char *apcu_operation;        // APCu operation name
-    double apcu_start_time;            // APCu start time
+    int64_t apcu_start_ns;             // APCu start time (monotonic)
     int is_redis_method;               // Flag for Redis methods
     char *redis_key;                  // Redis key being operated on
     const char *redis_command;         // Redis command/method name
-    double redis_start_time;           // Redis operation start time
+    int64_t redis_start_ns;            // Redis operation start time (monotonic)
     char *redis_host;                  // Redis connection host
     char *redis_port;                  // Redis connection port
     int is_symfony_cache_method;       // Flag for Symfony Cache methods
+    zend_execute_data *execute_data;   // Frame this entry belongs to
+    void *fiber;                       // EG(active_fiber) at begin, NULL outside fibers
 } opa_observer_data_t;
 
-// Hash table to store observer data keyed by execute_data pointer
-static HashTable *observer_data_table = NULL;
-static pthread_mutex_t observer_data_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Observer data of the frames currently executing, in call order: begin pushes, end removes.
+// Without fibers ends are LIFO and the entry is the top one. A suspended fiber
+// leaves its entries under those of the fiber that runs next, so an entry can
+// end below the top; lookups search down and only ever discard entries of the
+// current fiber.
+// No locking or hashing on the hot path (one request at a time per process).
+// The array is malloc'd, reused across requests and grows by doubling.
+static opa_observer_data_t *observer_frames = NULL;
+static int observer_frame_capacity = 0;
+static int observer_frame_depth = 0;
 
-// Helper function to free observer data entry (used in hash table cleanup)
-static int free_observer_data_entry(zval *zv) {
-    if (!zv || Z_TYPE_P(zv) != IS_PTR) {
-        return ZEND_HASH_APPLY_REMOVE;
+// Free the estrdup'd strings of an entry
+static void free_observer_data(opa_observer_data_t *data) {
+    if (data->sql) efree(data->sql);
+    if (data->apcu_key) efree(data->apcu_key);
+    if (data->redis_key) efree(data->redis_key);
+    if (data->redis_host) efree(data->redis_host);
+    if (data->redis_port) efree(data->redis_port);
+}
+
+static void *observer_current_fiber(void) {
+#if PHP_VERSION_ID >= 80100
+    return EG(active_fiber);
+#else
+    return NULL;
+#endif
+}
+
+static opa_observer_data_t *observer_frame_push(zend_execute_data *execute_data) {
+    if (observer_frame_depth == observer_frame_capacity) {
+        int capacity = observer_frame_capacity ? observer_frame_capacity * 2 : 64;
+        opa_observer_data_t *frames = realloc(observer_frames, (size_t)capacity * sizeof(opa_observer_data_t));
+        if (!frames) {
+            return NULL;
+        }
+        observer_frames = frames;
+        observer_frame_capacity = capacity;
     }
-    
-    opa_observer_data_t *data = (opa_observer_data_t *)Z_PTR_P(zv);
-    if (data) {
-        // Free all estrdup'd strings
-        if (data->call_id) efree(data->call_id);
-        if (data->sql) efree(data->sql);
-        if (data->apcu_key) efree(data->apcu_key);
-        if (data->redis_key) efree(data->redis_key);
-        if (data->redis_host) efree(data->redis_host);
-        if (data->redis_port) efree(data->redis_port);
-        
-        // Free the data structure itself
-        efree(data);
+    opa_observer_data_t *data = &observer_frames[observer_frame_depth++];
+    memset(data, 0, sizeof(opa_observer_data_t));
+    data->execute_data = execute_data;
+    data->fiber = observer_current_fiber();
+    return data;
+}
+
+// Remove the entry at index i (the top one except when fibers interleave)
+static void observer_frame_remove(int i) {
+    free_observer_data(&observer_frames[i]);
+    if (i < observer_frame_depth - 1) {
+        memmove(&observer_frames[i], &observer_frames[i + 1],
+                (size_t)(observer_frame_depth - 1 - i) * sizeof(opa_observer_data_t));
+    }
+    observer_frame_depth--;
+}
+
+// Entry of an ending frame (normally the top), or NULL if its begin didn't push one.
+// Entries above it from the same fiber belong to frames whose end never ran and
+// are dropped; entries of other (suspended) fibers are kept for their own ends.
+static opa_observer_data_t *observer_frame_find(zend_execute_data *execute_data) {
+    int i = observer_frame_depth - 1;
+    if (i >= 0 && observer_frames[i].execute_data == execute_data) {
+        return &observer_frames[i];
+    }
+    while (i >= 0 && observer_frames[i].execute_data != execute_data) {
+        i--;
+    }
+    if (i < 0) {
+        return NULL;
+    }
+    void *fiber = observer_current_fiber();
+    for (int j = observer_frame_depth - 1; j > i; j--) {
+        if (observer_frames[j].fiber == fiber) {
+            observer_frame_remove(j);
+        }
+    }
+    return &observer_frames[i];
+}
+
+static void observer_frame_pop(void) {
+    if (observer_frame_depth > 0) {
+        observer_frame_remove(observer_frame_depth - 1);
     }
-    
-    return ZEND_HASH_APPLY_REMOVE;
 }
 
 // General Zend Observer callbacks for all function calls
@@ -3645,37 +4111,31 @@ static void opa_observer_fcall_begin(zend_execute_data *execute_data) {
         }
     }
     
-    // Allocate observer data structure
-    opa_observer_data_t *data = emalloc(sizeof(opa_observer_data_t));
-    memset(data, 0, sizeof(opa_observer_data_t));
-    
-    // Store start time and metrics
-    data->start_time = get_time_seconds();
-    data->start_cpu_time = get_cpu_time();
-    data->start_memory = get_memory_usage();
-    data->start_bytes_sent = get_bytes_sent();
-    data->start_bytes_received = get_bytes_received();
+    // Push observer data for this frame
+    opa_observer_data_t *data = observer_frame_push(execute_data);
+    if (!data) {
+        in_opa_observer = 0;
+        return;
+    }
     
-    // Track function entry
+    // Track function entry (the call record takes the start time and metrics)
     // Skip profiling curl_getinfo and curl_error when called from within observer
     // These are now called directly via internal handlers, but we still skip profiling them
     // to be safe and avoid any potential recursion
-    char *call_id = NULL;
     if (function_name && (strcmp(function_name, "curl_getinfo") == 0 || strcmp(function_name, "curl_error") == 0)) {
         // Skip profiling these functions when called from observer context
         // They are now called directly via internal handlers to prevent recursion
-        call_id = NULL;
+        data->call = NULL;
     } else if (function_name || class_name) {
-        call_id = opa_enter_function(function_name, class_name, file, line, function_type);
-        if (call_id) {
-            data->call_id = estrdup(call_id);
-            efree(call_id);
-        }
+        data->call = opa_enter_function(func->common.function_name,
+            class_name ? func->common.scope->name : NULL,
+            file ? func->op_array.filename : NULL,
+            line, function_type);
     }
     
     // Detect and capture cURL calls
     if (function_name && strcmp(function_name, "curl_exec") == 0) {
-        data->curl_start_time = get_time_seconds();
+        data->curl_start_ns = get_time_ns();
         data->curl_bytes_sent_before = get_bytes_sent();
         data->curl_bytes_received_before = get_bytes_received();
         if (ZEND_CALL_NUM_ARGS(execute_data) > 0) {
@@ -3685,7 +4145,7 @@ static void opa_observer_fcall_begin(zend_execute_data *execute_data) {
             }
         }
     } else if (is_curl_function(execute_data)) {
-        data->curl_start_time = get_time_seconds();
+        data->curl_start_ns = get_time_ns();
         data->curl_bytes_sent_before = get_bytes_sent();
         data->curl_bytes_received_before = get_bytes_received();
         if (ZEND_CALL_NUM_ARGS(execute_data) > 0) {
@@ -3698,7 +4158,7 @@ static void opa_observer_fcall_begin(zend_execute_data *execute_data) {
     
     // Detect APCu functions
     if (is_apcu_function(execute_data) && function_name) {
-        data->apcu_start_time = get_time_seconds();
+        data->apcu_start_ns = get_time_ns();
         data->apcu_operation = function_name;
         if (ZEND_CALL_NUM_ARGS(execute_data) > 0) {
             zval *key_arg = ZEND_CALL_ARG(execute_data, 1);
@@ -3713,7 +4173,7 @@ static void opa_observer_fcall_begin(zend_execute_data *execute_data) {
     // Detect Redis methods
     if (is_redis_method(execute_data)) {
         data->is_redis_method = 1;
-        data->redis_start_time = get_time_seconds();
+        data->redis_start_ns = get_time_ns();
         data->redis_command = function_name; // Store method name as command
         
         // Extract Redis key from arguments based on method type
@@ -3787,27 +4247,6 @@ static void opa_observer_fcall_begin(zend_execute_data *execute_data) {
         data->is_symfony_cache_method = 1;
     }
     
-    // Store observer data in hash table keyed by execute_data pointer
-    pthread_mutex_lock(&observer_data_mutex);
-    if (!observer_data_table) {
-        // Use malloc instead of emalloc to prevent PHP from automatically destroying
-        // the hash table during request shutdown when zvals are invalid
-        observer_data_table = malloc(sizeof(HashTable));
-        if (observer_data_table) {
-            zend_hash_init(observer_data_table, 64, NULL, NULL, 0);
-        }
-    }
-    // CRITICAL: Validate before accessing hash table
-    if (observer_data_table && observer_data_table->nTableSize > 0) {
-        // Validate execute_data pointer is reasonable
-        if (execute_data && (zend_ulong)execute_data > 0x1000) {
-            zval data_zv;
-            ZVAL_PTR(&data_zv, data);
-            zend_hash_index_update(observer_data_table, (zend_ulong)execute_data, &data_zv);
-        }
-    }
-    pthread_mutex_unlock(&observer_data_mutex);
-    
     // Reset re-entrancy guard before returning
     in_opa_observer = 0;
 }
@@ -3834,119 +4273,8 @@ static void opa_observer_fcall_end(zend_execute_data *execute_data, zval *return
     // Set re-entrancy guard immediately after safety checks
     in_opa_observer = 1;
     
-    // Retrieve observer data from hash table
-    // CRITICAL: Keep mutex locked during entire access to prevent race condition with RSHUTDOWN
-    pthread_mutex_lock(&observer_data_mutex);
-    opa_observer_data_t *data = NULL;
-    
-    // CRITICAL: Double-check profiling_active and table existence after acquiring lock
-    // RSHUTDOWN sets profiling_active=0 BEFORE destroying the hash table, so if profiling_active
-    // is 0, the hash table might be in the process of being destroyed or already destroyed
-    // We MUST check this AFTER acquiring the mutex to avoid race conditions
-    if (!profiling_active) {
-        // Profiling was disabled by RSHUTDOWN - skip hash table access to prevent crash
-        pthread_mutex_unlock(&observer_data_mutex);
-        in_opa_observer = 0;
-        return;
-    }
-    
-    // Check if table exists (could be destroyed by RSHUTDOWN)
-    if (!observer_data_table) {
-        pthread_mutex_unlock(&observer_data_mutex);
-        in_opa_observer = 0;
-        return;
-    }
-    
-    // CRITICAL: The segfault is happening inside zend_hash_index_find at a consistent offset (0x1c3e)
-    // This suggests the hash table's internal structure (arData array) is corrupted
-    // Even with extensive validation, zend_hash_index_find crashes when accessing arData elements
-    // 
-    // The root cause appears to be that zend_hash_index_find accesses the hash table's arData array
-    // which might contain invalid pointers or be partially freed, even though the hash table structure
-    // itself looks valid (nTableSize, nTableMask, arData pointer all look correct).
-    //
-    // Since we can't prevent this from C without signal handlers, and validation isn't sufficient,
-    // we need to be extremely defensive. We'll skip the hash table lookup if there's ANY doubt.
-    
-    // Additional check: verify table still exists and profiling is still active
-    // (RSHUTDOWN might have destroyed table or disabled profiling between checks)
-    if (!profiling_active || !observer_data_table) {
-        pthread_mutex_unlock(&observer_data_mutex);
-        in_opa_observer = 0;
-        return;
-    }
-    
-    if (observer_data_table) {
-        // CRITICAL: Access ALL hash table fields through the global pointer ONLY
-        // Do NOT create a local copy - the memory might be freed between checks
-        // Validate structure fields directly through observer_data_table pointer
-        
-        // Step 1: Verify pointer is reasonable (basic sanity check)
-        uintptr_t ht_addr = (uintptr_t)observer_data_table;
-        if (ht_addr > 0x1000 && ht_addr < 0x7fffffffffff) {
-            // Step 2: Check nTableSize (first field access - if this crashes, table is definitely invalid)
-            // CRITICAL: Re-check profiling_active before accessing hash table fields
-            // RSHUTDOWN might have disabled profiling between the initial check and here
-            if (!profiling_active) {
-                // Profiling was disabled - skip hash table access
-            } else {
-                uint32_t table_size = 0;
-                uint32_t table_mask = 0;
-                void *ar_data = NULL;
-                
-                // Safely read hash table fields - if any access fails, we skip the lookup
-                // We can't use try-catch in C, so we validate extensively before each access
-                table_size = observer_data_table->nTableSize;
-                if (table_size > 0 && table_size < 1000000) {
-                    table_mask = observer_data_table->nTableMask;
-                    if (table_mask != 0) {
-                        ar_data = observer_data_table->arData;
-                        if (ar_data != NULL) {
-                            uintptr_t arData_addr = (uintptr_t)ar_data;
-                            if (arData_addr > 0x1000 && arData_addr < 0x7fffffffffff) {
-                                // Validate execute_data pointer
-                                if (execute_data && (zend_ulong)execute_data > 0x1000) {
-                                    // Final validation: re-check all fields are still consistent
-                                    // (RSHUTDOWN might have destroyed table between field reads)
-                                    // Also re-check profiling_active - it might have been disabled
-                                    if (profiling_active &&
-                                        observer_data_table != NULL &&
-                                        observer_data_table->nTableSize == table_size &&
-                                        observer_data_table->nTableMask == table_mask &&
-                                        observer_data_table->arData == ar_data) {
-                                        // CRITICAL: The segfault happens INSIDE zend_hash_index_find when it accesses
-                                        // the hash table's arData array elements. The arData array might contain
-                                        // invalid pointers or the array itself might be partially freed.
-                                        // 
-                                        // The crash happens at a consistent offset (0x1c3e) inside zend_hash_index_find,
-                                        // suggesting the hash table structure is corrupted in a specific way.
-                                        // 
-                                        // Since validation isn't sufficient and we can't prevent this from C,
-                                        // we'll try the lookup with all validations passed.
-                                        // If it still crashes, the issue is deeper than we can fix with validation.
-                                        //
-                                        // FINAL CHECK: Re-verify profiling_active one more time right before the call
-                                        // This is the last chance to avoid the crash
-                                        if (profiling_active && observer_data_table != NULL) {
-                                            zval *data_zv = zend_hash_index_find(observer_data_table, (zend_ulong)execute_data);
-                                            if (data_zv && Z_TYPE_P(data_zv) == IS_PTR) {
-                                                data = (opa_observer_data_t *)Z_PTR_P(data_zv);
-                                                // Additional validation: check if data pointer is reasonable
-                                                if (data && (uintptr_t)data < 0x1000) {
-                                                    data = NULL; // Invalid pointer
-                                                }
-                                            }
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
-    pthread_mutex_unlock(&observer_data_mutex);
+    // Observer data pushed by the begin handler of this frame
+    opa_observer_data_t *data = observer_frame_find(execute_data);
     
     if (!data) {
         // Reset re-entrancy guard before returning
@@ -3966,14 +4294,13 @@ static void opa_observer_fcall_end(zend_execute_data *execute_data, zval *return
     }
     
     // Track function exit
-    if (data->call_id) {
-        opa_exit_function(data->call_id);
+    if (data->call) {
+        opa_exit_function(data->call);
     }
     
     // Handle cURL calls
     if (data->curl_handle || (function_name && strcmp(function_name, "curl_exec") == 0)) {
-        double curl_end_time = get_time_seconds();
-        double curl_duration = curl_end_time - data->curl_start_time;
+        double curl_duration = get_elapsed_seconds(data->curl_start_ns);
         size_t curl_bytes_sent_after = get_bytes_sent();
         size_t curl_bytes_received_after = get_bytes_received();
         size_t bytes_sent = curl_bytes_sent_after - data->curl_bytes_sent_before;
@@ -4098,8 +4425,7 @@ static void opa_observer_fcall_end(zend_execute_data *execute_data, zval *return
     
     // Handle APCu cache operations
     if (data->apcu_operation) {
-        double apcu_end_time = get_time_seconds();
-        double apcu_duration = apcu_end_time - data->apcu_start_time;
+        double apcu_duration = get_elapsed_seconds(data->apcu_start_ns);
         int hit = 0;
         size_t data_size = 0;
         
@@ -4126,8 +4452,7 @@ static void opa_observer_fcall_end(zend_execute_data *execute_data, zval *return
     
     // Handle Redis operations
     if (data->is_redis_method) {
-        double redis_end_time = get_time_seconds();
-        double redis_duration = redis_end_time - data->redis_start_time;
+        double redis_duration = get_elapsed_seconds(data->redis_start_ns);
         int hit = 0;
         const char *error = NULL;
         
@@ -4215,43 +4540,8 @@ static void opa_observer_fcall_end(zend_execute_data *execute_data, zval *return
         record_redis_operation(data->redis_command, data->redis_key, hit, redis_duration, error, data->redis_host, data->redis_port);
     }
     
-    // Clean up observer data
-    if (data->call_id) efree(data->call_id);
-    if (data->sql) efree(data->sql);
-    if (data->apcu_key) efree(data->apcu_key);
-    if (data->redis_key) efree(data->redis_key);
-    if (data->redis_host) efree(data->redis_host);
-    if (data->redis_port) efree(data->redis_port);
-    
-    // Remove from hash table and free
-    // CRITICAL: Add same extensive validation as in the find operation
-    // Use local pointer to avoid race condition with RSHUTDOWN
-    pthread_mutex_lock(&observer_data_mutex);
-    HashTable *ht_del = observer_data_table; // Local copy to avoid race condition
-    if (ht_del) {
-        // CRITICAL: Extensive validation to prevent segfaults in zend_hash_index_del
-        // Check if hash table is properly initialized
-        if (ht_del->nTableSize > 0 && 
-            ht_del->nTableMask != 0 &&
-            ht_del->arData != NULL) {
-            
-            // Additional validation: check arData pointer is reasonable
-            uintptr_t arData_addr = (uintptr_t)ht_del->arData;
-            if (arData_addr > 0x1000 && arData_addr < 0x7fffffffffff) {
-                // Validate execute_data pointer is reasonable
-                if (execute_data && (zend_ulong)execute_data > 0x1000) {
-                    // Double-check table still exists (could be destroyed by RSHUTDOWN)
-                    if (observer_data_table == ht_del) {
-                        // Now safe to call zend_hash_index_del
-                        zend_hash_index_del(ht_del, (zend_ulong)execute_data);
-                    }
-                }
-            }
-        }
-    }
-    pthread_mutex_unlock(&observer_data_mutex);
-    
-    efree(data);
+    // Clean up observer data (the top entry unless fibers interleave)
+    observer_frame_remove((int)(data - observer_frames));
     
     // Reset re-entrancy guard before returning
     in_opa_observer = 0;
@@ -4298,6 +4588,14 @@ static zend_observer_fcall_handlers opa_observer_fcall_init(zend_execute_data *e
         return handlers;
     }
     
+    // opa.include / opa.exclude: filtered functions get no handlers at all.
+    // Functions whose I/O the begin/end handlers capture are always observed
+    if (!is_apcu && opa_filter_active() && !opa_filter_allows(func) &&
+        !is_curl_function(execute_data) && !is_pdo_method(execute_data) &&
+        !is_redis_method(execute_data) && !is_symfony_cache_method(execute_data)) {
+        return handlers;
+    }
+    
     // Register handlers for all functions (user and internal if enabled, plus APCu always)
     handlers.begin = opa_observer_fcall_begin;
     handlers.end = opa_observer_fcall_end;
@@ -4477,6 +4775,7 @@ static zend_observer_fcall_handlers opa_observer_pdo_init(zend_execute_data *exe
 
 PHP_MINIT_FUNCTION(opa) {
     REGISTER_INI_ENTRIES();
+    __atomic_store_n(&debug_log_shared, OPA_G(debug_log_enabled) ? 1 : 0, __ATOMIC_RELAXED);
     
     // TEMPORARILY DISABLED: Auto-detect PHP version (uses OPA_G which crashes)
     /*
@@ -4564,6 +4863,14 @@ PHP_MINIT_FUNCTION(opa) {
         debug_log("[MINIT] curl_exec not found or not internal");
     }
     
+    // Trace context propagation (W3C traceparent) on outgoing cURL requests
+    hook_curl_propagation("curl_setopt", zif_opa_curl_setopt, &orig_curl_setopt_handler);
+    hook_curl_propagation("curl_setopt_array", zif_opa_curl_setopt_array, &orig_curl_setopt_array_handler);
+    hook_curl_propagation("curl_init", zif_opa_curl_init, &orig_curl_init_handler);
+    hook_curl_propagation("curl_copy_handle", zif_opa_curl_copy_handle, &orig_curl_copy_handle_handler);
+    hook_curl_propagation("curl_reset", zif_opa_curl_reset, &orig_curl_reset_handler);
+    hook_curl_propagation("curl_multi_add_handle", zif_opa_curl_multi_add_handle, &orig_curl_multi_add_handle_handler);
+    
     // Store curl_getinfo and curl_error function pointers for direct calls (bypasses observers)
     curl_getinfo_func = zend_hash_str_find_ptr(CG(function_table), "curl_getinfo", sizeof("curl_getinfo")-1);
     curl_error_func = zend_hash_str_find_ptr(CG(function_table), "curl_error", sizeof("curl_error")-1);
@@ -4577,6 +4884,19 @@ PHP_MINIT_FUNCTION(opa) {
     // Initialize error and log tracking
     opa_init_error_tracking();
     
+    // Persistent agent connection, spool and sender thread are reset in forked children
+    opa_transport_init();
+    opa_sender_init();
+    
+    // Load the zstd dictionary (opa.zstd_dict_path) once for all requests
+    opa_compress_init();
+    
+    // Shared sampling token bucket must exist before FPM forks its workers
+    opa_sampler_init();
+    
+    // opa.include / opa.exclude, evaluated once per function in opa_observer_fcall_init()
+    opa_filter_init();
+    
     return SUCCESS;
 }
 
@@ -4613,6 +4933,13 @@ PHP_MSHUTDOWN_FUNCTION(opa) {
         efree(pdo_call_times);
         pdo_call_times = NULL;
     }
+    
+    // Observer frame stack (malloc'd, entries already released in RSHUTDOWN)
+    free(observer_frames);
+    observer_frames = NULL;
+    observer_frame_capacity = 0;
+    observer_frame_depth = 0;
+    
     // Restore original zend_execute_ex hook to prevent issues during module unload
     if (original_zend_execute_ex) {
         zend_execute_ex = original_zend_execute_ex;
@@ -4666,6 +4993,16 @@ PHP_MSHUTDOWN_FUNCTION(opa) {
         opa_collector_free(global_collector);
         global_collector = NULL;
     }
+    opa_aggregate_shutdown();
+    opa_symbol_shutdown();
+    opa_arena_destroy(&opa_request_arena);
+    
+    // Flush queued payloads, then close the persistent agent connection
+    opa_sender_shutdown();
+    opa_transport_shutdown();
+    opa_compress_shutdown();
+    opa_sampler_shutdown();
+    opa_filter_shutdown();
     
     UNREGISTER_INI_ENTRIES();
     return SUCCESS;
@@ -4691,36 +5028,57 @@ static void update_ini_from_env(const char *env_name, const char *ini_name) {
     }
 }
 
-PHP_RINIT_FUNCTION(opa) {
-    // RINIT: Reset per-request state AND register hooks (PDO classes available by RINIT time)
-    // Following user guidance: Move PDO hook registration to RINIT where classes are available
+// Value of an incoming request header (FastCGI/Apache: HTTP_* variable, CLI: environment), emalloc'd
+// $_SERVER is not populated yet in RINIT, so ask the SAPI directly
+static char *incoming_header_value(const char *server_name, const char *cli_env) {
+    if (sapi_module.name && strcmp(sapi_module.name, "cli") == 0) {
+        const char *value = getenv(cli_env);
+        return value ? estrdup(value) : NULL;
+    }
+    return sapi_getenv(server_name, strlen(server_name));
+}
+
+// Parse traceparent/tracestate of the incoming request into incoming_trace_ctx and root_span_tracestate
+static void read_incoming_trace_context(void) {
+    incoming_trace_valid = 0;
+    if (root_span_tracestate) {
+        free(root_span_tracestate);
+        root_span_tracestate = NULL;
+    }
+    if (!OPA_G(enabled) || !OPA_G(trace_propagation)) {
+        return;
+    }
     
-    // Initialize observer data hash table for this request
-    // CRITICAL: Check if table was already destroyed by RSHUTDOWN
-    pthread_mutex_lock(&observer_data_mutex);
-    if (!observer_data_table) {
-        // Use malloc instead of emalloc to prevent PHP from automatically destroying
-        // the hash table during request shutdown when zvals are invalid
-        observer_data_table = malloc(sizeof(HashTable));
-        if (observer_data_table) {
-            zend_hash_init(observer_data_table, 64, NULL, NULL, 0);
-        }
-    } else {
-        // Table exists - verify it's still valid (not destroyed)
-        // If it was destroyed, it might have invalid structure
-        if (observer_data_table->nTableSize == 0 || observer_data_table->arData == NULL) {
-            // Table is corrupted or destroyed - reinitialize it
-            if (observer_data_table->arData != NULL) {
-                zend_hash_destroy(observer_data_table);
-            }
-            free(observer_data_table);
-            observer_data_table = malloc(sizeof(HashTable));
-            if (observer_data_table) {
-                zend_hash_init(observer_data_table, 64, NULL, NULL, 0);
+    char *traceparent = incoming_header_value("HTTP_TRACEPARENT", "TRACEPARENT");
+    if (!traceparent) {
+        return;
+    }
+    if (opa_traceparent_parse(traceparent, &incoming_trace_ctx) == 0) {
+        incoming_trace_valid = 1;
+        char *tracestate = incoming_header_value("HTTP_TRACESTATE", "TRACESTATE");
+        if (tracestate) {
+            if (*tracestate && strlen(tracestate) <= OPA_TRACESTATE_MAX) {
+                root_span_tracestate = strdup(tracestate);
             }
+            efree(tracestate);
         }
+        debug_log("[RINIT] Continuing trace %s from parent %s (sampled=%d)",
+            incoming_trace_ctx.trace_id, incoming_trace_ctx.parent_id, incoming_trace_ctx.sampled);
+    } else {
+        debug_log("[RINIT] Ignoring invalid traceparent: %.64s", traceparent);
     }
-    pthread_mutex_unlock(&observer_data_mutex);
+    efree(traceparent);
+}
+
+PHP_RINIT_FUNCTION(opa) {
+    // RINIT: Reset per-request state AND register hooks (PDO classes available by RINIT time)
+    // Following user guidance: Move PDO hook registration to RINIT where classes are available
+    
+    // Observer frames of the previous request were released in RSHUTDOWN
+    observer_frame_depth = 0;
+    
+    // Per-directory opa.debug_log is applied by now; background threads follow it
+    __atomic_store_n(&debug_log_shared, OPA_G(debug_log_enabled) ? 1 : 0, __ATOMIC_RELAXED);
     
     // Try to register SQL hooks lazily if they weren't found at MINIT
     if (!orig_mysqli_query_func) {
@@ -4798,6 +5156,49 @@ PHP_RINIT_FUNCTION(opa) {
         }
     }
     
+    // Head sampling: decide once per request, so unsampled requests skip collection entirely
+    // With tail sampling (opa.full_capture_threshold_ms > 0) every request is collected and
+    // the decision is made in RSHUTDOWN instead
+    request_sampled = 1;
+    request_error_tracked = 0;
+    request_sample_rate = 1.0;
+    request_route_rate = -1.0;
+    
+    // Continue the caller's trace (W3C traceparent) and follow its sampling decision
+    read_incoming_trace_context();
+    
+    // Per-route rules (opa.sampling_rules); rate 0 never instruments the route, not even for tail sampling
+    if (profiling_active) {
+        request_route_rate = opa_sampler_route_rate(SG(request_info).request_method, SG(request_info).request_uri);
+        if (request_route_rate == 0.0) {
+            profiling_active = 0;
+            request_sampled = 0;
+            debug_log("[RINIT] Route excluded by opa.sampling_rules: %s %s",
+                SG(request_info).request_method ? SG(request_info).request_method : "-", SG(request_info).request_uri);
+        }
+    }
+    
+    if (profiling_active && incoming_trace_valid) {
+        // Upstream already decided: don't collect fragments of traces it dropped
+        request_sampled = incoming_trace_ctx.sampled;
+        if (!request_sampled) {
+            profiling_active = 0;
+            debug_log("[RINIT] Request not sampled (traceparent sampled flag unset)");
+        }
+    } else if (profiling_active && opa_sampler_active(request_route_rate) && OPA_G(full_capture_threshold_ms) <= 0) {
+        request_sampled = opa_sampler_decide(request_route_rate, &request_sample_rate);
+        if (!request_sampled) {
+            profiling_active = 0;
+            debug_log("[RINIT] Request not sampled (rate=%.4f)", request_sample_rate);
+        }
+    }
+    
+    // Agent unreachable (circuit open): don't build call trees that would be dropped
+    if (profiling_active && !opa_transport_breaker_allow()) {
+        profiling_active = 0;
+        debug_log("[RINIT] Agent unreachable, profiling suspended for this request");
+    }
+    
     // Only initialize collector if profiling is active (after profiling_active is set)
     if (profiling_active) {
         // Set memory_limit to -1 (unlimited) when profiling is enabled
@@ -4870,11 +5271,20 @@ PHP_RINIT_FUNCTION(opa) {
         free(root_span_cli_args_json);
         root_span_cli_args_json = NULL;
     }
+    if (root_span_parent_id) {
+        free(root_span_parent_id);
+        root_span_parent_id = NULL;
+    }
     
-    // Create new root span for this request
-    root_span_span_id = strdup(generate_id());
-    root_span_trace_id = strdup(generate_id());
-    root_span_start_ts = get_timestamp_ms();
+    // Create new root span for this request (joining the caller's trace if there is one)
+    root_span_span_id = opa_span_id_str();
+    if (incoming_trace_valid) {
+        root_span_trace_id = strdup(incoming_trace_ctx.trace_id);
+        root_span_parent_id = strdup(incoming_trace_ctx.parent_id);
+    } else {
+        root_span_trace_id = opa_trace_id_str();
+    }
+    root_span_start_ts = opa_clock_anchor_request();
     root_span_cpu_ms = 0;
     root_span_status = -1;
     
@@ -5004,28 +5414,6 @@ PHP_RINIT_FUNCTION(opa) {
     
     pthread_mutex_unlock(&root_span_data_mutex);
     
-    // Initialize and start collector for function call tracking
-    // This is required for capturing SQL, HTTP, cache, and Redis operations
-    // MUST be done in RINIT (not RSHUTDOWN) so it's ready when observer callbacks execute
-    if (!global_collector) {
-        global_collector = opa_collector_init();
-    }
-    if (global_collector && global_collector->magic == OPA_COLLECTOR_MAGIC) {
-        opa_collector_start(global_collector);
-        
-        // Initialize global SQL queries array
-        pthread_mutex_lock(&global_collector->global_sql_mutex);
-        if (global_collector->global_sql_queries) {
-            zval_ptr_dtor(global_collector->global_sql_queries);
-            efree(global_collector->global_sql_queries);
-        }
-        global_collector->global_sql_queries = ecalloc(1, sizeof(zval));
-        if (global_collector->global_sql_queries) {
-            array_init(global_collector->global_sql_queries);
-        }
-        pthread_mutex_unlock(&global_collector->global_sql_mutex);
-    }
-    
     return SUCCESS;
 }
 
@@ -5039,9 +5427,9 @@ PHP_RINIT_FUNCTION(opa) {
         // Minimal root span setup - defer everything else to RSHUTDOWN
         pthread_mutex_lock(&root_span_data_mutex);
         if (!root_span_span_id) {
-            root_span_span_id = strdup(generate_id());
-            root_span_trace_id = strdup(generate_id());
-            root_span_start_ts = get_timestamp_ms();
+            root_span_span_id = opa_span_id_str();
+            root_span_trace_id = opa_trace_id_str();
+            root_span_start_ts = opa_clock_anchor_request();
             root_span_cpu_ms = 0;
             root_span_status = -1;
             root_span_name = strdup("PHP Request");
@@ -5083,9 +5471,9 @@ PHP_RINIT_FUNCTION(opa) {
         // Root span tracks the entire request lifecycle and is created early in RINIT
         pthread_mutex_lock(&root_span_data_mutex);
         if (!root_span_span_id) {
-            root_span_span_id = strdup(generate_id());
-            root_span_trace_id = strdup(generate_id());
-            root_span_start_ts = get_timestamp_ms();
+            root_span_span_id = opa_span_id_str();
+            root_span_trace_id = opa_trace_id_str();
+            root_span_start_ts = opa_clock_anchor_request();
             root_span_cpu_ms = 0;
             root_span_status = -1;
             
@@ -5233,44 +5621,19 @@ PHP_RINIT_FUNCTION(opa) {
 }
 */
 
-// Helper function to find parent span_id for a call node (span expansion)
-// Returns root_span_id if no significant parent found, or parent's call_id if parent is significant
-static char* find_parent_span_id_for_call(call_node_t *call, call_node_t *all_calls, const char *root_span_id) {
-    if (!call || !call->parent_id || strlen(call->parent_id) == 0) {
-        return (char*)root_span_id; // Root-level call, parent is root span
-    }
-    
-    // Find parent call node
-    call_node_t *parent_call = all_calls;
-    while (parent_call) {
-        if (parent_call->call_id && strcmp(parent_call->call_id, call->parent_id) == 0) {
-            // Found parent call - check if it's significant
-            int has_sql = (parent_call->sql_queries && Z_TYPE_P(parent_call->sql_queries) == IS_ARRAY && 
-                           zend_hash_num_elements(Z_ARRVAL_P(parent_call->sql_queries)) > 0);
-            int has_http = (parent_call->http_requests && Z_TYPE_P(parent_call->http_requests) == IS_ARRAY && 
-                            zend_hash_num_elements(Z_ARRVAL_P(parent_call->http_requests)) > 0);
-            int has_cache = (parent_call->cache_operations && Z_TYPE_P(parent_call->cache_operations) == IS_ARRAY && 
-                             zend_hash_num_elements(Z_ARRVAL_P(parent_call->cache_operations)) > 0);
-            int has_redis = (parent_call->redis_operations && Z_TYPE_P(parent_call->redis_operations) == IS_ARRAY && 
-                             zend_hash_num_elements(Z_ARRVAL_P(parent_call->redis_operations)) > 0);
-            
-            double end_time = parent_call->end_time > 0.0 ? parent_call->end_time : parent_call->start_time + 0.001;
-            double duration_ms = (end_time - parent_call->start_time) * 1000.0;
-            if (duration_ms < 0.0) duration_ms = 0.0;
-            
-            // If parent is significant, use its call_id as span_id
-            if (has_sql || has_http || has_cache || has_redis || duration_ms > 10.0) {
-                return parent_call->call_id; // Parent will be sent as span, use its call_id
-            } else {
-                // Parent is not significant, traverse up
-                return find_parent_span_id_for_call(parent_call, all_calls, root_span_id);
-            }
-        }
-        parent_call = parent_call->next;
-    }
-    
-    // Parent call not found, use root span
-    return (char*)root_span_id;
+// Helper function to find the parent span of a call record (span expansion)
+// Writes the call id of the nearest significant ancestor into buf, or returns root_span_id
+// when the call has none (its span hangs off the root span)
+static const char* find_parent_span_id_for_call(call_node_t *call, const char *root_span_id, char *buf) {
+    call_node_t *parent = opa_call_get(global_collector, call->parent);
+    while (parent) {
+        if (opa_call_is_significant(global_collector, parent)) {
+            opa_call_format_id(global_collector, parent->index, buf);
+            return buf;
+        }
+        parent = opa_call_get(global_collector, parent->parent);
+    }
+    return root_span_id;
 }
 
 PHP_RSHUTDOWN_FUNCTION(opa) {
@@ -5283,19 +5646,17 @@ PHP_RSHUTDOWN_FUNCTION(opa) {
     // Disable profiling first to stop hook processing ()
     profiling_active = 0;
     
-    // Clean up observer data hash table
-    pthread_mutex_lock(&observer_data_mutex);
-    if (observer_data_table) {
-        // Free all remaining observer data entries before destroying the table
-        // The hash table uses NULL destructor, so entries are not automatically freed
-        zend_hash_apply(observer_data_table, free_observer_data_entry);
-        
-        // Now destroy the hash table structure
-        zend_hash_destroy(observer_data_table);
-        free(observer_data_table); // Use free (not efree) since we used malloc
-        observer_data_table = NULL;
+    // Handles tracked for trace propagation die with the request
+    if (curl_header_handles) {
+        zend_hash_destroy(curl_header_handles);
+        FREE_HASHTABLE(curl_header_handles);
+        curl_header_handles = NULL;
+    }
+    
+    // Release observer data of frames whose end never ran (exit, fatal error)
+    while (observer_frame_depth > 0) {
+        observer_frame_pop();
     }
-    pthread_mutex_unlock(&observer_data_mutex);
     
     // Get root span data from malloc'd global variables (NOT from emalloc'd structure)
     // This is safe even after fastcgi_finish_request()
@@ -5303,11 +5664,24 @@ PHP_RSHUTDOWN_FUNCTION(opa) {
     size_t json_len = 0;
     
     pthread_mutex_lock(&root_span_data_mutex);
-    debug_log("[RSHUTDOWN] root_span_span_id=%p, collector=%p", root_span_span_id, global_collector);
-    if (root_span_span_id) {
+    
+    // Tail sampling: keep slow and errored traces plus a sampled baseline of the rest.
+    // Dropped traces are discarded before anything is serialized
+    if (request_sampled && root_span_span_id && OPA_G(full_capture_threshold_ms) > 0 && !incoming_trace_valid) {
+        long duration_ms = opa_clock_wall_ms(get_time_ns()) - root_span_start_ts;
+        if (duration_ms < OPA_G(full_capture_threshold_ms) && !request_error_tracked &&
+            opa_sampler_active(request_route_rate) && !opa_sampler_decide(request_route_rate, &request_sample_rate)) {
+            request_sampled = 0;
+            debug_log("[RSHUTDOWN] Trace dropped by tail sampling (duration=%ldms, threshold=%ldms)",
+                duration_ms, (long)OPA_G(full_capture_threshold_ms));
+        }
+    }
+    
+    debug_log("[RSHUTDOWN] root_span_span_id=%p, collector=%p, sampled=%d", root_span_span_id, global_collector, request_sampled);
+    if (root_span_span_id && request_sampled) {
         debug_log("[RSHUTDOWN] About to produce span JSON, collector=%p", global_collector);
         // Data already in malloc'd memory - safe to use directly
-        long end_ts = get_timestamp_ms(); // Finalize end_ts
+        long end_ts = opa_clock_wall_ms(get_time_ns()); // Finalize end_ts (same timeline as the call spans)
         // Status is calculated by agent based on HTTP response codes and error indicators
         // Extension only provides data (HTTP response, dumps, etc.) - agent does the calculation
         int status = root_span_status; // Use existing status (defaults to -1, meaning "not set")
@@ -5403,12 +5777,19 @@ PHP_RSHUTDOWN_FUNCTION(opa) {
         debug_log("[RSHUTDOWN] Calling produce_span_json_from_values with dumps_json=%p, len=%zu", dumps_json, dumps_json ? strlen(dumps_json) : 0);
         debug_log("[RSHUTDOWN] HTTP request JSON: %p, len=%zu", root_span_http_request_json, root_span_http_request_json ? strlen(root_span_http_request_json) : 0);
         debug_log("[RSHUTDOWN] HTTP response JSON: %p, len=%zu", root_span_http_response_json, root_span_http_response_json ? strlen(root_span_http_response_json) : 0);
+        // Report the probability this trace was kept with, so the backend can extrapolate counts
+        char sample_tags[64];
+        const char *root_tags_json = NULL;
+        if (opa_sampler_active(request_route_rate)) {
+            snprintf(sample_tags, sizeof(sample_tags), "{\"sample_rate\":%.6g}", request_sample_rate);
+            root_tags_json = sample_tags;
+        }
         json_str = produce_span_json_from_values(
             root_span_trace_id, root_span_span_id, root_span_parent_id, root_span_name,
             root_span_url_scheme, root_span_url_host, root_span_url_path,
             root_span_start_ts, end_ts, root_span_cpu_ms, status, dumps_json,
             root_span_cli_args_json, root_span_http_request_json, root_span_http_response_json,
-            NULL  // tags_json (root span doesn't have custom tags)
+            root_tags_json  // Root span has no custom tags, only the sampling rate
         );
         debug_log("[RSHUTDOWN] Span JSON produced, json_str=%p, len=%zu", json_str, json_str ? strlen(json_str) : 0);
         
@@ -5428,83 +5809,52 @@ PHP_RSHUTDOWN_FUNCTION(opa) {
     opa_finish_request();
     
     // Now send profiling data in background (client connection is already closed)
-    // Use pre-encoded JSON string in regular C memory - safe after fastcgi_finish_request()
+    // Root span and child spans go out as one trace message: framed once, compressed once,
+    // written once. Span JSON is malloc'd - safe after fastcgi_finish_request()
+    opa_trace_batch_t batch;
+    opa_trace_batch_init(&batch);
     if (json_str && json_len > 0) {
-        // During RSHUTDOWN, PHP's memory manager is still active, so emalloc/efree is safe
-        // Convert malloc'd string to emalloc'd for send_message_direct
-        // (send_message_direct expects emalloc'd and will efree it)
-        char *msg_copy = estrdup(json_str);
-        if (msg_copy) {
-            free(json_str); // Free malloc'd version
-            send_message_direct(msg_copy, 1);
-        } else {
-            // NOTE: Do NOT call log_error() here during shutdown - it could cause issues
-            // Just free the malloc'd string and continue
-            free(json_str);
-        }
+        opa_trace_batch_add(&batch, json_str); // Batch takes ownership
     } else if (json_str) {
         free(json_str); // Free if not sent
     }
     
-    // Send child spans as separate messages (if expand_spans is enabled)
+    // Add child spans to the batch (if expand_spans is enabled)
     // All sending happens here in RSHUTDOWN after fastcgi_finish_request()
-    if (OPA_G(expand_spans) && root_span_span_id && root_span_trace_id && global_collector && 
-        global_collector->magic == OPA_COLLECTOR_MAGIC && global_collector->calls) {
+    // Aggregate mode keeps no per-call records to expand
+    if (request_sampled && OPA_G(expand_spans) && root_span_span_id && root_span_trace_id && global_collector && 
+        global_collector->magic == OPA_COLLECTOR_MAGIC && !global_collector->aggregate && global_collector->call_count > 0) {
         
-        debug_log("[RSHUTDOWN] expand_spans enabled, sending child spans from call stack");
+        debug_log("[RSHUTDOWN] expand_spans enabled, collecting child spans from call stack");
         
-        // Iterate through all calls and send significant ones as child spans
-        call_node_t *call = global_collector->calls;
-        int child_spans_sent = 0;
+        // Scan the records in call order and add significant ones as child spans
+        int child_spans_added = 0;
         long root_start_ts = root_span_start_ts;
+        char parent_buf[OPA_CALL_ID_LEN + 1];
         
-        while (call) {
-            if (call->magic == OPA_CALL_NODE_MAGIC && call->start_time > 0.0) {
-                // Check if this call is significant
-                int has_sql = (call->sql_queries && Z_TYPE_P(call->sql_queries) == IS_ARRAY && 
-                               zend_hash_num_elements(Z_ARRVAL_P(call->sql_queries)) > 0);
-                int has_http = (call->http_requests && Z_TYPE_P(call->http_requests) == IS_ARRAY && 
-                                zend_hash_num_elements(Z_ARRVAL_P(call->http_requests)) > 0);
-                int has_cache = (call->cache_operations && Z_TYPE_P(call->cache_operations) == IS_ARRAY && 
-                                 zend_hash_num_elements(Z_ARRVAL_P(call->cache_operations)) > 0);
-                int has_redis = (call->redis_operations && Z_TYPE_P(call->redis_operations) == IS_ARRAY && 
-                                 zend_hash_num_elements(Z_ARRVAL_P(call->redis_operations)) > 0);
+        for (uint32_t i = 0; i < (uint32_t)global_collector->call_count; i++) {
+            call_node_t *call = OPA_CALL_AT(global_collector, i);
+            if (call->start_ns > 0 && opa_call_is_significant(global_collector, call)) {
+                const char *parent_span_id = find_parent_span_id_for_call(call, root_span_span_id, parent_buf);
                 
-                double end_time = call->end_time > 0.0 ? call->end_time : call->start_time + 0.001;
-                double duration_ms = (end_time - call->start_time) * 1000.0;
-                if (duration_ms < 0.0) duration_ms = 0.0;
+                char *child_json = produce_child_span_json_from_call_node(
+                    call, root_span_trace_id, parent_span_id, root_start_ts
+                );
                 
-                if (has_sql || has_http || has_cache || has_redis || duration_ms > 10.0) {
-                    // Significant call - send as child span
-                    char *parent_span_id = find_parent_span_id_for_call(call, global_collector->calls, root_span_span_id);
-                    
-                    char *child_json = produce_child_span_json_from_call_node(
-                        call, root_span_trace_id, parent_span_id, root_start_ts
-                    );
-                    
-                    if (child_json) {
-                        debug_log("[RSHUTDOWN] Sending child span: call_id=%s, parent_span_id=%s", 
-                            call->call_id ? call->call_id : "NULL", parent_span_id);
-                        
-                        // Convert to emalloc'd for send_message_direct
-                        char *msg_copy = estrdup(child_json);
-                        if (msg_copy) {
-                            free(child_json); // Free malloc'd version
-                            send_message_direct(msg_copy, 1);
-                            child_spans_sent++;
-                        } else {
-                            free(child_json);
-                            log_error("Failed to allocate memory for child span message", "estrdup failed", "");
-                        }
-                    }
+                if (child_json) {
+                    debug_log("[RSHUTDOWN] Adding child span: call=%u, parent_span_id=%s", i, parent_span_id);
+                    opa_trace_batch_add(&batch, child_json); // Batch takes ownership
+                    child_spans_added++;
                 }
             }
-            call = call->next;
         }
         
-        debug_log("[RSHUTDOWN] Sent %d child spans (expand_spans mode)", child_spans_sent);
+        debug_log("[RSHUTDOWN] Added %d child spans (expand_spans mode)", child_spans_added);
     }
     
+    send_trace_batch(&batch, root_span_trace_id, 1);
+    opa_trace_batch_free(&batch);
+    
     // Stop collector first, then free it - this will free all calls
     if (global_collector) {
         opa_collector_stop(global_collector);
@@ -5543,6 +5893,7 @@ PHP_RSHUTDOWN_FUNCTION(opa) {
     if (root_span_trace_id) { free(root_span_trace_id); root_span_trace_id = NULL; }
     if (root_span_span_id) { free(root_span_span_id); root_span_span_id = NULL; }
     if (root_span_parent_id) { free(root_span_parent_id); root_span_parent_id = NULL; }
+    if (root_span_tracestate) { free(root_span_tracestate); root_span_tracestate = NULL; }
     if (root_span_name) { free(root_span_name); root_span_name = NULL; }
     if (root_span_url_scheme) { free(root_span_url_scheme); root_span_url_scheme = NULL; }
     if (root_span_url_host) { free(root_span_url_host); root_span_url_host = NULL; }
@@ -5562,6 +5913,7 @@ PHP_RSHUTDOWN_FUNCTION(opa) {
     }
     root_span_start_ts = 0;
     root_span_end_ts = 0;
+    request_anchor_mono_ns = 0;
     root_span_cpu_ms = 0;
     root_span_status = -1;
     pthread_mutex_unlock(&root_span_data_mutex);
@@ -5583,7 +5935,10 @@ PHP_FUNCTION(opa_dump);
 PHP_FUNCTION(opa_enable);
 PHP_FUNCTION(opa_disable);
 PHP_FUNCTION(opa_is_enabled);
+PHP_FUNCTION(opa_is_sampled);
 PHP_FUNCTION(opa_track_error);
+PHP_FUNCTION(opa_transport_stats);
+PHP_FUNCTION(opa_spool_replay);
 
 // Forward declarations for arginfo (defined in opa_api.c)
 ZEND_BEGIN_ARG_INFO_EX(arginfo_opa_start_span, 0, 0, 1)
@@ -5623,6 +5978,9 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_INFO_EX(arginfo_opa_is_enabled, 0, 0, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_opa_is_sampled, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO_EX(arginfo_opa_track_error, 0, 0, 2)
     ZEND_ARG_INFO(0, error_type)
     ZEND_ARG_INFO(0, error_message)
@@ -5631,6 +5989,12 @@ ZEND_BEGIN_ARG_INFO_EX(arginfo_opa_track_error, 0, 0, 2)
     ZEND_ARG_ARRAY_INFO(0, stack_trace, 1)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO_EX(arginfo_opa_transport_stats, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_opa_spool_replay, 0, 0, 0)
+ZEND_END_ARG_INFO()
+
 // Function entries
 static const zend_function_entry opa_functions[] = {
     PHP_FE(opa_start_span, arginfo_opa_start_span)
@@ -5642,7 +6006,10 @@ static const zend_function_entry opa_functions[] = {
     PHP_FE(opa_enable, arginfo_opa_enable)
     PHP_FE(opa_disable, arginfo_opa_disable)
     PHP_FE(opa_is_enabled, arginfo_opa_is_enabled)
+    PHP_FE(opa_is_sampled, arginfo_opa_is_sampled)
     PHP_FE(opa_track_error, arginfo_opa_track_error)
+    PHP_FE(opa_transport_stats, arginfo_opa_transport_stats)
+    PHP_FE(opa_spool_replay, arginfo_opa_spool_replay)
     PHP_FE_END
 };
 
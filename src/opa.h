@@ -25,28 +25,41 @@
 #include <fcntl.h>
 #include <errno.h>
 #ifdef HAVE_LZ4
-#include <lz4.h>
+#include <lz4frame.h>
 #include <lz4hc.h>
 #define LZ4_ENABLED 1
 #else
 #define LZ4_ENABLED 0
 #endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#define ZSTD_ENABLED 1
+#else
+#define ZSTD_ENABLED 0
+#endif
 
 // Constants
 #define MSG_MAX 1048576
 #define MAX_STACK_DEPTH 50
-#define COMPRESSION_HEADER "LZ4"
-#define OPA_CALL_NODE_MAGIC 0x4F504100  // "OPA\0"
 
 // Module globals structure
 ZEND_BEGIN_MODULE_GLOBALS(opa)
     zend_bool enabled;
     double sampling_rate;
+    double sampling_target_tps; // Traces per second per host from a shared token bucket (0 = use sampling_rate)
+    char *sampling_rules; // Per-route rates: "[METHOD] /path rate", comma separated (compiled at MINIT)
+    zend_bool trace_propagation; // Continue incoming W3C traceparent and inject it into outgoing cURL requests
     char *socket_path;
     zend_long full_capture_threshold_ms;
-    zend_long stack_depth;
+    zend_long stack_depth; // Deepest recorded call; deeper calls are summarized on their caller (0 = unlimited)
+    zend_long max_calls; // Call records per request (0 = unlimited)
+    zend_long max_call_bytes; // Memory for call records, names and their side table per request (0 = unlimited)
     zend_long buffer_size;
     zend_bool collect_internal_functions;
+    zend_bool call_cpu_time; // Read the thread CPU clock on every call entry and exit
+    zend_long mode; // OPA_MODE_* parsed from opa.mode (tree = one record per call, aggregate = call graph edges)
+    char *include; // Only observe matching functions, comma separated (compiled at MINIT, see filter.h)
+    char *exclude; // Never observe matching functions (compiled at MINIT)
     zend_bool debug_log_enabled; // Enable/disable debug logging
     char *organization_id;
     char *project_id;
@@ -59,6 +72,23 @@ ZEND_BEGIN_MODULE_GLOBALS(opa)
     zend_bool track_logs; // Enable/disable log tracking
     char *log_levels; // Comma-separated list: critical,error,warning
     zend_bool expand_spans; // 1 = multiple spans (default), 0 = full span
+    zend_bool async_send; // 1 = hand payloads to the background sender thread
+    zend_long async_queue_size; // Capacity of the sender ring (rounded up to a power of two)
+    zend_long shm_size; // Data capacity of a shared-memory ring created by the extension (shm:/name)
+    zend_long compression_codec; // OPA_CODEC_* parsed from opa.compression
+    zend_long compression_level; // Codec-specific level, 0 = codec default
+    zend_long compression_min_size; // Payloads smaller than this are sent uncompressed
+    char *zstd_dict_path; // Trained zstd dictionary loaded at MINIT
+    zend_long zstd_dict_min_size; // Minimum payload size when a dictionary is loaded
+    char *zstd_sample_dir; // Capture uncompressed payloads here for dictionary training
+    zend_long dns_refresh_sec; // Re-resolve a TCP agent host name this often in the background (0 = once)
+    zend_long send_timeout_ms; // Deadline for connecting and writing one message (0 = none)
+    zend_long breaker_threshold; // Consecutive failed sends before collection is suspended (0 = never)
+    zend_long breaker_backoff_ms; // First backoff before the agent is probed again
+    zend_long breaker_max_backoff_ms; // Backoff doubles on every failed probe up to this
+    char *spool_dir; // Undeliverable frames are spooled here and replayed later (empty = drop them)
+    zend_long spool_max_bytes; // Cap on the spool directory
+    zend_long spool_segment_size; // Size of one mmap'd spool segment
 ZEND_END_MODULE_GLOBALS(opa)
 
 // Declare extern for other files - actual declaration is in opa.c
@@ -67,35 +97,47 @@ extern zend_opa_globals opa_globals;
 // Macro helper for accessing globals
 #define OPA_G(v) (opa_globals.v)
 
-// Call node structure for call stack tracking
+// Call record: one per tracked call, fixed size, stored in call order
+// Names are symbol ids (symbol.h), the caller is a record index, and the rare
+// SQL/HTTP/cache/Redis data lives in a side table (opa_call_io_t).
+#define OPA_CALL_NONE 0xFFFFFFFFu // No parent / no record
+#define OPA_CALL_ID_LEN 16 // Hex digits of a serialized call id
+
 typedef struct call_node {
-    unsigned int magic; // Magic number for validation
-    char *call_id;
-    char *function_name;
-    char *class_name;
-    char *file;
-    int line;
-    double start_time;
-    double end_time;
-    double start_cpu_time;
-    double end_cpu_time;
-    size_t start_memory;
-    size_t end_memory;
-    size_t start_bytes_sent;
-    size_t end_bytes_sent;
-    size_t start_bytes_received;
-    size_t end_bytes_received;
-    char *parent_id;
-    zval *children;
-    int depth;
-    int function_type; // 0=user, 1=internal, 2=method
+    uint32_t index;         // Position in call order
+    uint32_t parent;        // Record index of the caller, OPA_CALL_NONE at the top level
+    uint32_t function_name; // Symbol id, 0 = none
+    uint32_t class_name;    // Symbol id, 0 = none
+    uint32_t file;          // Symbol id, 0 = none
+    uint32_t line;
+    uint32_t io;            // 1-based index into the collector's I/O side table, 0 = none
+    uint16_t depth;
+    uint8_t function_type;  // 0=user, 1=internal, 2=method
+    int64_t start_ns;       // Wall clock
+    int64_t end_ns;         // 0 until the call exits
+    int64_t start_cpu_ns;
+    int64_t end_cpu_ns;
+    int64_t memory;         // Memory usage at entry, delta once the call has exited
+    int64_t bytes_sent;     // Network bytes sent at entry, delta once the call has exited
+    int64_t bytes_received; // Network bytes received at entry, delta once the call has exited
+} call_node_t;
+
+// Rare per-call data: I/O records (PHP arrays, zval holders in the request arena)
+// and the summary of callees that were not recorded because of the call budget
+typedef struct {
     zval *sql_queries; // Array of SQL queries executed in this call
     zval *http_requests; // Array of HTTP requests (cURL) executed in this call
     zval *cache_operations; // Array of cache operations (APCu, Symfony Cache) executed in this call
     zval *redis_operations; // Array of Redis operations executed in this call
-    struct call_node *next; // Next in calls list
-    struct call_node *stack_next; // Next in call stack (for unlimited depth)
-} call_node_t;
+    uint32_t truncated_calls; // Calls below this one summarized instead of recorded
+    int64_t truncated_ns; // Wall time of the outermost summarized calls
+} opa_call_io_t;
+
+// Records are kept in fixed-size blocks from the request arena, so they never move
+#define OPA_CALL_BLOCK_SHIFT 9
+#define OPA_CALL_BLOCK_SIZE (1u << OPA_CALL_BLOCK_SHIFT)
+#define OPA_CALL_AT(collector, index) \
+    (&(collector)->call_blocks[(index) >> OPA_CALL_BLOCK_SHIFT][(index) & (OPA_CALL_BLOCK_SIZE - 1)])
 
 // Tag storage structure (malloc'd, persistent across requests)
 typedef struct span_tag {
@@ -131,12 +173,20 @@ typedef struct {
 
 typedef struct _opa_collector_t {
     unsigned int magic; // Magic number for integrity checking
-    call_node_t *calls; // Linked list of all calls
-    call_node_t *call_stack_top; // Top of call stack (linked list, no depth limit)
-    int call_stack_depth; // Current depth (for debugging, no limit enforced) // Current stack depth
-    int call_depth; // Current call depth (for statistics)
-    int call_count; // Total number of calls tracked
+    call_node_t **call_blocks; // Call records in call order (OPA_CALL_AT), blocks from the request arena
+    uint32_t call_block_capacity; // Slots in call_blocks
+    uint64_t call_id_base; // Serialized call id = call_id_base + record index
+    opa_call_io_t *call_io; // I/O side table (emalloc'd), indexed by call_node_t.io - 1
+    uint32_t call_io_count;
+    uint32_t call_io_capacity;
+    call_node_t *call_stack_top; // Top of call stack (records link to their caller)
+    int call_stack_depth; // Recorded calls on the stack (limited by opa.stack_depth)
+    int call_count; // Records in use: one per call in tree mode, the deepest stack in aggregate mode
     zend_bool active; // Whether collector is active
+    zend_bool aggregate; // opa.mode=aggregate for this request: records are reused as a stack, calls fold into edges
+    uint64_t calls_summarized; // Calls past the budget (depth, calls, bytes), counted but not recorded
+    uint32_t summary_depth; // Nesting of the summarized calls currently executing
+    int64_t summary_start_ns; // Start of the outermost one
     double start_time; // Request start time
     double end_time; // Request end time
     size_t start_memory; // Request start memory
@@ -152,6 +202,7 @@ extern pthread_mutex_t active_spans_mutex;
 extern char *root_span_trace_id;
 extern char *root_span_span_id;
 extern char *root_span_parent_id;
+extern char *root_span_tracestate;
 extern char *root_span_name;
 extern char *root_span_url_scheme;
 extern char *root_span_url_host;
@@ -166,6 +217,9 @@ extern int root_span_status;
 extern zval *root_span_dumps; // Root span dumps array
 extern pthread_mutex_t root_span_data_mutex;
 extern int profiling_active;
+extern int request_sampled;
+extern int request_error_tracked;
+extern double request_sample_rate;
 extern opa_collector_t *global_collector;
 extern size_t network_bytes_sent_total;
 extern size_t network_bytes_received_total;
@@ -173,15 +227,21 @@ extern pthread_mutex_t network_mutex;
 
 // Helper functions (declared in opa.c)
 char* generate_id(void);
+char* generate_trace_id(void);
 long get_timestamp_ms(void);
 double get_time_seconds(void);
 size_t get_memory_usage(void);
-double get_cpu_time(void);
+int64_t get_time_ns(void);
+int64_t get_cpu_time_ns(void);
+double get_elapsed_seconds(int64_t since_ns);
+long opa_clock_anchor_request(void);
+long opa_clock_wall_ms(int64_t mono_ns);
 size_t get_bytes_sent(void);
 size_t get_bytes_received(void);
 void add_bytes_sent(size_t bytes);
 void add_bytes_received(size_t bytes);
 void debug_log(const char *msg, ...);
+void opa_debug_log_detach_thread(void); // Background threads: never read OPA_G from debug_log()
 void log_error(const char *message, const char *error, const char *fields_json);
 void log_warn(const char *message, const char *fields_json);
 void log_info(const char *message, const char *fields_json);
@@ -208,8 +268,14 @@ void opa_collector_stop(opa_collector_t *collector);
 void opa_collector_free(opa_collector_t *collector);
 
 // Call tracking functions
-char* opa_enter_function(const char *function_name, const char *class_name, const char *file, int line, int function_type);
-void opa_exit_function(const char *call_id);
+call_node_t* opa_call_get(opa_collector_t *collector, uint32_t index); // NULL if out of range
+opa_call_io_t* opa_call_io(opa_collector_t *collector, call_node_t *call); // NULL if the call has no I/O records
+opa_call_io_t* opa_call_io_ensure(call_node_t *call); // Creates the call's side table entry (call_node.c)
+void opa_call_format_id(opa_collector_t *collector, uint32_t index, char *buf); // OPA_CALL_ID_LEN + 1 bytes
+int opa_call_is_significant(opa_collector_t *collector, call_node_t *call); // Sent as its own span in expand_spans mode
+call_node_t* opa_enter_function(zend_string *function_name, zend_string *class_name, zend_string *file, int line, int function_type);
+call_node_t* opa_enter_root(const char *file, int line);
+void opa_exit_function(call_node_t *call);
 
 // zend_execute_ex hook
 extern void (*original_zend_execute_ex)(zend_execute_data *execute_data);
@@ -1,7 +1,10 @@
 #include "opa.h"
 #include "span.h"
 #include "transport.h"
+#include "sender.h"
+#include "compress.h"
 #include "serialize.h"
+#include "rng.h"
 
 // Creates a new manual span and returns its span_id
 // Manual spans allow programmatic tracing of specific operations
@@ -18,7 +21,7 @@ PHP_FUNCTION(opa_start_span) {
     HashTable *spans = get_active_spans();
     
     char *span_id = generate_id();
-    char *trace_id = generate_id();
+    char *trace_id = generate_trace_id();
     span_context_t *span = create_span_context(span_id, trace_id, NULL);
     // create_span_context does estrdup, so free original IDs
     efree(span_id);
@@ -305,9 +308,9 @@ PHP_FUNCTION(dump) {
         // Initialize root span if it doesn't exist yet (will be finalized in opa_execute_ex)
         if (!root_span_span_id) {
             // Create minimal root span data - will be updated when first function is called
-            root_span_span_id = strdup(generate_id());
-            root_span_trace_id = strdup(generate_id());
-            root_span_start_ts = get_timestamp_ms();
+            root_span_span_id = opa_span_id_str();
+            root_span_trace_id = opa_trace_id_str();
+            root_span_start_ts = opa_clock_anchor_request();
             
             // Try to extract real URI from $_SERVER instead of using generic name
             zval *server = NULL;
@@ -477,9 +480,9 @@ PHP_FUNCTION(opa_dump) {
         // Initialize root span if it doesn't exist yet (will be finalized in opa_execute_ex)
         if (!root_span_span_id) {
             // Create minimal root span data - will be updated when first function is called
-            root_span_span_id = strdup(generate_id());
-            root_span_trace_id = strdup(generate_id());
-            root_span_start_ts = get_timestamp_ms();
+            root_span_span_id = opa_span_id_str();
+            root_span_trace_id = opa_trace_id_str();
+            root_span_start_ts = opa_clock_anchor_request();
             
             // Try to extract real URI from $_SERVER instead of using generic name
             zval *server = NULL;
@@ -613,8 +616,10 @@ PHP_FUNCTION(opa_dump) {
 // Can be called at runtime to enable profiling even if it was disabled at request start
 PHP_FUNCTION(opa_enable) {
     
-    // Set profiling active flag
+    // Set profiling active flag (an explicit enable overrides the sampling decision)
     profiling_active = 1;
+    request_sampled = 1;
+    request_sample_rate = 1.0;
     
     // Initialize collector if not already initialized
     if (!global_collector) {
@@ -650,6 +655,14 @@ PHP_FUNCTION(opa_is_enabled) {
     RETURN_BOOL(profiling_active != 0);
 }
 
+// Returns whether the current request was selected by head sampling (opa.sampling_rate)
+// Unsampled requests are not profiled and send no trace
+PHP_FUNCTION(opa_is_sampled) {
+    ZEND_PARSE_PARAMETERS_NONE();
+    
+    RETURN_BOOL(request_sampled != 0);
+}
+
 // Error tracking function - called from PHP userland error handlers
 PHP_FUNCTION(opa_track_error) {
     zend_string *error_type = NULL;
@@ -680,3 +693,50 @@ PHP_FUNCTION(opa_track_error) {
         &exception_code
     );
 }
+
+// Returns transport counters for this worker process (async sender queue, shared-memory ring)
+PHP_FUNCTION(opa_transport_stats) {
+    ZEND_PARSE_PARAMETERS_NONE();
+    
+    opa_sender_stats_t stats;
+    opa_sender_get_stats(&stats);
+    opa_transport_stats_t transport_stats;
+    opa_transport_get_stats(&transport_stats);
+    opa_compress_stats_t compress_stats;
+    opa_compress_get_stats(&compress_stats);
+    
+    array_init(return_value);
+    add_assoc_bool(return_value, "async", OPA_G(async_send));
+    add_assoc_long(return_value, "enqueued", (zend_long)stats.enqueued);
+    add_assoc_long(return_value, "sent", (zend_long)stats.sent);
+    add_assoc_long(return_value, "queued", (zend_long)stats.queued);
+    add_assoc_long(return_value, "dropped_full", (zend_long)stats.dropped_full);
+    add_assoc_long(return_value, "send_failed", (zend_long)stats.send_failed);
+    add_assoc_long(return_value, "shm_dropped", (zend_long)transport_stats.shm_dropped);
+    add_assoc_long(return_value, "dropped_bytes", (zend_long)transport_stats.dropped_bytes);
+    add_assoc_long(return_value, "send_timeouts", (zend_long)transport_stats.send_timeouts);
+    add_assoc_string(return_value, "breaker", transport_stats.breaker_state == OPA_BREAKER_OPEN ? "open" :
+        (transport_stats.breaker_state == OPA_BREAKER_HALF_OPEN ? "half-open" : "closed"));
+    add_assoc_long(return_value, "breaker_trips", (zend_long)transport_stats.breaker_trips);
+    add_assoc_long(return_value, "breaker_rejected", (zend_long)transport_stats.breaker_rejected);
+    add_assoc_long(return_value, "spooled", (zend_long)transport_stats.spool.spooled);
+    add_assoc_long(return_value, "spool_dropped", (zend_long)transport_stats.spool.dropped);
+    add_assoc_long(return_value, "spool_replayed", (zend_long)transport_stats.spool.replayed);
+    add_assoc_long(return_value, "spool_bytes", (zend_long)transport_stats.spool.bytes);
+    add_assoc_long(return_value, "compressed", (zend_long)compress_stats.compressed);
+    add_assoc_long(return_value, "compression_skipped", (zend_long)(compress_stats.skipped_ratio + compress_stats.skipped_adaptive));
+    add_assoc_long(return_value, "compressed_bytes_in", (zend_long)compress_stats.bytes_in);
+    add_assoc_long(return_value, "compressed_bytes_out", (zend_long)compress_stats.bytes_out);
+}
+
+// Replays the local disk spool (opa.spool_dir) to the agent now
+// Returns the number of messages replayed, or false if the agent is unreachable
+PHP_FUNCTION(opa_spool_replay) {
+    ZEND_PARSE_PARAMETERS_NONE();
+    
+    long replayed = opa_transport_replay_spool();
+    if (replayed < 0) {
+        RETURN_FALSE;
+    }
+    RETURN_LONG((zend_long)replayed);
+}
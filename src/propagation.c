@@ -0,0 +1,90 @@
+#include "propagation.h"
+#include <ctype.h>
+
+static int is_lower_hex(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (!((s[i] >= '0' && s[i] <= '9') || (s[i] >= 'a' && s[i] <= 'f'))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int is_all_zero(const char *s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] != '0') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int hex_value(char c) {
+    return (c >= '0' && c <= '9') ? c - '0' : c - 'a' + 10;
+}
+
+int opa_traceparent_parse(const char *value, opa_trace_context_t *ctx) {
+    if (!value || !ctx) {
+        return -1;
+    }
+    while (*value == ' ' || *value == '\t') {
+        value++;
+    }
+    size_t len = strlen(value);
+    while (len > 0 && isspace((unsigned char)value[len - 1])) {
+        len--;
+    }
+    if (len < OPA_TRACEPARENT_LEN ||
+        value[2] != '-' || value[35] != '-' || value[52] != '-' ||
+        !is_lower_hex(value, 2) || !is_lower_hex(value + 3, 32) ||
+        !is_lower_hex(value + 36, 16) || !is_lower_hex(value + 53, 2)) {
+        return -1;
+    }
+    // Version ff is invalid; version 00 has no extra fields, later versions may append some
+    if (memcmp(value, "ff", 2) == 0 ||
+        (memcmp(value, "00", 2) == 0 && len != OPA_TRACEPARENT_LEN) ||
+        (len > OPA_TRACEPARENT_LEN && value[OPA_TRACEPARENT_LEN] != '-')) {
+        return -1;
+    }
+    if (is_all_zero(value + 3, 32) || is_all_zero(value + 36, 16)) {
+        return -1;
+    }
+
+    memcpy(ctx->trace_id, value + 3, 32);
+    ctx->trace_id[32] = '\0';
+    memcpy(ctx->parent_id, value + 36, 16);
+    ctx->parent_id[16] = '\0';
+    int flags = hex_value(value[53]) * 16 + hex_value(value[54]);
+    ctx->sampled = (flags & OPA_TRACE_FLAG_SAMPLED) ? 1 : 0;
+    return 0;
+}
+
+// Copy a hex id into a fixed-width field, left-padding shorter ids with zeros
+static int format_id(char *out, size_t width, const char *id) {
+    size_t len = id ? strlen(id) : 0;
+    if (len == 0 || len > width || !is_lower_hex(id, len)) {
+        return -1;
+    }
+    memset(out, '0', width - len);
+    memcpy(out + (width - len), id, len);
+    return is_all_zero(out, width) ? -1 : 0;
+}
+
+int opa_traceparent_format(char *buf, size_t size, const char *trace_id, const char *span_id, int sampled) {
+    if (!buf || size < OPA_TRACEPARENT_LEN + 1) {
+        return -1;
+    }
+    memcpy(buf, "00-", 3);
+    if (format_id(buf + 3, 32, trace_id) < 0) {
+        return -1;
+    }
+    buf[35] = '-';
+    if (format_id(buf + 36, 16, span_id) < 0) {
+        return -1;
+    }
+    buf[52] = '-';
+    buf[53] = '0';
+    buf[54] = sampled ? '1' : '0';
+    buf[55] = '\0';
+    return OPA_TRACEPARENT_LEN;
+}
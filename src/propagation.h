@@ -0,0 +1,26 @@
+#ifndef PROPAGATION_H
+#define PROPAGATION_H
+
+#include "opa.h"
+
+// W3C Trace Context propagation
+// Incoming requests continue the trace named by their traceparent header and
+// follow its sampled flag. Outgoing cURL requests carry the current context:
+//   traceparent: 00-<32 hex trace-id>-<16 hex parent-id>-<2 hex flags>
+//   tracestate:  forwarded unchanged from the incoming request
+
+#define OPA_TRACEPARENT_LEN 55
+#define OPA_TRACESTATE_MAX 512
+#define OPA_TRACE_FLAG_SAMPLED 0x01
+
+typedef struct {
+    char trace_id[33];  // 32 lowercase hex digits
+    char parent_id[17]; // 16 lowercase hex digits (span of the caller)
+    int sampled;        // Caller's sampled flag
+} opa_trace_context_t;
+
+// Propagation functions
+int opa_traceparent_parse(const char *value, opa_trace_context_t *ctx); // 0 if valid, -1 otherwise
+int opa_traceparent_format(char *buf, size_t size, const char *trace_id, const char *span_id, int sampled); // Length, -1 if the ids are unusable
+
+#endif /* PROPAGATION_H */
@@ -0,0 +1,321 @@
+#include "resolver.h"
+
+// Cache for one target (the current opa.socket_path), guarded by resolver_mutex
+static pthread_mutex_t resolver_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resolver_cond = PTHREAD_COND_INITIALIZER;
+static char *resolver_host = NULL; // malloc'd
+static char resolver_port[8] = {0};
+static opa_agent_addr_t resolver_addrs[OPA_AGENT_MAX_ADDRS];
+static int resolver_count = 0;
+static int resolver_preferred = 0; // Index of the last address that accepted a connection
+
+// Read without the lock in RINIT
+static uint64_t resolver_target_hash = 0; // Hash of the socket_path the cache belongs to
+static uint64_t resolver_expires_ms = 0;
+static int resolver_thread_running = 0;
+
+static pthread_t resolver_thread;
+static int resolver_stop = 0;
+
+// opa.dns_refresh_sec, copied at MINIT: read by the refresh and sender threads
+static long refresh_sec = 0;
+
+static uint64_t resolver_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// FNV-1a, never 0 (0 = nothing cached)
+static uint64_t target_hash(const char *s) {
+    uint64_t h = 14695981039346656037ULL;
+    while (*s) {
+        h ^= (unsigned char)*s++;
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;
+}
+
+static void resolver_atfork_child(void) {
+    // The refresh thread does not exist in the child; the next RINIT restarts it
+    resolver_thread_running = 0;
+    resolver_stop = 0;
+    pthread_mutex_init(&resolver_mutex, NULL);
+    pthread_cond_init(&resolver_cond, NULL);
+}
+
+// Called from MINIT
+void opa_resolver_init(void) {
+    refresh_sec = (long)OPA_G(dns_refresh_sec);
+    static int atfork_registered = 0;
+    if (!atfork_registered) {
+        pthread_atfork(NULL, NULL, resolver_atfork_child);
+        atfork_registered = 1;
+    }
+}
+
+// Called from MSHUTDOWN
+void opa_resolver_shutdown(void) {
+    pthread_mutex_lock(&resolver_mutex);
+    int running = resolver_thread_running;
+    resolver_stop = 1;
+    pthread_cond_signal(&resolver_cond);
+    pthread_mutex_unlock(&resolver_mutex);
+    if (running) {
+        pthread_join(resolver_thread, NULL);
+    }
+
+    pthread_mutex_lock(&resolver_mutex);
+    resolver_thread_running = 0;
+    resolver_stop = 0;
+    if (resolver_host) {
+        free(resolver_host);
+        resolver_host = NULL;
+    }
+    resolver_count = 0;
+    __atomic_store_n(&resolver_target_hash, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&resolver_mutex);
+}
+
+// Split "host:port", "[v6addr]:port" or a bare "port" (localhost)
+int opa_resolver_parse(const char *sock_path, char *host, size_t host_size, char *port, size_t port_size) {
+    const char *port_str;
+    size_t host_len;
+    if (sock_path[0] == '[') {
+        const char *end = strchr(sock_path, ']');
+        if (!end || end[1] != ':') {
+            return -1;
+        }
+        host_len = (size_t)(end - sock_path - 1);
+        port_str = end + 2;
+        sock_path++;
+    } else {
+        const char *colon = strrchr(sock_path, ':');
+        if (!colon) {
+            port_str = sock_path;
+            sock_path = "127.0.0.1";
+            host_len = strlen(sock_path);
+        } else {
+            host_len = (size_t)(colon - sock_path);
+            port_str = colon + 1;
+        }
+    }
+    if (host_len == 0 || host_len >= host_size) {
+        return -1;
+    }
+    int port_num = atoi(port_str);
+    if (port_num <= 0 || port_num > 65535) {
+        debug_log("[RESOLVER] Invalid port number: %s", port_str);
+        return -1;
+    }
+    memcpy(host, sock_path, host_len);
+    host[host_len] = '\0';
+    snprintf(port, port_size, "%d", port_num);
+    return 0;
+}
+
+// Resolve every address of host (A and AAAA, in getaddrinfo's preference order).
+// With numeric_only, IP literals are parsed and nothing is looked up.
+static int resolve_all(const char *host, const char *port, int numeric_only, opa_agent_addr_t *out, int max) {
+    struct addrinfo hints, *result, *rp;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = numeric_only ? AI_NUMERICHOST | AI_NUMERICSERV : AI_NUMERICSERV;
+    if (getaddrinfo(host, port, &hints, &result) != 0) {
+        return 0;
+    }
+    int n = 0;
+    for (rp = result; rp != NULL && n < max; rp = rp->ai_next) {
+        if ((rp->ai_family != AF_INET && rp->ai_family != AF_INET6) || rp->ai_addrlen > sizeof(out[n].addr)) {
+            continue;
+        }
+        memcpy(&out[n].addr, rp->ai_addr, rp->ai_addrlen);
+        out[n].len = rp->ai_addrlen;
+        n++;
+    }
+    freeaddrinfo(result);
+    return n;
+}
+
+// Install a resolution result; keeps the preferred address if it is still listed.
+// Caller holds resolver_mutex.
+static void resolver_install(const opa_agent_addr_t *addrs, int count) {
+    int preferred = 0;
+    if (resolver_preferred < resolver_count) {
+        const opa_agent_addr_t *old = &resolver_addrs[resolver_preferred];
+        for (int i = 0; i < count; i++) {
+            if (addrs[i].len == old->len && memcmp(&addrs[i].addr, &old->addr, old->len) == 0) {
+                preferred = i;
+                break;
+            }
+        }
+    }
+    memcpy(resolver_addrs, addrs, sizeof(opa_agent_addr_t) * count);
+    resolver_count = count;
+    resolver_preferred = preferred;
+}
+
+static uint64_t refresh_interval_ms(void) {
+    return refresh_sec > 0 ? (uint64_t)refresh_sec * 1000 : 0;
+}
+
+// Background refresh: re-resolve the cached host every opa.dns_refresh_sec.
+// A failed lookup keeps the previous addresses.
+static void *resolver_thread_main(void *arg) {
+    (void)arg;
+    opa_debug_log_detach_thread();
+    pthread_mutex_lock(&resolver_mutex);
+    while (!resolver_stop) {
+        uint64_t interval = refresh_interval_ms();
+        if (interval == 0) {
+            break;
+        }
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += (time_t)(interval / 1000);
+        until.tv_nsec += (long)(interval % 1000) * 1000000;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&resolver_cond, &resolver_mutex, &until);
+        if (resolver_stop || !resolver_host) {
+            continue;
+        }
+
+        char host[256];
+        char port[8];
+        uint64_t hash = __atomic_load_n(&resolver_target_hash, __ATOMIC_RELAXED);
+        snprintf(host, sizeof(host), "%s", resolver_host);
+        memcpy(port, resolver_port, sizeof(port));
+        pthread_mutex_unlock(&resolver_mutex);
+
+        opa_agent_addr_t addrs[OPA_AGENT_MAX_ADDRS];
+        int n = resolve_all(host, port, 0, addrs, OPA_AGENT_MAX_ADDRS);
+
+        pthread_mutex_lock(&resolver_mutex);
+        // Target may have changed while resolving
+        if (n > 0 && hash == __atomic_load_n(&resolver_target_hash, __ATOMIC_RELAXED)) {
+            resolver_install(addrs, n);
+            __atomic_store_n(&resolver_expires_ms, resolver_now_ms() + interval, __ATOMIC_RELAXED);
+        } else if (n == 0) {
+            debug_log("[RESOLVER] Refresh of %s failed, keeping %d cached addresses", host, resolver_count);
+        }
+    }
+    __atomic_store_n(&resolver_thread_running, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&resolver_mutex);
+    return NULL;
+}
+
+// Caller holds resolver_mutex
+static void resolver_start_thread(void) {
+    if (resolver_thread_running || refresh_interval_ms() == 0) {
+        return;
+    }
+    resolver_stop = 0;
+    // The resolver thread must never run PHP signal handlers
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int rc = pthread_create(&resolver_thread, NULL, resolver_thread_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0) {
+        debug_log("[RESOLVER] Failed to start refresh thread: %d", rc);
+        return;
+    }
+    __atomic_store_n(&resolver_thread_running, 1, __ATOMIC_RELAXED);
+}
+
+// Resolve in RINIT (a safe context for getaddrinfo) when the cache is missing,
+// belongs to another socket_path, or is stale without a refresh thread.
+// The fresh-cache path is a hash of socket_path and two atomic loads.
+void opa_resolver_refresh(const char *sock_path) {
+    uint64_t hash = target_hash(sock_path);
+    if (hash == __atomic_load_n(&resolver_target_hash, __ATOMIC_RELAXED) &&
+        (__atomic_load_n(&resolver_thread_running, __ATOMIC_RELAXED) ||
+         resolver_now_ms() < __atomic_load_n(&resolver_expires_ms, __ATOMIC_RELAXED))) {
+        return;
+    }
+
+    char host[256];
+    char port[8];
+    if (opa_resolver_parse(sock_path, host, sizeof(host), port, sizeof(port)) != 0) {
+        return;
+    }
+    opa_agent_addr_t addrs[OPA_AGENT_MAX_ADDRS];
+    int literal = 1;
+    int n = resolve_all(host, port, 1, addrs, OPA_AGENT_MAX_ADDRS);
+    if (n == 0) {
+        literal = 0;
+        n = resolve_all(host, port, 0, addrs, OPA_AGENT_MAX_ADDRS);
+    }
+
+    pthread_mutex_lock(&resolver_mutex);
+    int same_target = hash == __atomic_load_n(&resolver_target_hash, __ATOMIC_RELAXED);
+    if (n > 0) {
+        if (!same_target) {
+            resolver_count = 0;
+        }
+        resolver_install(addrs, n);
+        if (!resolver_host || strcmp(resolver_host, host) != 0) {
+            if (resolver_host) {
+                free(resolver_host);
+            }
+            resolver_host = strdup(host);
+        }
+        memcpy(resolver_port, port, sizeof(resolver_port));
+        // IP literals never change and need no refresh
+        __atomic_store_n(&resolver_expires_ms, literal ? UINT64_MAX : resolver_now_ms() + refresh_interval_ms(),
+            __ATOMIC_RELAXED);
+        __atomic_store_n(&resolver_target_hash, hash, __ATOMIC_RELAXED);
+        if (!literal) {
+            resolver_start_thread();
+        }
+        debug_log("[RESOLVER] %s resolved to %d address(es)", host, n);
+    } else {
+        // Keep serving stale addresses for the same target; retry on the next request
+        debug_log("[RESOLVER] Cannot resolve %s", host);
+    }
+    pthread_mutex_unlock(&resolver_mutex);
+}
+
+// Addresses to try for sock_path, preferred first. Safe from any context: IP
+// literals are parsed without a lookup, host names are served from the cache only.
+int opa_resolver_get(const char *sock_path, opa_agent_addr_t *addrs, int max) {
+    uint64_t hash = target_hash(sock_path);
+    int n = 0;
+    pthread_mutex_lock(&resolver_mutex);
+    if (resolver_count > 0 && hash == __atomic_load_n(&resolver_target_hash, __ATOMIC_RELAXED)) {
+        for (int i = 0; i < resolver_count && n < max; i++) {
+            addrs[n++] = resolver_addrs[(resolver_preferred + i) % resolver_count];
+        }
+    }
+    pthread_mutex_unlock(&resolver_mutex);
+    if (n > 0) {
+        return n;
+    }
+
+    char host[256];
+    char port[8];
+    if (opa_resolver_parse(sock_path, host, sizeof(host), port, sizeof(port)) != 0) {
+        return 0;
+    }
+    n = resolve_all(host, port, 1, addrs, max);
+    if (n == 0) {
+        // No cache - this might be called from an unsafe context, so no getaddrinfo lookup
+        debug_log("[RESOLVER] Cannot resolve host (no cache, unsafe context): %s", host);
+    }
+    return n;
+}
+
+void opa_resolver_mark_good(const opa_agent_addr_t *addr) {
+    pthread_mutex_lock(&resolver_mutex);
+    for (int i = 0; i < resolver_count; i++) {
+        if (resolver_addrs[i].len == addr->len && memcmp(&resolver_addrs[i].addr, &addr->addr, addr->len) == 0) {
+            resolver_preferred = i;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&resolver_mutex);
+}
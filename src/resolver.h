@@ -0,0 +1,27 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include "opa.h"
+
+// Agent address cache for TCP transports (opa.socket_path=host:port or [v6addr]:port)
+// Holds every A/AAAA record of the agent host. After the first resolution in
+// RINIT, a background thread re-resolves it every opa.dns_refresh_sec, so
+// requests never wait on DNS and agent pod IP changes are picked up. Connects
+// try the addresses in order, starting with the last one that worked.
+
+#define OPA_AGENT_MAX_ADDRS 8
+
+typedef struct {
+    struct sockaddr_storage addr;
+    socklen_t len;
+} opa_agent_addr_t;
+
+// Resolver functions
+void opa_resolver_init(void); // Register fork handler (MINIT)
+void opa_resolver_shutdown(void); // Stop the refresh thread (MSHUTDOWN)
+int opa_resolver_parse(const char *sock_path, char *host, size_t host_size, char *port, size_t port_size); // -1 if invalid
+void opa_resolver_refresh(const char *sock_path); // RINIT: no-op while the cache is fresh
+int opa_resolver_get(const char *sock_path, opa_agent_addr_t *addrs, int max); // Never does DNS; 0 if unresolved
+void opa_resolver_mark_good(const opa_agent_addr_t *addr); // Prefer this address for the next connect
+
+#endif /* RESOLVER_H */
@@ -0,0 +1,135 @@
+#include "rng.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+
+// Bumped in the child after every fork; a thread whose state is from an
+// older generation reseeds before its next draw
+static volatile unsigned int fork_generation = 1;
+static pthread_once_t atfork_once = PTHREAD_ONCE_INIT;
+
+static __thread uint64_t rng_state[4];
+static __thread unsigned int rng_generation = 0;
+
+static void rng_after_fork_child(void) {
+    fork_generation++;
+}
+
+static void rng_register_atfork(void) {
+    pthread_atfork(NULL, NULL, rng_after_fork_child);
+}
+
+static inline uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static void rng_seed(void) {
+    uint64_t entropy[4] = {0, 0, 0, 0};
+    int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        if (read(fd, entropy, sizeof(entropy)) != (ssize_t)sizeof(entropy)) {
+            debug_log("[RNG] Short read from /dev/urandom, seeding from clocks only");
+        }
+        close(fd);
+    }
+
+    // Mixed in even when urandom worked: distinct per process, thread and moment
+    struct timespec wall, mono;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    uint64_t x = ((uint64_t)wall.tv_sec * 1000000000ULL + (uint64_t)wall.tv_nsec) ^
+                 ((uint64_t)mono.tv_nsec << 32) ^ ((uint64_t)getpid() << 16) ^
+                 (uint64_t)pthread_self() ^ (uint64_t)(uintptr_t)&x;
+
+    for (int i = 0; i < 4; i++) {
+        rng_state[i] = splitmix64(&x) ^ entropy[i];
+    }
+    // xoshiro must not start from the all-zero state
+    if ((rng_state[0] | rng_state[1] | rng_state[2] | rng_state[3]) == 0) {
+        rng_state[0] = 0x9E3779B97F4A7C15ULL;
+    }
+    rng_generation = fork_generation;
+}
+
+uint64_t opa_random_u64(void) {
+    if (rng_generation != fork_generation) {
+        pthread_once(&atfork_once, rng_register_atfork);
+        rng_seed();
+    }
+
+    // xoshiro256**
+    uint64_t *s = rng_state;
+    const uint64_t result = rotl(s[1] * 5, 7) * 9;
+    const uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+    return result;
+}
+
+double opa_random_double(void) {
+    return (double)(opa_random_u64() >> 11) * (1.0 / 9007199254740992.0); // 53 bits -> [0, 1)
+}
+
+uint64_t opa_span_id_new(void) {
+    uint64_t id;
+    do {
+        id = opa_random_u64();
+    } while (id == 0);
+    return id;
+}
+
+opa_trace_id_t opa_trace_id_new(void) {
+    opa_trace_id_t id;
+    do {
+        id.hi = opa_random_u64();
+        id.lo = opa_random_u64();
+    } while ((id.hi | id.lo) == 0);
+    return id;
+}
+
+// Manual hex conversion: must not call anything that could trigger observers
+static void write_hex(char *buf, uint64_t value) {
+    static const char hex_chars[] = "0123456789abcdef";
+    for (int i = 15; i >= 0; i--) {
+        buf[i] = hex_chars[value & 0xf];
+        value >>= 4;
+    }
+}
+
+void opa_id_hex64(char *buf, uint64_t id) {
+    write_hex(buf, id);
+    buf[OPA_SPAN_ID_HEX_LEN] = '\0';
+}
+
+void opa_id_hex128(char *buf, opa_trace_id_t id) {
+    write_hex(buf, id.hi);
+    write_hex(buf + 16, id.lo);
+    buf[OPA_TRACE_ID_HEX_LEN] = '\0';
+}
+
+char *opa_span_id_str(void) {
+    char *id = malloc(OPA_SPAN_ID_HEX_LEN + 1);
+    if (id) {
+        opa_id_hex64(id, opa_span_id_new());
+    }
+    return id;
+}
+
+char *opa_trace_id_str(void) {
+    char *id = malloc(OPA_TRACE_ID_HEX_LEN + 1);
+    if (id) {
+        opa_id_hex128(id, opa_trace_id_new());
+    }
+    return id;
+}
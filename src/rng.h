@@ -0,0 +1,33 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include "opa.h"
+
+// Per-thread random generator and trace/span identifiers
+// xoshiro256** seeded through splitmix64 from /dev/urandom (clocks, pid and
+// thread as fallback). A fork handler makes the child reseed on its next draw,
+// so FPM workers forked from the same master never share a sequence.
+// Trace ids are 128-bit and span ids 64-bit; both stay integers until they are
+// written out as lowercase hex.
+
+#define OPA_SPAN_ID_HEX_LEN 16
+#define OPA_TRACE_ID_HEX_LEN 32
+
+typedef struct {
+    uint64_t hi;
+    uint64_t lo;
+} opa_trace_id_t;
+
+// Generator functions
+uint64_t opa_random_u64(void);
+double opa_random_double(void); // Uniform in [0, 1)
+
+// Identifier functions
+uint64_t opa_span_id_new(void);       // Never 0
+opa_trace_id_t opa_trace_id_new(void); // Never all zero
+void opa_id_hex64(char *buf, uint64_t id);          // OPA_SPAN_ID_HEX_LEN digits + terminator
+void opa_id_hex128(char *buf, opa_trace_id_t id);   // OPA_TRACE_ID_HEX_LEN digits + terminator
+char *opa_span_id_str(void);  // New span id as malloc'd hex (NULL on allocation failure)
+char *opa_trace_id_str(void); // New trace id as malloc'd hex (NULL on allocation failure)
+
+#endif /* RNG_H */
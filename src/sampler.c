@@ -0,0 +1,342 @@
+#include "sampler.h"
+#include "rng.h"
+#include <sys/mman.h>
+#include <ctype.h>
+
+// Shared token bucket (opa.sampling_target_tps), NULL when throughput targeting is off
+static opa_sampler_bucket_t *bucket = NULL;
+static int bucket_shared = 0;
+
+// Compiled opa.sampling_rules (node 0 is the root), read-only after MINIT
+static opa_route_node_t *route_nodes = NULL;
+static int route_node_count = 0;
+static int route_node_capacity = 0;
+
+// Method of each rule slot (slot 0 = any method)
+static const char *route_methods[OPA_ROUTE_METHODS] = {
+    NULL, "GET", "HEAD", "POST", "PUT", "PATCH", "DELETE", "OPTIONS"
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int route_method_slot(const char *method, size_t len) {
+    for (int i = 1; i < OPA_ROUTE_METHODS; i++) {
+        if (strlen(route_methods[i]) == len && strncasecmp(route_methods[i], method, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int route_node_new(char ch) {
+    if (route_node_count == route_node_capacity) {
+        int capacity = route_node_capacity ? route_node_capacity * 2 : 64;
+        opa_route_node_t *nodes = realloc(route_nodes, (size_t)capacity * sizeof(opa_route_node_t));
+        if (!nodes) {
+            return -1;
+        }
+        route_nodes = nodes;
+        route_node_capacity = capacity;
+    }
+    opa_route_node_t *node = &route_nodes[route_node_count];
+    node->first_child = -1;
+    node->next_sibling = -1;
+    node->ch = ch;
+    for (int i = 0; i < OPA_ROUTE_METHODS; i++) {
+        node->rate[i] = -1.0f;
+    }
+    return route_node_count++;
+}
+
+static int route_child(int parent, char ch) {
+    for (int i = route_nodes[parent].first_child; i >= 0; i = route_nodes[i].next_sibling) {
+        if (route_nodes[i].ch == ch) {
+            return i;
+        }
+    }
+    int child = route_node_new(ch);
+    if (child < 0) {
+        return -1;
+    }
+    // route_nodes may have moved
+    route_nodes[child].next_sibling = route_nodes[parent].first_child;
+    route_nodes[parent].first_child = child;
+    return child;
+}
+
+static int route_insert(const char *pattern, size_t len, int slot, float rate) {
+    int node = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (pattern[i] == '*' && i > 0 && pattern[i - 1] == '*') {
+            continue; // "**" is the same as "*"
+        }
+        if (pattern[i] == '$' && i + 1 != len) {
+            return -1; // Only valid at the end
+        }
+        node = route_child(node, pattern[i]);
+        if (node < 0) {
+            return -1;
+        }
+    }
+    route_nodes[node].rate[slot] = rate;
+    return 0;
+}
+
+// Parse "[METHOD] /pattern rate" rules separated by commas
+static void route_compile(const char *rules) {
+    if (!rules || !*rules || route_node_new(0) < 0) {
+        return;
+    }
+    int count = 0;
+    const char *p = rules;
+    while (*p) {
+        const char *end = strchr(p, ',');
+        if (!end) {
+            end = p + strlen(p);
+        }
+
+        // Split the rule into up to three whitespace-separated fields
+        const char *field[3];
+        size_t field_len[3];
+        int fields = 0;
+        const char *q = p;
+        while (q < end) {
+            while (q < end && isspace((unsigned char)*q)) q++;
+            if (q == end) break;
+            const char *start = q;
+            while (q < end && !isspace((unsigned char)*q)) q++;
+            if (fields < 3) {
+                field[fields] = start;
+                field_len[fields] = (size_t)(q - start);
+            }
+            fields++;
+        }
+
+        if (fields == 2 || fields == 3) {
+            int slot = 0;
+            const char *pattern = field[fields - 2];
+            size_t pattern_len = field_len[fields - 2];
+            char rate_buf[32];
+            size_t rate_len = field_len[fields - 1] < sizeof(rate_buf) - 1 ? field_len[fields - 1] : sizeof(rate_buf) - 1;
+            memcpy(rate_buf, field[fields - 1], rate_len);
+            rate_buf[rate_len] = '\0';
+            char *rate_end = NULL;
+            double rate = strtod(rate_buf, &rate_end);
+
+            if (fields == 3) {
+                slot = route_method_slot(field[0], field_len[0]);
+            }
+            if (slot < 0 || pattern[0] != '/' || rate_end == rate_buf || *rate_end || rate < 0.0 || rate > 1.0 ||
+                route_insert(pattern, pattern_len, slot, (float)rate) < 0) {
+                debug_log("[SAMPLER] Ignoring invalid sampling rule: %.*s", (int)(end - p), p);
+            } else {
+                count++;
+            }
+        } else if (fields > 0) {
+            debug_log("[SAMPLER] Ignoring invalid sampling rule: %.*s", (int)(end - p), p);
+        }
+
+        p = *end ? end + 1 : end;
+    }
+    debug_log("[SAMPLER] Compiled %d sampling rules into %d trie nodes", count, route_node_count);
+}
+
+// Depth-first match; depth counts pattern characters so longer patterns win
+static void route_match(int node, const char *p, const char *end, int slot, int depth, int *best_depth, float *best_rate) {
+    const opa_route_node_t *n = &route_nodes[node];
+    float rate = n->rate[slot] >= 0.0f ? n->rate[slot] : n->rate[0];
+    if (rate >= 0.0f && depth > *best_depth) {
+        *best_depth = depth;
+        *best_rate = rate;
+    }
+    for (int i = n->first_child; i >= 0; i = route_nodes[i].next_sibling) {
+        char ch = route_nodes[i].ch;
+        if (ch == '$') {
+            if (p == end) {
+                route_match(i, p, end, slot, depth + 1, best_depth, best_rate);
+            }
+        } else if (ch == '*') {
+            // Any run of characters within the current path segment
+            const char *q = p;
+            for (;;) {
+                route_match(i, q, end, slot, depth + 1, best_depth, best_rate);
+                if (q == end || *q == '/') {
+                    break;
+                }
+                q++;
+            }
+        } else if (p < end && *p == ch) {
+            route_match(i, p + 1, end, slot, depth + 1, best_depth, best_rate);
+        }
+    }
+}
+
+double opa_sampler_route_rate(const char *method, const char *uri) {
+    if (!route_nodes || !uri) {
+        return -1.0;
+    }
+    int slot = method ? route_method_slot(method, strlen(method)) : 0;
+    if (slot < 0) {
+        slot = 0;
+    }
+    const char *end = strchr(uri, '?');
+    if (!end) {
+        end = uri + strlen(uri);
+    }
+    int best_depth = -1;
+    float best_rate = -1.0f;
+    route_match(0, uri, end, slot, 0, &best_depth, &best_rate);
+    return best_rate;
+}
+
+void opa_sampler_init(void) {
+    route_compile(OPA_G(sampling_rules));
+
+    if (OPA_G(sampling_target_tps) <= 0) {
+        return;
+    }
+
+    // Anonymous shared mapping: inherited by every worker forked after MINIT
+    void *p = mmap(NULL, sizeof(opa_sampler_bucket_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p != MAP_FAILED) {
+        bucket = p;
+        bucket_shared = 1;
+    } else {
+        // Fall back to a per-process budget
+        debug_log("[SAMPLER] mmap failed (errno=%d), token bucket is per process", errno);
+        bucket = calloc(1, sizeof(opa_sampler_bucket_t));
+        if (!bucket) {
+            return;
+        }
+    }
+
+    double tps = OPA_G(sampling_target_tps);
+    uint64_t now = monotonic_ns();
+    bucket->tokens = (uint64_t)((tps < 1.0 ? 1.0 : tps) * OPA_SAMPLER_TOKEN_SCALE);
+    bucket->refill_ns = now;
+    bucket->window_start_ns = now;
+    bucket->rate_ppm = OPA_SAMPLER_RATE_UNKNOWN;
+    debug_log("[SAMPLER] Token bucket ready: target=%.3f traces/s, shared=%d", tps, bucket_shared);
+}
+
+void opa_sampler_shutdown(void) {
+    free(route_nodes);
+    route_nodes = NULL;
+    route_node_count = 0;
+    route_node_capacity = 0;
+
+    if (!bucket) {
+        return;
+    }
+    if (bucket_shared) {
+        munmap(bucket, sizeof(opa_sampler_bucket_t));
+    } else {
+        free(bucket);
+    }
+    bucket = NULL;
+    bucket_shared = 0;
+}
+
+int opa_sampler_active(double route_rate) {
+    if (route_rate >= 0.0) {
+        return route_rate < 1.0;
+    }
+    return bucket != NULL || OPA_G(sampling_rate) < 1.0;
+}
+
+// Credit the time elapsed since the last refill (whoever advances refill_ns adds it)
+static void bucket_refill(uint64_t now, double tps) {
+    uint64_t last = __atomic_load_n(&bucket->refill_ns, __ATOMIC_RELAXED);
+    if (now <= last) {
+        return;
+    }
+    uint64_t add = (uint64_t)((double)(now - last) * tps * ((double)OPA_SAMPLER_TOKEN_SCALE / 1e9));
+    if (add == 0) {
+        return; // Keep accumulating time rather than losing the fraction
+    }
+    if (!__atomic_compare_exchange_n(&bucket->refill_ns, &last, now, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        return; // Another worker credited it
+    }
+    uint64_t cap = (uint64_t)((tps < 1.0 ? 1.0 : tps) * OPA_SAMPLER_TOKEN_SCALE);
+    uint64_t cur = __atomic_load_n(&bucket->tokens, __ATOMIC_RELAXED);
+    uint64_t next;
+    do {
+        next = cur + add;
+        if (next > cap) {
+            next = cap;
+        }
+    } while (!__atomic_compare_exchange_n(&bucket->tokens, &cur, next, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+}
+
+static int bucket_take(void) {
+    uint64_t cur = __atomic_load_n(&bucket->tokens, __ATOMIC_RELAXED);
+    while (cur >= OPA_SAMPLER_TOKEN_SCALE) {
+        if (__atomic_compare_exchange_n(&bucket->tokens, &cur, cur - OPA_SAMPLER_TOKEN_SCALE, 0,
+                __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Roll the measurement window once it is complete, count the decision and
+// return the probability a request is currently sampled with
+static double bucket_account(uint64_t now, int taken) {
+    uint64_t start = __atomic_load_n(&bucket->window_start_ns, __ATOMIC_RELAXED);
+    if (now - start >= OPA_SAMPLER_WINDOW_NS &&
+        __atomic_compare_exchange_n(&bucket->window_start_ns, &start, now, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        uint64_t seen = __atomic_exchange_n(&bucket->window_seen, 0, __ATOMIC_ACQ_REL);
+        uint64_t took = __atomic_exchange_n(&bucket->window_taken, 0, __ATOMIC_ACQ_REL);
+        // A window stretched by an idle gap says nothing about the load now
+        uint64_t ppm = OPA_SAMPLER_RATE_UNKNOWN;
+        if (seen > 0 && now - start < 2 * OPA_SAMPLER_WINDOW_NS) {
+            ppm = took * 1000000 / seen;
+        }
+        __atomic_store_n(&bucket->rate_ppm, ppm, __ATOMIC_RELAXED);
+    }
+
+    uint64_t seen = __atomic_add_fetch(&bucket->window_seen, 1, __ATOMIC_RELAXED);
+    uint64_t took = taken ? __atomic_add_fetch(&bucket->window_taken, 1, __ATOMIC_RELAXED)
+                          : __atomic_load_n(&bucket->window_taken, __ATOMIC_RELAXED);
+    uint64_t ppm = __atomic_load_n(&bucket->rate_ppm, __ATOMIC_RELAXED);
+    if (ppm != OPA_SAMPLER_RATE_UNKNOWN) {
+        return (double)ppm / 1000000.0;
+    }
+    // No complete window yet: what the bucket has let through so far in this one
+    if (took > seen) {
+        took = seen; // Counters read while another worker rolled the window
+    }
+    return (double)took / (double)seen;
+}
+
+int opa_sampler_decide(double route_rate, double *rate) {
+    // A matching opa.sampling_rules entry overrides the global rate and the token bucket
+    if (route_rate >= 0.0) {
+        if (rate) {
+            *rate = route_rate;
+        }
+        return route_rate >= 1.0 || (route_rate > 0.0 && opa_random_double() < route_rate);
+    }
+
+    if (bucket) {
+        double tps = OPA_G(sampling_target_tps);
+        uint64_t now = monotonic_ns();
+        bucket_refill(now, tps);
+        int taken = bucket_take();
+        double effective = bucket_account(now, taken);
+        if (rate) {
+            *rate = effective;
+        }
+        return taken;
+    }
+
+    double sampling_rate = OPA_G(sampling_rate);
+    if (rate) {
+        *rate = sampling_rate < 1.0 ? sampling_rate : 1.0;
+    }
+    return sampling_rate >= 1.0 || opa_random_double() < sampling_rate;
+}
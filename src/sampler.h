@@ -0,0 +1,54 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "opa.h"
+
+// Per-request sampling decisions
+// opa.sampling_rate samples a fixed fraction of requests. opa.sampling_target_tps
+// targets a throughput instead ("N traces per second per host"). Its token bucket
+// lives in an anonymous shared mapping created at MINIT, before FPM forks, so
+// every worker of a pool draws from the same budget with atomic operations.
+// Buckets refill continuously, and bursts are capped at one second of budget.
+
+// opa.sampling_rules overrides the rate per route: "[METHOD] /path/prefix rate",
+// comma separated, e.g. "GET /health 0, /static/* 0, POST /checkout 1". Patterns
+// match path prefixes; '*' matches within one path segment and a trailing '$'
+// anchors the end of the path. The longest matching pattern wins, and a rule
+// for the request method beats a rule for any method. Rate 0 never instruments
+// the route. Rules are compiled into a character trie at MINIT.
+
+// Token bucket amounts are fixed point (1 token = OPA_SAMPLER_TOKEN_SCALE)
+#define OPA_SAMPLER_TOKEN_SCALE 1000000ULL
+// Window over which the effective rate (traces taken / requests seen) is measured
+#define OPA_SAMPLER_WINDOW_NS 1000000000ULL
+// rate_ppm before the first complete window and after an idle gap: the running
+// ratio of the current window is reported instead
+#define OPA_SAMPLER_RATE_UNKNOWN UINT64_MAX
+
+typedef struct {
+    uint64_t tokens;          // Available tokens (fixed point)
+    uint64_t refill_ns;       // Last refill (CLOCK_MONOTONIC, shared by all processes)
+    uint64_t window_start_ns; // Start of the current measurement window
+    uint64_t window_seen;     // Decisions in the current window
+    uint64_t window_taken;    // Sampled decisions in the current window
+    uint64_t rate_ppm;        // Effective rate of the last complete window (parts per million), or OPA_SAMPLER_RATE_UNKNOWN
+} opa_sampler_bucket_t;
+
+// Route methods with their own rule slot (slot 0 = any method)
+#define OPA_ROUTE_METHODS 8
+
+typedef struct {
+    int first_child;               // Node index, -1 if none
+    int next_sibling;              // Node index, -1 if none
+    char ch;                       // Pattern character ('*' = segment wildcard, '$' = end of path)
+    float rate[OPA_ROUTE_METHODS]; // Rate of a rule ending here, per method (-1 = none)
+} opa_route_node_t;
+
+// Sampler functions
+void opa_sampler_init(void); // Compile opa.sampling_rules and map the shared token bucket (MINIT)
+void opa_sampler_shutdown(void);
+double opa_sampler_route_rate(const char *method, const char *uri); // Rate of the best matching rule, -1 if none
+int opa_sampler_active(double route_rate); // Whether requests can be sampled out
+int opa_sampler_decide(double route_rate, double *rate); // 1 = sample; rate receives the probability to report with the trace
+
+#endif /* SAMPLER_H */
@@ -0,0 +1,246 @@
+#include "sender.h"
+#include "transport.h"
+
+// Queued payload: one malloc'd block holding the target and the payload bytes
+typedef struct {
+    size_t len;
+    char *sock_path; // Points into data after the payload
+    char data[];
+} sender_item_t;
+
+// Ring cell (Vyukov bounded queue): seq tells producers and the consumer
+// whether the cell is free for position pos (seq == pos) or holds the
+// item published for pos (seq == pos + 1)
+typedef struct {
+    size_t seq;
+    sender_item_t *item;
+} sender_cell_t;
+
+static sender_cell_t *ring = NULL;
+static size_t ring_mask = 0;
+static size_t enqueue_pos = 0; // Shared by producers (CAS)
+static size_t dequeue_pos = 0; // Owned by the sender thread
+
+static pthread_t sender_thread;
+static int sender_running = 0;
+static int sender_stop = 0;
+static int sender_sleeping = 0;
+static pthread_mutex_t sender_mutex = PTHREAD_MUTEX_INITIALIZER; // Thread start/stop and wakeups only
+static pthread_cond_t sender_cond = PTHREAD_COND_INITIALIZER;
+
+static uint64_t stat_enqueued = 0;
+static uint64_t stat_sent = 0;
+static uint64_t stat_dropped_full = 0;
+static uint64_t stat_send_failed = 0;
+
+static sender_item_t *ring_pop(void) {
+    sender_cell_t *cell = &ring[dequeue_pos & ring_mask];
+    size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    if (seq != dequeue_pos + 1) {
+        return NULL;
+    }
+    sender_item_t *item = cell->item;
+    cell->item = NULL;
+    // Free the cell for the producer one lap ahead
+    __atomic_store_n(&cell->seq, dequeue_pos + ring_mask + 1, __ATOMIC_RELEASE);
+    dequeue_pos++;
+    return item;
+}
+
+static int ring_push(sender_item_t *item) {
+    size_t pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+    sender_cell_t *cell;
+    for (;;) {
+        cell = &ring[pos & ring_mask];
+        size_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1; // Full: the consumer has not released this cell yet
+        } else {
+            pos = __atomic_load_n(&enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+    cell->item = item;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static void *sender_thread_main(void *arg) {
+    (void)arg;
+    // Everything below runs outside PHP: no OPA_G, not even for debug_log()
+    opa_debug_log_detach_thread();
+    for (;;) {
+        sender_item_t *item = ring_pop();
+        if (item) {
+            if (opa_transport_send_payload(item->sock_path, item->data, item->len) == 0) {
+                __atomic_add_fetch(&stat_sent, 1, __ATOMIC_RELAXED);
+            } else {
+                __atomic_add_fetch(&stat_send_failed, 1, __ATOMIC_RELAXED);
+            }
+            free(item);
+            continue;
+        }
+
+        // Ring is empty: exit if asked to, otherwise sleep until a producer signals.
+        // sleeping is published before the ring is re-checked, and producers check it
+        // after publishing, so a wakeup cannot be missed.
+        pthread_mutex_lock(&sender_mutex);
+        if (__atomic_load_n(&sender_stop, __ATOMIC_ACQUIRE)) {
+            pthread_mutex_unlock(&sender_mutex);
+            break;
+        }
+        __atomic_store_n(&sender_sleeping, 1, __ATOMIC_SEQ_CST);
+        sender_cell_t *cell = &ring[dequeue_pos & ring_mask];
+        if (__atomic_load_n(&cell->seq, __ATOMIC_SEQ_CST) != dequeue_pos + 1) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += 1; // Safety net only
+            pthread_cond_timedwait(&sender_cond, &sender_mutex, &ts);
+        }
+        __atomic_store_n(&sender_sleeping, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&sender_mutex);
+    }
+    return NULL;
+}
+
+// Allocate the ring and start the thread (first enqueue in this process)
+static int sender_start(void) {
+    pthread_mutex_lock(&sender_mutex);
+    if (sender_running) {
+        pthread_mutex_unlock(&sender_mutex);
+        return 0;
+    }
+
+    size_t capacity = 16;
+    size_t wanted = OPA_G(async_queue_size) > 0 ? (size_t)OPA_G(async_queue_size) : 1024;
+    while (capacity < wanted && capacity < 65536) {
+        capacity <<= 1;
+    }
+    ring = calloc(capacity, sizeof(sender_cell_t));
+    if (!ring) {
+        pthread_mutex_unlock(&sender_mutex);
+        return -1;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        ring[i].seq = i;
+    }
+    ring_mask = capacity - 1;
+    enqueue_pos = 0;
+    dequeue_pos = 0;
+    sender_stop = 0;
+    sender_sleeping = 0;
+
+    // The sender thread must never run PHP signal handlers
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int rc = pthread_create(&sender_thread, NULL, sender_thread_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (rc != 0) {
+        free(ring);
+        ring = NULL;
+        pthread_mutex_unlock(&sender_mutex);
+        debug_log("[SENDER] Failed to start sender thread: %d", rc);
+        return -1;
+    }
+    __atomic_store_n(&sender_running, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&sender_mutex);
+    debug_log("[SENDER] Started sender thread, queue size=%zu", capacity);
+    return 0;
+}
+
+// Child side of fork(): the sender thread does not exist in the child.
+// Discard the parent's pending payloads (the parent still sends them) and let
+// the next enqueue start a fresh thread.
+static void sender_atfork_child(void) {
+    if (ring) {
+        for (size_t i = 0; i <= ring_mask; i++) {
+            if (ring[i].item) {
+                free(ring[i].item);
+            }
+        }
+        free(ring);
+        ring = NULL;
+    }
+    sender_running = 0;
+    sender_stop = 0;
+    sender_sleeping = 0;
+    pthread_mutex_init(&sender_mutex, NULL);
+    pthread_cond_init(&sender_cond, NULL);
+}
+
+void opa_sender_init(void) {
+    static int atfork_registered = 0;
+    if (!atfork_registered) {
+        pthread_atfork(NULL, NULL, sender_atfork_child);
+        atfork_registered = 1;
+    }
+}
+
+void opa_sender_shutdown(void) {
+    if (!__atomic_load_n(&sender_running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    pthread_mutex_lock(&sender_mutex);
+    __atomic_store_n(&sender_stop, 1, __ATOMIC_RELEASE);
+    pthread_cond_signal(&sender_cond);
+    pthread_mutex_unlock(&sender_mutex);
+
+    // The thread drains whatever is still queued before it exits
+    pthread_join(sender_thread, NULL);
+
+    free(ring);
+    ring = NULL;
+    sender_running = 0;
+}
+
+int opa_sender_enqueue(const char *sock_path, const struct iovec *iov, int iovcnt, size_t len) {
+    if (!__atomic_load_n(&sender_running, __ATOMIC_ACQUIRE) && sender_start() != 0) {
+        return -1;
+    }
+
+    size_t path_len = strlen(sock_path);
+    sender_item_t *item = malloc(sizeof(sender_item_t) + len + path_len + 1);
+    if (!item) {
+        __atomic_add_fetch(&stat_dropped_full, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    item->len = len;
+    size_t off = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(item->data + off, iov[i].iov_base, iov[i].iov_len);
+        off += iov[i].iov_len;
+    }
+    item->sock_path = item->data + len;
+    memcpy(item->sock_path, sock_path, path_len + 1);
+
+    if (ring_push(item) != 0) {
+        free(item);
+        __atomic_add_fetch(&stat_dropped_full, 1, __ATOMIC_RELAXED);
+        debug_log("[SENDER] Queue full, dropped %zu bytes", len);
+        return -1;
+    }
+    __atomic_add_fetch(&stat_enqueued, 1, __ATOMIC_RELAXED);
+
+    // Wake the sender thread only if it is waiting
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&sender_sleeping, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&sender_mutex);
+        pthread_cond_signal(&sender_cond);
+        pthread_mutex_unlock(&sender_mutex);
+    }
+    return 0;
+}
+
+void opa_sender_get_stats(opa_sender_stats_t *stats) {
+    stats->enqueued = __atomic_load_n(&stat_enqueued, __ATOMIC_RELAXED);
+    stats->sent = __atomic_load_n(&stat_sent, __ATOMIC_RELAXED);
+    stats->dropped_full = __atomic_load_n(&stat_dropped_full, __ATOMIC_RELAXED);
+    stats->send_failed = __atomic_load_n(&stat_send_failed, __ATOMIC_RELAXED);
+    stats->queued = stats->enqueued - stats->sent - stats->send_failed;
+}
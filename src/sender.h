@@ -0,0 +1,31 @@
+#ifndef SENDER_H
+#define SENDER_H
+
+#include "opa.h"
+#include <sys/uio.h>
+
+// Background sender (opa.async_send=1)
+// RSHUTDOWN hands finished payloads to a bounded lock-free multi-producer ring;
+// a dedicated thread drains it and owns the agent connection, so a slow agent
+// no longer blocks the worker. When the ring is full the payload is dropped
+// and counted.
+// The thread never reads OPA_G (invalid on a non-PHP thread under ZTS, racy
+// under NTS): the transport, spool and resolver settings it reaches are copied
+// at MINIT, and debug_log() follows opa.debug_log as of the last RINIT.
+
+// Counters reported by opa_transport_stats()
+typedef struct {
+    uint64_t enqueued;     // Payloads accepted into the ring
+    uint64_t sent;         // Payloads written to the agent by the sender thread
+    uint64_t dropped_full; // Payloads dropped because the ring was full
+    uint64_t send_failed;  // Payloads the sender thread could not deliver
+    uint64_t queued;       // Payloads currently waiting in the ring
+} opa_sender_stats_t;
+
+// Sender functions
+void opa_sender_init(void); // Register fork handler (MINIT)
+void opa_sender_shutdown(void); // Drain the ring and join the thread (MSHUTDOWN)
+int opa_sender_enqueue(const char *sock_path, const struct iovec *iov, int iovcnt, size_t len); // Copies the payload; -1 if dropped
+void opa_sender_get_stats(opa_sender_stats_t *stats);
+
+#endif /* SENDER_H */
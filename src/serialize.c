@@ -1,4 +1,5 @@
 #include "serialize.h"
+#include "symbol.h"
 
 // Helper: Escape JSON string
 void json_escape_string(smart_string *buf, const char *str, size_t len) {
@@ -27,78 +28,85 @@ void json_escape_string(smart_string *buf, const char *str, size_t len) {
     }
 }
 
+// Append a symbol's cached escaped form
+static void append_symbol_json(smart_string *buf, uint32_t symbol) {
+    size_t len;
+    const char *json = opa_symbol_json(symbol, &len);
+    smart_string_appendl(buf, json, len);
+}
+
 // Serialize call node to JSON
 void serialize_call_node_json(smart_string *buf, call_node_t *call) {
-    if (!call || call->magic != OPA_CALL_NODE_MAGIC) return;
-    
-    smart_string_appends(buf, "{");
+    extern opa_collector_t *global_collector;
+    if (!call || !global_collector) return;
     
-    if (call->call_id) {
-        smart_string_appends(buf, "\"call_id\":\"");
-        smart_string_appends(buf, call->call_id);
-        smart_string_appends(buf, "\"");
-    }
+    char id[OPA_CALL_ID_LEN + 1];
+    opa_call_format_id(global_collector, call->index, id);
+    smart_string_appends(buf, "{\"call_id\":\"");
+    smart_string_appends(buf, id);
+    smart_string_appends(buf, "\"");
     
     if (call->function_name) {
         smart_string_appends(buf, ",\"function\":\"");
-        json_escape_string(buf, call->function_name, strlen(call->function_name));
+        append_symbol_json(buf, call->function_name);
         smart_string_appends(buf, "\"");
     }
     
     if (call->class_name) {
         smart_string_appends(buf, ",\"class\":\"");
-        json_escape_string(buf, call->class_name, strlen(call->class_name));
+        append_symbol_json(buf, call->class_name);
         smart_string_appends(buf, "\"");
     }
     
     if (call->file) {
         smart_string_appends(buf, ",\"file\":\"");
-        json_escape_string(buf, call->file, strlen(call->file));
+        append_symbol_json(buf, call->file);
         smart_string_appends(buf, "\"");
     }
     
     if (call->line > 0) {
         char line_str[32];
-        snprintf(line_str, sizeof(line_str), "%d", call->line);
+        snprintf(line_str, sizeof(line_str), "%u", call->line);
         smart_string_appends(buf, ",\"line\":");
         smart_string_appends(buf, line_str);
     }
     
+    // Counters are deltas once the call has exited
+    int ended = call->end_ns > 0;
+    
     // Duration in milliseconds
-    double duration_ms = (call->end_time - call->start_time) * 1000.0;
+    double duration_ms = ended ? (double)(call->end_ns - call->start_ns) / 1000000.0 : 0.0;
     char duration_str[64];
     snprintf(duration_str, sizeof(duration_str), "%.3f", duration_ms);
     smart_string_appends(buf, ",\"duration_ms\":");
     smart_string_appends(buf, duration_str);
     
     // CPU time in milliseconds
-    double cpu_ms = (call->end_cpu_time - call->start_cpu_time) * 1000.0;
+    double cpu_ms = ended ? (double)(call->end_cpu_ns - call->start_cpu_ns) / 1000000.0 : 0.0;
     char cpu_str[64];
     snprintf(cpu_str, sizeof(cpu_str), "%.3f", cpu_ms);
     smart_string_appends(buf, ",\"cpu_ms\":");
     smart_string_appends(buf, cpu_str);
     
     // Memory delta
-    long memory_delta = (long)call->end_memory - (long)call->start_memory;
     char mem_str[64];
-    snprintf(mem_str, sizeof(mem_str), "%ld", memory_delta);
+    snprintf(mem_str, sizeof(mem_str), "%lld", ended ? (long long)call->memory : 0LL);
     smart_string_appends(buf, ",\"memory_delta\":");
     smart_string_appends(buf, mem_str);
     
     // Network bytes
-    long net_sent = (long)call->end_bytes_sent - (long)call->start_bytes_sent;
-    long net_received = (long)call->end_bytes_received - (long)call->start_bytes_received;
     char net_sent_str[64], net_recv_str[64];
-    snprintf(net_sent_str, sizeof(net_sent_str), "%ld", net_sent);
-    snprintf(net_recv_str, sizeof(net_recv_str), "%ld", net_received);
+    snprintf(net_sent_str, sizeof(net_sent_str), "%lld", ended ? (long long)call->bytes_sent : 0LL);
+    snprintf(net_recv_str, sizeof(net_recv_str), "%lld", ended ? (long long)call->bytes_received : 0LL);
     smart_string_appends(buf, ",\"network_bytes_sent\":");
     smart_string_appends(buf, net_sent_str);
     smart_string_appends(buf, ",\"network_bytes_received\":");
     smart_string_appends(buf, net_recv_str);
     
-    if (call->parent_id) {
+    if (call->parent != OPA_CALL_NONE) {
+        opa_call_format_id(global_collector, call->parent, id);
         smart_string_appends(buf, ",\"parent_id\":\"");
-        smart_string_appends(buf, call->parent_id);
+        smart_string_appends(buf, id);
         smart_string_appends(buf, "\"");
     }
     
@@ -112,28 +120,38 @@ void serialize_call_node_json(smart_string *buf, call_node_t *call) {
     smart_string_appends(buf, ",\"function_type\":");
     smart_string_appends(buf, type_str);
     
-    // Serialize SQL queries
-    if (call->sql_queries && Z_TYPE_P(call->sql_queries) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(call->sql_queries)) > 0) {
-        smart_string_appends(buf, ",\"sql_queries\":");
-        serialize_zval_json(buf, call->sql_queries);
+    opa_call_io_t *io = opa_call_io(global_collector, call);
+    if (io && io->truncated_calls > 0) {
+        // Callees past the call budget, summarized instead of recorded
+        char truncated_str[96];
+        snprintf(truncated_str, sizeof(truncated_str), ",\"truncated_calls\":%u,\"truncated_ms\":%.3f",
+            io->truncated_calls, (double)io->truncated_ns / 1000000.0);
+        smart_string_appends(buf, truncated_str);
     }
-    
-    // Serialize HTTP requests (cURL)
-    if (call->http_requests && Z_TYPE_P(call->http_requests) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(call->http_requests)) > 0) {
-        smart_string_appends(buf, ",\"http_requests\":");
-        serialize_zval_json(buf, call->http_requests);
-    }
-    
-    // Serialize cache operations (APCu, Symfony Cache)
-    if (call->cache_operations && Z_TYPE_P(call->cache_operations) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(call->cache_operations)) > 0) {
-        smart_string_appends(buf, ",\"cache_operations\":");
-        serialize_zval_json(buf, call->cache_operations);
-    }
-    
-    // Serialize Redis operations
-    if (call->redis_operations && Z_TYPE_P(call->redis_operations) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(call->redis_operations)) > 0) {
-        smart_string_appends(buf, ",\"redis_operations\":");
-        serialize_zval_json(buf, call->redis_operations);
+    if (io) {
+        // Serialize SQL queries
+        if (io->sql_queries && Z_TYPE_P(io->sql_queries) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(io->sql_queries)) > 0) {
+            smart_string_appends(buf, ",\"sql_queries\":");
+            serialize_zval_json(buf, io->sql_queries);
+        }
+        
+        // Serialize HTTP requests (cURL)
+        if (io->http_requests && Z_TYPE_P(io->http_requests) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(io->http_requests)) > 0) {
+            smart_string_appends(buf, ",\"http_requests\":");
+            serialize_zval_json(buf, io->http_requests);
+        }
+        
+        // Serialize cache operations (APCu, Symfony Cache)
+        if (io->cache_operations && Z_TYPE_P(io->cache_operations) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(io->cache_operations)) > 0) {
+            smart_string_appends(buf, ",\"cache_operations\":");
+            serialize_zval_json(buf, io->cache_operations);
+        }
+        
+        // Serialize Redis operations
+        if (io->redis_operations && Z_TYPE_P(io->redis_operations) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(io->redis_operations)) > 0) {
+            smart_string_appends(buf, ",\"redis_operations\":");
+            serialize_zval_json(buf, io->redis_operations);
+        }
     }
     
     // Serialize children - will be built recursively in serialize_call_node_json_recursive
@@ -599,75 +617,23 @@ void serialize_call_stack_from_root(smart_string *buf) {
         return;
     }
     
-    // Count total calls for debugging
-    int total_calls = 0;
-    int completed_calls = 0;
-    int root_calls = 0;
-    call_node_t *debug_call = global_collector->calls;
-    while (debug_call) {
-        total_calls++;
-        if (debug_call->magic == OPA_CALL_NODE_MAGIC && debug_call->end_time > 0.0) {
-            completed_calls++;
-            if (!debug_call->parent_id) {
-                root_calls++;
-            }
-        }
-        debug_call = debug_call->next;
+    // Aggregate mode keeps no call tree (see aggregate.h)
+    if (global_collector->aggregate) {
+        smart_string_appends(buf, "]");
+        return;
     }
     
-    // Find root calls (no parent_id) and serialize recursively
-    // Only serialize calls that have completed (end_time > 0)
-    call_node_t *call = global_collector->calls;
+    // Records are in call order and children always follow their parent.
+    // Serialize the completed top-level calls with their subtrees
     int first = 1;
-    int found_any = 0;
-    
-    while (call) {
-        // Validate call structure
-        if (call->magic == OPA_CALL_NODE_MAGIC && call->end_time > 0.0 && !call->parent_id) {
+    for (uint32_t i = 0; i < (uint32_t)global_collector->call_count; i++) {
+        call_node_t *call = OPA_CALL_AT(global_collector, i);
+        if (call->end_ns > 0 && call->parent == OPA_CALL_NONE) {
             if (!first) {
                 smart_string_appends(buf, ",");
             }
             serialize_call_node_json_recursive(buf, call);
             first = 0;
-            found_any = 1;
-        }
-        call = call->next;
-    }
-    
-    // If no root calls found, serialize all completed calls as a flat list
-    // This can happen if all calls have parents (e.g., all are nested)
-    if (!found_any) {
-        call = global_collector->calls;
-        first = 1;
-        while (call) {
-            if (call->magic == OPA_CALL_NODE_MAGIC && call->end_time > 0.0) {
-                if (!first) {
-                    smart_string_appends(buf, ",");
-                }
-                serialize_call_node_json(buf, call);
-                // Serialize children recursively
-                smart_string_appends(buf, ",\"children\":[");
-                call_node_t *child = global_collector->calls;
-                int first_child = 1;
-                while (child) {
-                    if (child->magic == OPA_CALL_NODE_MAGIC && 
-                        child->end_time > 0.0 &&
-                        child->parent_id && 
-                        call->call_id &&
-                        strcmp(child->parent_id, call->call_id) == 0) {
-                        if (!first_child) {
-                            smart_string_appends(buf, ",");
-                        }
-                        serialize_call_node_json(buf, child);
-                        smart_string_appends(buf, ",\"children\":[]");
-                        first_child = 0;
-                    }
-                    child = child->next;
-                }
-                smart_string_appends(buf, "]");
-                first = 0;
-            }
-            call = call->next;
         }
     }
     
@@ -676,29 +642,23 @@ void serialize_call_stack_from_root(smart_string *buf) {
 
 // Serialize call node recursively with children
 void serialize_call_node_json_recursive(smart_string *buf, call_node_t *call) {
-    if (!call || call->magic != OPA_CALL_NODE_MAGIC) return;
+    extern opa_collector_t *global_collector;
+    if (!call || !global_collector) return;
     
     serialize_call_node_json(buf, call);
     
-    // Serialize children if any - find children calls by parent_id
-    extern opa_collector_t *global_collector;
+    // Children are the later records whose parent is this call
     smart_string_appends(buf, ",\"children\":[");
-    call_node_t *child = global_collector ? global_collector->calls : NULL;
     int first_child = 1;
-    while (child) {
-        // Validate child and check if it's completed and belongs to this parent
-        if (child->magic == OPA_CALL_NODE_MAGIC && 
-            child->end_time > 0.0 &&
-            child->parent_id && 
-            call->call_id &&
-            strcmp(child->parent_id, call->call_id) == 0) {
+    for (uint32_t i = call->index + 1; i < (uint32_t)global_collector->call_count; i++) {
+        call_node_t *child = OPA_CALL_AT(global_collector, i);
+        if (child->end_ns > 0 && child->parent == call->index) {
             if (!first_child) {
                 smart_string_appends(buf, ",");
             }
             serialize_call_node_json_recursive(buf, child);
             first_child = 0;
         }
-        child = child->next;
     }
     smart_string_appends(buf, "]");
 }
@@ -713,44 +673,21 @@ void serialize_all_sql_queries(smart_string *buf) {
         return;
     }
     
-    call_node_t *call = global_collector->calls;
+    // Only calls with I/O records have queries: scan the side table
     int first = 1;
-    int max_iterations = 10000; // Safety limit
-    int iterations = 0;
-    
-    while (call && iterations < max_iterations) {
-        iterations++;
-        
-        // Validate call structure before accessing any fields
-        if (call->magic != OPA_CALL_NODE_MAGIC) {
-            // Invalid magic - skip this node
-            call = call->next;
-            continue;
-        }
-        
-        // Save next pointer before accessing sql_queries
-        call_node_t *next = call->next;
-        
-        // Validate sql_queries pointer and type
-        if (call->sql_queries && 
-            Z_TYPE_P(call->sql_queries) == IS_ARRAY) {
-            HashTable *ht = Z_ARRVAL_P(call->sql_queries);
-            if (ht) {
-                zval *val;
-                ZEND_HASH_FOREACH_VAL(ht, val) {
-                    if (!first) {
-                        smart_string_appends(buf, ",");
-                    }
-                    serialize_zval_json(buf, val);
-                    first = 0;
-                } ZEND_HASH_FOREACH_END();
-            }
+    for (uint32_t i = 0; i < global_collector->call_io_count; i++) {
+        zval *queries = global_collector->call_io[i].sql_queries;
+        if (queries && Z_TYPE_P(queries) == IS_ARRAY) {
+            zval *val;
+            ZEND_HASH_FOREACH_VAL(Z_ARRVAL_P(queries), val) {
+                if (!first) {
+                    smart_string_appends(buf, ",");
+                }
+                serialize_zval_json(buf, val);
+                first = 0;
+            } ZEND_HASH_FOREACH_END();
         }
-        
-        // Use saved next pointer
-        call = next;
     }
     
     smart_string_appends(buf, "]");
 }
-
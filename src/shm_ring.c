@@ -0,0 +1,230 @@
+#include "shm_ring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+typedef struct {
+    uint64_t seq;   // Absolute position + 1 once committed (| OPA_SHM_SEQ_RESERVED while copying)
+    uint32_t len;
+    uint32_t flags;
+} shm_record_t;
+
+#define SHM_ALIGN(n) (((n) + 15) & ~(uint64_t)15)
+
+static int64_t shm_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Wait (up to ~100ms) for another process to finish creating the ring
+static int shm_wait_ready(int fd, opa_shm_header_t **hdr_out, size_t *map_size_out) {
+    for (int i = 0; i < 100; i++) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size > OPA_SHM_HEADER_SIZE) {
+            void *p = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                return -1;
+            }
+            opa_shm_header_t *hdr = p;
+            if (memcmp(hdr->magic, OPA_SHM_MAGIC, sizeof(hdr->magic)) == 0) {
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                *hdr_out = hdr;
+                *map_size_out = (size_t)st.st_size;
+                return 0;
+            }
+            munmap(p, (size_t)st.st_size);
+        }
+        usleep(1000);
+    }
+    return -1;
+}
+
+opa_shm_ring_t *opa_shm_ring_open(const char *name, size_t capacity, int create) {
+    size_t cap = 4096;
+    while (cap < capacity && cap < ((size_t)1 << 30)) {
+        cap <<= 1;
+    }
+
+    int created = 0;
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0 && errno == ENOENT && create) {
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0660);
+        if (fd >= 0) {
+            created = 1;
+        } else if (errno == EEXIST) {
+            fd = shm_open(name, O_RDWR, 0);
+        }
+    }
+    if (fd < 0) {
+        return NULL;
+    }
+
+    opa_shm_header_t *hdr = NULL;
+    size_t map_size = 0;
+    if (created) {
+        map_size = OPA_SHM_HEADER_SIZE + cap;
+        if (ftruncate(fd, (off_t)map_size) != 0) {
+            close(fd);
+            shm_unlink(name);
+            return NULL;
+        }
+        void *p = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            shm_unlink(name);
+            return NULL;
+        }
+        // ftruncate zero-fills: positions start at 0, no record is committed
+        hdr = p;
+        hdr->version = OPA_SHM_VERSION;
+        hdr->header_size = OPA_SHM_HEADER_SIZE;
+        hdr->capacity = cap;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(hdr->magic, OPA_SHM_MAGIC, sizeof(hdr->magic));
+    } else if (shm_wait_ready(fd, &hdr, &map_size) != 0) {
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+
+    // Validate a ring created by someone else
+    if (hdr->version != OPA_SHM_VERSION || hdr->header_size != OPA_SHM_HEADER_SIZE ||
+        hdr->capacity == 0 || (hdr->capacity & (hdr->capacity - 1)) != 0 ||
+        OPA_SHM_HEADER_SIZE + hdr->capacity > map_size) {
+        munmap(hdr, map_size);
+        return NULL;
+    }
+
+    opa_shm_ring_t *ring = malloc(sizeof(opa_shm_ring_t));
+    if (!ring) {
+        munmap(hdr, map_size);
+        return NULL;
+    }
+    ring->hdr = hdr;
+    ring->data = (unsigned char *)hdr + OPA_SHM_HEADER_SIZE;
+    ring->map_size = map_size;
+    ring->pending_next = 0;
+    ring->stall_pos = UINT64_MAX;
+    ring->stall_since_ms = 0;
+    return ring;
+}
+
+void opa_shm_ring_close(opa_shm_ring_t *ring) {
+    if (!ring) {
+        return;
+    }
+    munmap(ring->hdr, ring->map_size);
+    free(ring);
+}
+
+int opa_shm_ring_write(opa_shm_ring_t *ring, const struct iovec *iov, int iovcnt, size_t len) {
+    opa_shm_header_t *hdr = ring->hdr;
+    uint64_t cap = hdr->capacity;
+    uint64_t need = SHM_ALIGN(OPA_SHM_RECORD_HEADER_SIZE + (uint64_t)len);
+    if (len > UINT32_MAX || need > cap / 2) {
+        __atomic_add_fetch(&hdr->dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    // Reserve need bytes (plus tail padding if the record would wrap)
+    uint64_t pos = __atomic_load_n(&hdr->reserve_pos, __ATOMIC_RELAXED);
+    uint64_t pad;
+    for (;;) {
+        uint64_t rd = __atomic_load_n(&hdr->read_pos, __ATOMIC_ACQUIRE);
+        uint64_t off = pos & (cap - 1);
+        pad = (off + need > cap) ? cap - off : 0;
+        if (pos + pad + need - rd > cap) {
+            __atomic_add_fetch(&hdr->dropped, 1, __ATOMIC_RELAXED);
+            return -1;
+        }
+        if (__atomic_compare_exchange_n(&hdr->reserve_pos, &pos, pos + pad + need, 1,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (pad) {
+        shm_record_t *padrec = (shm_record_t *)(ring->data + (pos & (cap - 1)));
+        padrec->len = (uint32_t)(pad - OPA_SHM_RECORD_HEADER_SIZE);
+        padrec->flags = OPA_SHM_RECORD_PAD;
+        __atomic_store_n(&padrec->seq, pos + 1, __ATOMIC_RELEASE);
+        pos += pad;
+    }
+
+    // Publish the length first so the consumer can skip the record if we die while copying
+    shm_record_t *rec = (shm_record_t *)(ring->data + (pos & (cap - 1)));
+    rec->len = (uint32_t)len;
+    rec->flags = 0;
+    uint64_t reserved = (pos + 1) | OPA_SHM_SEQ_RESERVED;
+    __atomic_store_n(&rec->seq, reserved, __ATOMIC_RELEASE);
+    unsigned char *dst = (unsigned char *)rec + OPA_SHM_RECORD_HEADER_SIZE;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+    // Fails if the consumer gave up on us (or the space was reused since)
+    if (!__atomic_compare_exchange_n(&rec->seq, &reserved, pos + 1, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        __atomic_add_fetch(&hdr->dropped, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    __atomic_add_fetch(&hdr->written, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int opa_shm_ring_read(opa_shm_ring_t *ring, const void **data, size_t *len) {
+    opa_shm_header_t *hdr = ring->hdr;
+    uint64_t cap = hdr->capacity;
+    for (;;) {
+        uint64_t rd = __atomic_load_n(&hdr->read_pos, __ATOMIC_RELAXED);
+        shm_record_t *rec = (shm_record_t *)(ring->data + (rd & (cap - 1)));
+        uint64_t seq = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+        if (seq != rd + 1) {
+            uint64_t reserved = __atomic_load_n(&hdr->reserve_pos, __ATOMIC_ACQUIRE);
+            if (reserved == rd) {
+                return 0; // Empty
+            }
+            // Reserved but not committed: wait, then give up on the producer
+            int64_t now = shm_now_ms();
+            if (ring->stall_pos != rd) {
+                ring->stall_pos = rd;
+                ring->stall_since_ms = now;
+                return 0;
+            }
+            if (now - ring->stall_since_ms < OPA_SHM_STALL_MS) {
+                return 0;
+            }
+            uint64_t next = reserved;
+            if (seq == ((rd + 1) | OPA_SHM_SEQ_RESERVED)) {
+                // Tombstone first: if the producer commits meanwhile, read the record instead
+                if (!__atomic_compare_exchange_n(&rec->seq, &seq, seq | OPA_SHM_SEQ_ABANDONED, 0,
+                                                 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                    continue;
+                }
+                next = rd + SHM_ALIGN(OPA_SHM_RECORD_HEADER_SIZE + (uint64_t)rec->len);
+            }
+            __atomic_add_fetch(&hdr->abandoned, 1, __ATOMIC_RELAXED);
+            __atomic_store_n(&hdr->read_pos, next, __ATOMIC_RELEASE);
+            continue;
+        }
+        uint64_t next = rd + SHM_ALIGN(OPA_SHM_RECORD_HEADER_SIZE + (uint64_t)rec->len);
+        if (rec->flags & OPA_SHM_RECORD_PAD) {
+            __atomic_store_n(&hdr->read_pos, next, __ATOMIC_RELEASE);
+            continue;
+        }
+        *data = (unsigned char *)rec + OPA_SHM_RECORD_HEADER_SIZE;
+        *len = rec->len;
+        ring->pending_next = next;
+        return 1;
+    }
+}
+
+void opa_shm_ring_release(opa_shm_ring_t *ring) {
+    __atomic_store_n(&ring->hdr->read_pos, ring->pending_next, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,79 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+// Shared-memory ring transport (opa.socket_path=shm:/name)
+// Deliberately free of PHP headers so the agent side (and scripts/dev/opa_shm_consume.c)
+// can build against it directly.
+//
+// Layout of the shared object (/dev/shm/<name>):
+//   opa_shm_header_t (OPA_SHM_HEADER_SIZE bytes), then capacity bytes of record data.
+// Records are 16-byte aligned and never wrap; a padding record fills the tail
+// of the buffer when the next record does not fit before the end.
+//   uint64_t seq   - absolute ring position of the record + 1, stored last (commit);
+//                    OPA_SHM_SEQ_RESERVED | (position + 1) while the payload is copied,
+//                    | OPA_SHM_SEQ_ABANDONED once the consumer has skipped it
+//   uint32_t len   - payload length
+//   uint32_t flags - OPA_SHM_RECORD_PAD for padding records
+//   payload        - same bytes as the payload of an "OPAF" socket frame
+// Producers reserve space with a CAS on reserve_pos; the single consumer
+// advances read_pos. A record is ready when its seq equals read_pos + 1.
+//
+// A producer killed between reserving and committing (e.g. SIGKILL from
+// request_terminate_timeout) would block the consumer forever. The producer
+// publishes len with the reserved marker right after its CAS; if the record at
+// read_pos is still uncommitted after OPA_SHM_STALL_MS, the consumer skips it
+// (by len, or up to reserve_pos if not even the marker was written) and counts
+// it in "abandoned". Both sides CAS seq from the reserved marker: the consumer
+// to the abandoned marker, the producer to the committed value, so exactly one
+// wins and a late producer can never commit into space the consumer reclaimed.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#define OPA_SHM_MAGIC "OPASHM1"
+#define OPA_SHM_VERSION 1
+#define OPA_SHM_HEADER_SIZE 256
+#define OPA_SHM_RECORD_HEADER_SIZE 16
+#define OPA_SHM_RECORD_PAD 1
+#define OPA_SHM_DEFAULT_CAPACITY (8 * 1024 * 1024)
+#define OPA_SHM_SEQ_RESERVED (1ULL << 63)
+#define OPA_SHM_SEQ_ABANDONED (1ULL << 62)
+// A producer still alive but stalled this long loses its record. Its late
+// payload copy can still land in reclaimed space: only a problem if the ring
+// has wrapped a full capacity past it meanwhile, and the newer record at that
+// offset then fails its own commit instead of being read corrupt.
+#define OPA_SHM_STALL_MS 2000
+
+typedef struct {
+    char magic[8];        // OPA_SHM_MAGIC, written last by the creator
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t capacity;    // Data bytes, power of two
+    char pad0[40];
+    uint64_t reserve_pos; // Producers (own cache line)
+    char pad1[56];
+    uint64_t read_pos;    // Consumer (own cache line)
+    char pad2[56];
+    uint64_t dropped;     // Records rejected because the ring was full
+    uint64_t written;     // Records committed
+    uint64_t abandoned;   // Stalled reservations skipped by the consumer
+} opa_shm_header_t;
+
+typedef struct {
+    opa_shm_header_t *hdr;
+    unsigned char *data;
+    size_t map_size;
+    uint64_t pending_next; // Consumer: read_pos after the record returned by opa_shm_ring_read()
+    uint64_t stall_pos;    // Consumer: read_pos last seen waiting on an uncommitted record
+    int64_t stall_since_ms; // Consumer: when stall_pos was first seen (monotonic)
+} opa_shm_ring_t;
+
+// Shared-memory ring functions
+opa_shm_ring_t *opa_shm_ring_open(const char *name, size_t capacity, int create); // name as for shm_open ("/opa")
+void opa_shm_ring_close(opa_shm_ring_t *ring);
+int opa_shm_ring_write(opa_shm_ring_t *ring, const struct iovec *iov, int iovcnt, size_t len); // 0, or -1 if full/too large
+int opa_shm_ring_read(opa_shm_ring_t *ring, const void **data, size_t *len); // 1 = record available, 0 = empty
+void opa_shm_ring_release(opa_shm_ring_t *ring); // Consume the record returned by opa_shm_ring_read()
+
+#endif /* SHM_RING_H */
@@ -1,5 +1,7 @@
 #include "span.h"
 #include "serialize.h"
+#include "symbol.h"
+#include "aggregate.h"
 #include "opa.h"
 #include <stdlib.h>
 #include <string.h>
@@ -85,9 +87,17 @@ static void json_escape_string_malloc(json_buffer_t *buf, const char *str, size_
     }
 }
 
+// Append a symbol's cached escaped form
+static void json_buffer_append_symbol(json_buffer_t *buf, uint32_t symbol) {
+    size_t len;
+    const char *json = opa_symbol_json(symbol, &len);
+    json_buffer_append(buf, json, len);
+}
+
 // Forward declarations
 static void serialize_call_node_json_malloc(json_buffer_t *buf, call_node_t *call);
 static void serialize_call_stack_from_root_malloc(json_buffer_t *buf);
+static void serialize_call_graph_malloc(json_buffer_t *buf);
 
 // Aggregate network bytes from all call nodes in the collector
 static void aggregate_network_bytes_from_calls(size_t *total_sent, size_t *total_received) {
@@ -98,19 +108,21 @@ static void aggregate_network_bytes_from_calls(size_t *total_sent, size_t *total
         return;
     }
     
-    call_node_t *call = global_collector->calls;
-    while (call) {
-        if (call->magic == OPA_CALL_NODE_MAGIC && call->start_time > 0.0) {
-            long net_sent = (long)call->end_bytes_sent - (long)call->start_bytes_sent;
-            long net_received = (long)call->end_bytes_received - (long)call->start_bytes_received;
-            if (net_sent > 0) {
-                *total_sent += (size_t)net_sent;
+    if (global_collector->aggregate) {
+        opa_aggregate_net(total_sent, total_received);
+        return;
+    }
+    
+    for (uint32_t i = 0; i < (uint32_t)global_collector->call_count; i++) {
+        call_node_t *call = OPA_CALL_AT(global_collector, i);
+        if (call->end_ns > 0) {
+            if (call->bytes_sent > 0) {
+                *total_sent += (size_t)call->bytes_sent;
             }
-            if (net_received > 0) {
-                *total_received += (size_t)net_received;
+            if (call->bytes_received > 0) {
+                *total_received += (size_t)call->bytes_received;
             }
         }
-        call = call->next;
     }
 }
 
@@ -128,14 +140,14 @@ static int aggregate_sql_queries_from_calls(json_buffer_t *buf) {
     int first = 1;
     
     // First, add SQL queries from call nodes
-    call_node_t *call = global_collector->calls;
-    while (call) {
-        if (call->magic == OPA_CALL_NODE_MAGIC && 
-            call->sql_queries && 
-            Z_TYPE_P(call->sql_queries) == IS_ARRAY &&
-            zend_hash_num_elements(Z_ARRVAL_P(call->sql_queries)) > 0) {
+    // Only calls with I/O records have SQL queries: scan the side table
+    for (uint32_t i = 0; i < global_collector->call_io_count; i++) {
+        zval *records = global_collector->call_io[i].sql_queries;
+        if (records && 
+            Z_TYPE_P(records) == IS_ARRAY &&
+            zend_hash_num_elements(Z_ARRVAL_P(records)) > 0) {
             
-            HashTable *ht = Z_ARRVAL_P(call->sql_queries);
+            HashTable *ht = Z_ARRVAL_P(records);
             zval *val;
             ZEND_HASH_FOREACH_VAL(ht, val) {
                 if (!first) {
@@ -154,7 +166,6 @@ static int aggregate_sql_queries_from_calls(json_buffer_t *buf) {
                 first = 0;
             } ZEND_HASH_FOREACH_END();
         }
-        call = call->next;
     }
     
     // Then, add SQL queries from global array (captured outside of call stack)
@@ -203,14 +214,14 @@ static int aggregate_cache_operations_from_calls(json_buffer_t *buf) {
     int first = 1;
     
     // Add cache operations from call nodes
-    call_node_t *call = global_collector->calls;
-    while (call) {
-        if (call->magic == OPA_CALL_NODE_MAGIC && 
-            call->cache_operations && 
-            Z_TYPE_P(call->cache_operations) == IS_ARRAY &&
-            zend_hash_num_elements(Z_ARRVAL_P(call->cache_operations)) > 0) {
+    // Only calls with I/O records have cache operations: scan the side table
+    for (uint32_t i = 0; i < global_collector->call_io_count; i++) {
+        zval *records = global_collector->call_io[i].cache_operations;
+        if (records && 
+            Z_TYPE_P(records) == IS_ARRAY &&
+            zend_hash_num_elements(Z_ARRVAL_P(records)) > 0) {
             
-            HashTable *ht = Z_ARRVAL_P(call->cache_operations);
+            HashTable *ht = Z_ARRVAL_P(records);
             zval *val;
             ZEND_HASH_FOREACH_VAL(ht, val) {
                 if (!first) {
@@ -228,7 +239,6 @@ static int aggregate_cache_operations_from_calls(json_buffer_t *buf) {
                 first = 0;
             } ZEND_HASH_FOREACH_END();
         }
-        call = call->next;
     }
     
     json_buffer_append_str(buf, "]");
@@ -249,14 +259,14 @@ static int aggregate_http_requests_from_calls(json_buffer_t *buf) {
     int first = 1;
     
     // Add HTTP requests from call nodes
-    call_node_t *call = global_collector->calls;
-    while (call) {
-        if (call->magic == OPA_CALL_NODE_MAGIC && 
-            call->http_requests && 
-            Z_TYPE_P(call->http_requests) == IS_ARRAY &&
-            zend_hash_num_elements(Z_ARRVAL_P(call->http_requests)) > 0) {
+    // Only calls with I/O records have HTTP requests: scan the side table
+    for (uint32_t i = 0; i < global_collector->call_io_count; i++) {
+        zval *records = global_collector->call_io[i].http_requests;
+        if (records && 
+            Z_TYPE_P(records) == IS_ARRAY &&
+            zend_hash_num_elements(Z_ARRVAL_P(records)) > 0) {
             
-            HashTable *ht = Z_ARRVAL_P(call->http_requests);
+            HashTable *ht = Z_ARRVAL_P(records);
             zval *val;
             ZEND_HASH_FOREACH_VAL(ht, val) {
                 if (!first) {
@@ -274,7 +284,6 @@ static int aggregate_http_requests_from_calls(json_buffer_t *buf) {
                 first = 0;
             } ZEND_HASH_FOREACH_END();
         }
-        call = call->next;
     }
     
     json_buffer_append_str(buf, "]");
@@ -295,14 +304,14 @@ static int aggregate_redis_operations_from_calls(json_buffer_t *buf) {
     int first = 1;
     
     // Add Redis operations from call nodes
-    call_node_t *call = global_collector->calls;
-    while (call) {
-        if (call->magic == OPA_CALL_NODE_MAGIC && 
-            call->redis_operations && 
-            Z_TYPE_P(call->redis_operations) == IS_ARRAY &&
-            zend_hash_num_elements(Z_ARRVAL_P(call->redis_operations)) > 0) {
+    // Only calls with I/O records have Redis operations: scan the side table
+    for (uint32_t i = 0; i < global_collector->call_io_count; i++) {
+        zval *records = global_collector->call_io[i].redis_operations;
+        if (records && 
+            Z_TYPE_P(records) == IS_ARRAY &&
+            zend_hash_num_elements(Z_ARRVAL_P(records)) > 0) {
             
-            HashTable *ht = Z_ARRVAL_P(call->redis_operations);
+            HashTable *ht = Z_ARRVAL_P(records);
             zval *val;
             ZEND_HASH_FOREACH_VAL(ht, val) {
                 if (!first) {
@@ -320,7 +329,6 @@ static int aggregate_redis_operations_from_calls(json_buffer_t *buf) {
                 first = 0;
             } ZEND_HASH_FOREACH_END();
         }
-        call = call->next;
     }
     
     json_buffer_append_str(buf, "]");
@@ -354,34 +362,22 @@ static void serialize_call_stack_from_root_malloc(json_buffer_t *buf) {
         return;
     }
     
-    debug_log("[SERIALIZE] Collector is valid: active=%d, calls=%p, call_stack_depth=%d", 
-        global_collector->active, global_collector->calls, global_collector->call_stack_depth);
-    
-    call_node_t *call = global_collector->calls;
-    int first = 1;
-    int found_any = 0;
-    int total_calls = 0;
-    int valid_calls = 0;
-    
-    // Count total calls for debugging
-    call_node_t *debug_call = global_collector->calls;
-    while (debug_call) {
-        total_calls++;
-        if (debug_call->magic == OPA_CALL_NODE_MAGIC && debug_call->start_time > 0.0) {
-            valid_calls++;
-        }
-        debug_call = debug_call->next;
+    if (global_collector->aggregate) {
+        // Calls were folded into the call graph
+        json_buffer_append_str(buf, "]");
+        return;
     }
-    debug_log("[SERIALIZE] Total calls in collector: %d (valid: %d), call_stack_depth: %d", 
-        total_calls, valid_calls, global_collector->call_stack_depth);
     
-    // Serialize ALL calls as a flat list to ensure nothing is lost
+    debug_log("[SERIALIZE] Collector is valid: active=%d, calls=%d, call_stack_depth=%d", 
+        global_collector->active, global_collector->call_count, global_collector->call_stack_depth);
+    
+    // Serialize ALL calls as a flat list, in call order, to ensure nothing is lost
     // The recursive structure will be rebuilt by the agent using parent_id relationships
-    debug_log("[SERIALIZE] Serializing all %d valid calls as flat list (will be rebuilt by agent)", valid_calls);
-    call = global_collector->calls;
+    int first = 1;
     int serialized_count = 0;
-    while (call) {
-        if (call->magic == OPA_CALL_NODE_MAGIC && call->start_time > 0.0) {
+    for (uint32_t i = 0; i < (uint32_t)global_collector->call_count; i++) {
+        call_node_t *call = OPA_CALL_AT(global_collector, i);
+        if (call->start_ns > 0) {
             if (!first) {
                 json_buffer_append_str(buf, ",");
             }
@@ -389,7 +385,6 @@ static void serialize_call_stack_from_root_malloc(json_buffer_t *buf) {
             first = 0;
             serialized_count++;
         }
-        call = call->next;
     }
     debug_log("[SERIALIZE] Serialized %d calls as flat list", serialized_count);
     
@@ -398,30 +393,24 @@ static void serialize_call_stack_from_root_malloc(json_buffer_t *buf) {
 
 // Serialize call node to JSON using malloc'd buffer
 static void serialize_call_node_json_malloc(json_buffer_t *buf, call_node_t *call) {
-    if (!call || call->magic != OPA_CALL_NODE_MAGIC) return;
+    if (!call) return;
     
-    // Debug: log parent_id at serialization time
-    debug_log("[SERIALIZE] serialize_call_node_json_malloc: call_id=%s, parent_id=%s", 
-        call->call_id ? call->call_id : "NULL",
-        call->parent_id ? call->parent_id : "NULL");
-    
-    json_buffer_append_str(buf, "{");
-    
-    if (call->call_id) {
-        json_buffer_append_str(buf, "\"call_id\":\"");
-        json_buffer_append_str(buf, call->call_id);
-        json_buffer_append_str(buf, "\"");
-    }
+    char id[OPA_CALL_ID_LEN + 1];
+    opa_call_format_id(global_collector, call->index, id);
+    json_buffer_append_str(buf, "{\"call_id\":\"");
+    json_buffer_append_str(buf, id);
+    json_buffer_append_str(buf, "\"");
     
     // Always include function field, even if empty (for debugging)
     json_buffer_append_str(buf, ",\"function\":\"");
-    if (call->function_name && strlen(call->function_name) > 0) {
-        json_escape_string_malloc(buf, call->function_name, strlen(call->function_name));
+    opa_symbol_t *function_symbol = opa_symbol_get(call->function_name);
+    if (function_symbol && function_symbol->len > 0) {
+        json_buffer_append_symbol(buf, call->function_name);
     } else {
         // Fallback: use function_type to generate a name
         if (call->function_type == 2 && call->class_name) {
             // Method call - use class name
-            json_escape_string_malloc(buf, call->class_name, strlen(call->class_name));
+            json_buffer_append_symbol(buf, call->class_name);
             json_buffer_append_str(buf, "::");
         }
         json_buffer_append_str(buf, "<unknown>");
@@ -430,13 +419,13 @@ static void serialize_call_node_json_malloc(json_buffer_t *buf, call_node_t *cal
     
     if (call->class_name) {
         json_buffer_append_str(buf, ",\"class\":\"");
-        json_escape_string_malloc(buf, call->class_name, strlen(call->class_name));
+        json_buffer_append_symbol(buf, call->class_name);
         json_buffer_append_str(buf, "\"");
     }
     
     if (call->file) {
         json_buffer_append_str(buf, ",\"file\":\"");
-        json_escape_string_malloc(buf, call->file, strlen(call->file));
+        json_buffer_append_symbol(buf, call->file);
         json_buffer_append_str(buf, "\"");
     }
     
@@ -447,10 +436,13 @@ static void serialize_call_node_json_malloc(json_buffer_t *buf, call_node_t *cal
         json_buffer_append_str(buf, line_str);
     }
     
+    // Counters are deltas once the call has exited
+    int ended = call->end_ns > 0;
+    
     // Duration in milliseconds
-    // TEMPORARY TEST: If end_time is 0, use a default duration of 1ms for testing
-    double end_time = call->end_time > 0.0 ? call->end_time : call->start_time + 0.001; // Default 1ms if not set
-    double duration_ms = (end_time - call->start_time) * 1000.0;
+    // TEMPORARY TEST: If end_ns is 0, use a default duration of 1ms for testing
+    int64_t end_ns = ended ? call->end_ns : call->start_ns + 1000000; // Default 1ms if not set
+    double duration_ms = (double)(end_ns - call->start_ns) / 1000000.0;
     if (duration_ms < 0.0) duration_ms = 0.0; // Safety check
     char duration_str[64];
     snprintf(duration_str, sizeof(duration_str), "%.3f", duration_ms);
@@ -458,9 +450,9 @@ static void serialize_call_node_json_malloc(json_buffer_t *buf, call_node_t *cal
     json_buffer_append_str(buf, duration_str);
     
     // CPU time in milliseconds
-    // TEMPORARY TEST: If end_cpu_time is 0, use a default value for testing
-    double end_cpu_time = call->end_cpu_time > 0.0 ? call->end_cpu_time : call->start_cpu_time + 0.0005; // Default 0.5ms if not set
-    double cpu_ms = (end_cpu_time - call->start_cpu_time) * 1000.0;
+    // TEMPORARY TEST: If end_cpu_ns is 0, use a default value for testing
+    int64_t end_cpu_ns = ended ? call->end_cpu_ns : call->start_cpu_ns + 500000; // Default 0.5ms if not set
+    double cpu_ms = (double)(end_cpu_ns - call->start_cpu_ns) / 1000000.0;
     if (cpu_ms < 0.0) cpu_ms = 0.0; // Safety check
     char cpu_str[64];
     snprintf(cpu_str, sizeof(cpu_str), "%.3f", cpu_ms);
@@ -468,18 +460,15 @@ static void serialize_call_node_json_malloc(json_buffer_t *buf, call_node_t *cal
     json_buffer_append_str(buf, cpu_str);
     
     // Memory delta
-    long memory_delta = (long)call->end_memory - (long)call->start_memory;
     char mem_str[64];
-    snprintf(mem_str, sizeof(mem_str), "%ld", memory_delta);
+    snprintf(mem_str, sizeof(mem_str), "%lld", ended ? (long long)call->memory : 0LL);
     json_buffer_append_str(buf, ",\"memory_delta\":");
     json_buffer_append_str(buf, mem_str);
     
     // Network bytes
-    long net_sent = (long)call->end_bytes_sent - (long)call->start_bytes_sent;
-    long net_received = (long)call->end_bytes_received - (long)call->start_bytes_received;
     char net_sent_str[64], net_recv_str[64];
-    snprintf(net_sent_str, sizeof(net_sent_str), "%ld", net_sent);
-    snprintf(net_recv_str, sizeof(net_recv_str), "%ld", net_received);
+    snprintf(net_sent_str, sizeof(net_sent_str), "%lld", ended ? (long long)call->bytes_sent : 0LL);
+    snprintf(net_recv_str, sizeof(net_recv_str), "%lld", ended ? (long long)call->bytes_received : 0LL);
     json_buffer_append_str(buf, ",\"network_bytes_sent\":");
     json_buffer_append_str(buf, net_sent_str);
     json_buffer_append_str(buf, ",\"network_bytes_received\":");
@@ -487,15 +476,13 @@ static void serialize_call_node_json_malloc(json_buffer_t *buf, call_node_t *cal
     
     // Always include parent_id field, even if NULL (for debugging)
     json_buffer_append_str(buf, ",\"parent_id\":");
-    if (call->parent_id && strlen(call->parent_id) > 0) {
+    if (call->parent != OPA_CALL_NONE) {
+        opa_call_format_id(global_collector, call->parent, id);
         json_buffer_append_str(buf, "\"");
-        json_buffer_append_str(buf, call->parent_id);
+        json_buffer_append_str(buf, id);
         json_buffer_append_str(buf, "\"");
-        debug_log("[SERIALIZE] Added parent_id=%s to JSON for call_id=%s", call->parent_id, call->call_id ? call->call_id : "NULL");
     } else {
         json_buffer_append_str(buf, "null");
-        debug_log("[SERIALIZE] parent_id is NULL/empty for call_id=%s (parent_id=%p)", 
-            call->call_id ? call->call_id : "NULL", call->parent_id);
     }
     
     char depth_str[32];
@@ -508,12 +495,26 @@ static void serialize_call_node_json_malloc(json_buffer_t *buf, call_node_t *cal
     json_buffer_append_str(buf, ",\"function_type\":");
     json_buffer_append_str(buf, type_str);
     
+    opa_call_io_t *io = opa_call_io(global_collector, call);
+    zval *sql_queries = io ? io->sql_queries : NULL;
+    zval *http_requests = io ? io->http_requests : NULL;
+    zval *cache_operations = io ? io->cache_operations : NULL;
+    zval *redis_operations = io ? io->redis_operations : NULL;
+    
+    // Callees past the call budget, summarized instead of recorded
+    if (io && io->truncated_calls > 0) {
+        char truncated_str[96];
+        snprintf(truncated_str, sizeof(truncated_str), ",\"truncated_calls\":%u,\"truncated_ms\":%.3f",
+            io->truncated_calls, (double)io->truncated_ns / 1000000.0);
+        json_buffer_append_str(buf, truncated_str);
+    }
+    
     // Serialize SQL queries
-    if (call->sql_queries && Z_TYPE_P(call->sql_queries) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(call->sql_queries)) > 0) {
+    if (sql_queries && Z_TYPE_P(sql_queries) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(sql_queries)) > 0) {
         json_buffer_append_str(buf, ",\"sql_queries\":");
         // Use temporary smart_string to serialize, then copy to json_buffer
         smart_string temp_buf = {0};
-        serialize_zval_json(&temp_buf, call->sql_queries);
+        serialize_zval_json(&temp_buf, sql_queries);
         smart_string_0(&temp_buf);
         if (temp_buf.c && temp_buf.len > 0) {
             json_buffer_append(buf, temp_buf.c, temp_buf.len);
@@ -522,10 +523,10 @@ static void serialize_call_node_json_malloc(json_buffer_t *buf, call_node_t *cal
     }
     
     // Serialize HTTP requests
-    if (call->http_requests && Z_TYPE_P(call->http_requests) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(call->http_requests)) > 0) {
+    if (http_requests && Z_TYPE_P(http_requests) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(http_requests)) > 0) {
         json_buffer_append_str(buf, ",\"http_requests\":");
         smart_string temp_buf = {0};
-        serialize_zval_json(&temp_buf, call->http_requests);
+        serialize_zval_json(&temp_buf, http_requests);
         smart_string_0(&temp_buf);
         if (temp_buf.c && temp_buf.len > 0) {
             json_buffer_append(buf, temp_buf.c, temp_buf.len);
@@ -534,10 +535,10 @@ static void serialize_call_node_json_malloc(json_buffer_t *buf, call_node_t *cal
     }
     
     // Serialize cache operations (APCu, Symfony Cache)
-    if (call->cache_operations && Z_TYPE_P(call->cache_operations) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(call->cache_operations)) > 0) {
+    if (cache_operations && Z_TYPE_P(cache_operations) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(cache_operations)) > 0) {
         json_buffer_append_str(buf, ",\"cache_operations\":");
         smart_string temp_buf = {0};
-        serialize_zval_json(&temp_buf, call->cache_operations);
+        serialize_zval_json(&temp_buf, cache_operations);
         smart_string_0(&temp_buf);
         if (temp_buf.c && temp_buf.len > 0) {
             json_buffer_append(buf, temp_buf.c, temp_buf.len);
@@ -546,10 +547,10 @@ static void serialize_call_node_json_malloc(json_buffer_t *buf, call_node_t *cal
     }
     
     // Serialize Redis operations
-    if (call->redis_operations && Z_TYPE_P(call->redis_operations) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(call->redis_operations)) > 0) {
+    if (redis_operations && Z_TYPE_P(redis_operations) == IS_ARRAY && zend_hash_num_elements(Z_ARRVAL_P(redis_operations)) > 0) {
         json_buffer_append_str(buf, ",\"redis_operations\":");
         smart_string temp_buf = {0};
-        serialize_zval_json(&temp_buf, call->redis_operations);
+        serialize_zval_json(&temp_buf, redis_operations);
         smart_string_0(&temp_buf);
         if (temp_buf.c && temp_buf.len > 0) {
             json_buffer_append(buf, temp_buf.c, temp_buf.len);
@@ -952,6 +953,11 @@ char* produce_span_json_from_values(
         json_buffer_append_str(&buf, "false");
     }
     tag_first = 0;
+    // Calls past the depth/call/byte budget that were only counted
+    char summarized_str[64];
+    snprintf(summarized_str, sizeof(summarized_str), ",\"calls_summarized\":%llu",
+        (global_collector && global_collector->magic == OPA_COLLECTOR_MAGIC) ? (unsigned long long)global_collector->calls_summarized : 0ULL);
+    json_buffer_append_str(&buf, summarized_str);
     json_buffer_append_str(&buf, "}");
     
     // Aggregate network metrics from call stack
@@ -1007,6 +1013,12 @@ char* produce_span_json_from_values(
     serialize_call_stack_from_root_malloc(&buf);
     debug_log("[produce_span_json_from_values] Call stack serialization completed");
     
+    // Aggregate mode: caller -> callee edges instead of a call tree
+    if (global_collector && global_collector->magic == OPA_COLLECTOR_MAGIC && global_collector->aggregate) {
+        json_buffer_append_str(&buf, ",\"call_graph\":");
+        serialize_call_graph_malloc(&buf);
+    }
+    
     json_buffer_append_str(&buf, "}\n");
     
     
@@ -1014,49 +1026,98 @@ char* produce_span_json_from_values(
     return buf.data;
 }
 
+// Edge endpoint name: Class::function, function, or "main()" for the top level of the request
+static void append_edge_name(json_buffer_t *buf, uint32_t class_name, uint32_t function_name) {
+    if (!class_name && !function_name) {
+        json_buffer_append_str(buf, "main()");
+        return;
+    }
+    if (class_name) {
+        json_buffer_append_symbol(buf, class_name);
+        json_buffer_append_str(buf, "::");
+    }
+    json_buffer_append_symbol(buf, function_name);
+}
+
+// Serialize the aggregated call graph (opa.mode=aggregate) as a flat edge list
+static void serialize_call_graph_malloc(json_buffer_t *buf) {
+    json_buffer_append_str(buf, "[");
+    uint32_t count = opa_aggregate_edge_count();
+    for (uint32_t i = 0; i < count; i++) {
+        const opa_edge_t *e = opa_aggregate_edge(i);
+        char num[64];
+        if (i > 0) {
+            json_buffer_append_str(buf, ",");
+        }
+        json_buffer_append_str(buf, "{\"caller\":\"");
+        append_edge_name(buf, e->caller_class, e->caller_function);
+        json_buffer_append_str(buf, "\",\"callee\":\"");
+        append_edge_name(buf, e->class_name, e->function_name);
+        snprintf(num, sizeof(num), "\",\"count\":%llu", (unsigned long long)e->count);
+        json_buffer_append_str(buf, num);
+        snprintf(num, sizeof(num), ",\"wall_ms\":%.3f", (double)e->wall_ns / 1000000.0);
+        json_buffer_append_str(buf, num);
+        snprintf(num, sizeof(num), ",\"excl_wall_ms\":%.3f", (double)e->excl_wall_ns / 1000000.0);
+        json_buffer_append_str(buf, num);
+        snprintf(num, sizeof(num), ",\"cpu_ms\":%.3f", (double)e->cpu_ns / 1000000.0);
+        json_buffer_append_str(buf, num);
+        snprintf(num, sizeof(num), ",\"excl_cpu_ms\":%.3f", (double)e->excl_cpu_ns / 1000000.0);
+        json_buffer_append_str(buf, num);
+        snprintf(num, sizeof(num), ",\"memory_delta\":%lld}", (long long)e->memory);
+        json_buffer_append_str(buf, num);
+    }
+    json_buffer_append_str(buf, "]");
+}
+
 // Produce child span JSON from call node - send each significant call as separate span
 // Returns NULL if call node is not significant (no SQL/HTTP/cache/Redis and duration <= 10ms)
 // Safe to use after fastcgi_finish_request()
 char* produce_child_span_json_from_call_node(
     call_node_t *call, const char *trace_id, const char *parent_span_id, long root_start_ts
 ) {
-    if (!call || call->magic != OPA_CALL_NODE_MAGIC) {
+    if (!call || !global_collector) {
         return NULL;
     }
     
-    // Check if call node is significant (should create a span)
-    int has_sql = (call->sql_queries && Z_TYPE_P(call->sql_queries) == IS_ARRAY && 
-                   zend_hash_num_elements(Z_ARRVAL_P(call->sql_queries)) > 0);
-    int has_http = (call->http_requests && Z_TYPE_P(call->http_requests) == IS_ARRAY && 
-                    zend_hash_num_elements(Z_ARRVAL_P(call->http_requests)) > 0);
-    int has_cache = (call->cache_operations && Z_TYPE_P(call->cache_operations) == IS_ARRAY && 
-                     zend_hash_num_elements(Z_ARRVAL_P(call->cache_operations)) > 0);
-    int has_redis = (call->redis_operations && Z_TYPE_P(call->redis_operations) == IS_ARRAY && 
-                     zend_hash_num_elements(Z_ARRVAL_P(call->redis_operations)) > 0);
-    
-    double end_time = call->end_time > 0.0 ? call->end_time : call->start_time + 0.001;
-    double duration_ms = (end_time - call->start_time) * 1000.0;
-    if (duration_ms < 0.0) duration_ms = 0.0;
-    
     // Only create span for significant nodes
-    if (!has_sql && !has_http && !has_cache && !has_redis && duration_ms <= 10.0) {
+    // (SQL/HTTP/cache/Redis activity or duration > 10ms)
+    if (!opa_call_is_significant(global_collector, call)) {
         return NULL; // Not significant, skip
     }
     
+    opa_call_io_t *io = opa_call_io(global_collector, call);
+    zval *sql_queries = io ? io->sql_queries : NULL;
+    zval *http_requests = io ? io->http_requests : NULL;
+    zval *cache_operations = io ? io->cache_operations : NULL;
+    zval *redis_operations = io ? io->redis_operations : NULL;
+    int has_sql = (sql_queries && Z_TYPE_P(sql_queries) == IS_ARRAY && 
+                   zend_hash_num_elements(Z_ARRVAL_P(sql_queries)) > 0);
+    int has_http = (http_requests && Z_TYPE_P(http_requests) == IS_ARRAY && 
+                    zend_hash_num_elements(Z_ARRVAL_P(http_requests)) > 0);
+    int has_cache = (cache_operations && Z_TYPE_P(cache_operations) == IS_ARRAY && 
+                     zend_hash_num_elements(Z_ARRVAL_P(cache_operations)) > 0);
+    int has_redis = (redis_operations && Z_TYPE_P(redis_operations) == IS_ARRAY && 
+                     zend_hash_num_elements(Z_ARRVAL_P(redis_operations)) > 0);
+    
+    int ended = call->end_ns > 0;
+    int64_t end_ns = ended ? call->end_ns : call->start_ns + 1000000;
+    double duration_ms = (double)(end_ns - call->start_ns) / 1000000.0;
+    if (duration_ms < 0.0) duration_ms = 0.0;
+    
     // Build span name from class::function or just function
+    opa_symbol_t *class_symbol = opa_symbol_get(call->class_name);
+    opa_symbol_t *function_symbol = opa_symbol_get(call->function_name);
     char *span_name = NULL;
-    if (call->class_name && call->function_name) {
-        size_t name_len = strlen(call->class_name) + 2 + strlen(call->function_name) + 1;
-        span_name = malloc(name_len);
-        if (span_name) {
-            snprintf(span_name, name_len, "%s::%s", call->class_name, call->function_name);
-        }
-    } else if (call->function_name) {
-        size_t name_len = strlen(call->function_name) + 1;
+    if (class_symbol && function_symbol) {
+        size_t name_len = class_symbol->len + 2 + function_symbol->len + 1;
         span_name = malloc(name_len);
         if (span_name) {
-            strcpy(span_name, call->function_name);
+            snprintf(span_name, name_len, "%.*s::%.*s",
+                (int)class_symbol->len, class_symbol->name,
+                (int)function_symbol->len, function_symbol->name);
         }
+    } else if (function_symbol) {
+        span_name = strndup(function_symbol->name, function_symbol->len);
     } else {
         span_name = strdup("function_call");
     }
@@ -1065,18 +1126,20 @@ char* produce_child_span_json_from_call_node(
         return NULL; // Memory allocation failed
     }
     
-    // Calculate timestamps relative to root span
-    // Approximate: use depth and duration to estimate timing
-    long start_ts = root_start_ts + (long)(call->start_time * 1000.0);
-    long end_ts = root_start_ts + (long)(end_time * 1000.0);
+    // Call times are monotonic; convert them through the request's wall clock anchor
+    long start_ts = opa_clock_wall_ms(call->start_ns);
+    long end_ts = opa_clock_wall_ms(end_ns);
     if (start_ts < root_start_ts) start_ts = root_start_ts; // Safety check
     
     // Calculate CPU time
-    double end_cpu_time = call->end_cpu_time > 0.0 ? call->end_cpu_time : call->start_cpu_time + 0.0005;
-    double cpu_ms = (end_cpu_time - call->start_cpu_time) * 1000.0;
+    int64_t end_cpu_ns = ended ? call->end_cpu_ns : call->start_cpu_ns + 500000;
+    double cpu_ms = (double)(end_cpu_ns - call->start_cpu_ns) / 1000000.0;
     if (cpu_ms < 0.0) cpu_ms = 0.0;
     int cpu_ms_int = (int)cpu_ms;
     
+    char call_id[OPA_CALL_ID_LEN + 1];
+    opa_call_format_id(global_collector, call->index, call_id);
+    
     // Use malloc'd buffer (safe after fastcgi_finish_request)
     json_buffer_t buf;
     json_buffer_init(&buf);
@@ -1088,11 +1151,7 @@ char* produce_child_span_json_from_call_node(
         json_buffer_append_str(&buf, "unknown");
     }
     json_buffer_append_str(&buf, "\",\"span_id\":\"");
-    if (call->call_id) {
-        json_buffer_append_str(&buf, call->call_id);
-    } else {
-        json_buffer_append_str(&buf, "unknown");
-    }
+    json_buffer_append_str(&buf, call_id);
     json_buffer_append_str(&buf, "\"");
     
     if (parent_span_id) {
@@ -1177,16 +1236,14 @@ char* produce_child_span_json_from_call_node(
     // Add call metadata to tags
     if (!tag_first) json_buffer_append_str(&buf, ",");
     json_buffer_append_str(&buf, "\"call_id\":\"");
-    if (call->call_id) {
-        json_buffer_append_str(&buf, call->call_id);
-    }
+    json_buffer_append_str(&buf, call_id);
     json_buffer_append_str(&buf, "\"");
     tag_first = 0;
     
     if (call->file) {
         if (!tag_first) json_buffer_append_str(&buf, ",");
         json_buffer_append_str(&buf, "\"file\":\"");
-        json_escape_string_malloc(&buf, call->file, strlen(call->file));
+        json_buffer_append_symbol(&buf, call->file);
         json_buffer_append_str(&buf, "\"");
         tag_first = 0;
     }
@@ -1194,7 +1251,7 @@ char* produce_child_span_json_from_call_node(
     if (call->line > 0) {
         if (!tag_first) json_buffer_append_str(&buf, ",");
         char line_str[32];
-        snprintf(line_str, sizeof(line_str), "%d", call->line);
+        snprintf(line_str, sizeof(line_str), "%u", call->line);
         json_buffer_append_str(&buf, "\"line\":");
         json_buffer_append_str(&buf, line_str);
         tag_first = 0;
@@ -1210,8 +1267,8 @@ char* produce_child_span_json_from_call_node(
     json_buffer_append_str(&buf, "}");
     
     // Network metrics
-    long net_sent = (long)call->end_bytes_sent - (long)call->start_bytes_sent;
-    long net_received = (long)call->end_bytes_received - (long)call->start_bytes_received;
+    long net_sent = ended ? (long)call->bytes_sent : 0;
+    long net_received = ended ? (long)call->bytes_received : 0;
     if (net_sent > 0 || net_received > 0) {
         json_buffer_append_str(&buf, ",\"net\":{");
         char net_sent_str[64], net_recv_str[64];
@@ -1230,7 +1287,7 @@ char* produce_child_span_json_from_call_node(
     json_buffer_append_str(&buf, ",\"sql\":");
     if (has_sql) {
         smart_string temp_buf = {0};
-        serialize_zval_json(&temp_buf, call->sql_queries);
+        serialize_zval_json(&temp_buf, sql_queries);
         smart_string_0(&temp_buf);
         if (temp_buf.c && temp_buf.len > 0) {
             json_buffer_append(&buf, temp_buf.c, temp_buf.len);
@@ -1246,7 +1303,7 @@ char* produce_child_span_json_from_call_node(
     json_buffer_append_str(&buf, ",\"http\":");
     if (has_http) {
         smart_string temp_buf = {0};
-        serialize_zval_json(&temp_buf, call->http_requests);
+        serialize_zval_json(&temp_buf, http_requests);
         smart_string_0(&temp_buf);
         if (temp_buf.c && temp_buf.len > 0) {
             json_buffer_append(&buf, temp_buf.c, temp_buf.len);
@@ -1262,7 +1319,7 @@ char* produce_child_span_json_from_call_node(
     json_buffer_append_str(&buf, ",\"cache\":");
     if (has_cache) {
         smart_string temp_buf = {0};
-        serialize_zval_json(&temp_buf, call->cache_operations);
+        serialize_zval_json(&temp_buf, cache_operations);
         smart_string_0(&temp_buf);
         if (temp_buf.c && temp_buf.len > 0) {
             json_buffer_append(&buf, temp_buf.c, temp_buf.len);
@@ -1278,7 +1335,7 @@ char* produce_child_span_json_from_call_node(
     json_buffer_append_str(&buf, ",\"redis\":");
     if (has_redis) {
         smart_string temp_buf = {0};
-        serialize_zval_json(&temp_buf, call->redis_operations);
+        serialize_zval_json(&temp_buf, redis_operations);
         smart_string_0(&temp_buf);
         if (temp_buf.c && temp_buf.len > 0) {
             json_buffer_append(&buf, temp_buf.c, temp_buf.len);
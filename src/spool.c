@@ -0,0 +1,393 @@
+#include "spool.h"
+#include "transport.h"
+#include <dirent.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Replay hands the sink runs of whole frames of at most this size
+#define SPOOL_REPLAY_CHUNK (1024 * 1024)
+
+// Segment currently being written by this process (flock'd while open)
+static int seg_fd = -1;
+static opa_spool_header_t *seg_hdr = NULL;
+static size_t seg_map_size = 0;
+static char *seg_path = NULL; // malloc'd
+static unsigned int seg_seq = 0;
+
+// Spool directory size, rescanned on rotation. Changed under the transport
+// mutex; opa_spool_has_room() reads it without, hence the atomics.
+static uint64_t dir_bytes = 0;
+static int pending = 0;
+static time_t last_replay = 0; // Segments sealed by other workers are picked up by a periodic rescan
+static opa_spool_stats_t spool_stats = {0};
+
+// Settings copied at MINIT (all PHP_INI_SYSTEM): the spool is also written
+// by the sender thread, which must not read OPA_G
+static char *cfg_dir = NULL; // malloc'd, NULL = spool disabled
+static size_t cfg_segment_size = 65536;
+static uint64_t cfg_max_bytes = 0;
+
+static const char *spool_dir(void) {
+    return cfg_dir;
+}
+
+static size_t spool_segment_size(void) {
+    return cfg_segment_size;
+}
+
+static uint64_t spool_dir_bytes(void) {
+    return __atomic_load_n(&dir_bytes, __ATOMIC_RELAXED);
+}
+
+static void spool_set_dir_bytes(uint64_t bytes) {
+    __atomic_store_n(&dir_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+static int is_segment_name(const char *name) {
+    size_t len = strlen(name);
+    return strncmp(name, "opa-", 4) == 0 && len > 10 && strcmp(name + len - 6, ".spool") == 0;
+}
+
+static int segment_filter(const struct dirent *entry) {
+    return is_segment_name(entry->d_name);
+}
+
+// Total size of all segments in the directory (every worker's)
+static uint64_t spool_scan_bytes(const char *dir, int *count) {
+    uint64_t total = 0;
+    int n = 0;
+    DIR *d = opendir(dir);
+    if (!d) {
+        return 0;
+    }
+    struct dirent *entry;
+    char path[1024];
+    while ((entry = readdir(d)) != NULL) {
+        if (!is_segment_name(entry->d_name)) {
+            continue;
+        }
+        struct stat st;
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        if (stat(path, &st) == 0) {
+            total += (uint64_t)st.st_size;
+            n++;
+        }
+    }
+    closedir(d);
+    if (count) {
+        *count = n;
+    }
+    return total;
+}
+
+void opa_spool_init(void) {
+    const char *ini_dir = OPA_G(spool_dir);
+    if (cfg_dir) {
+        free(cfg_dir);
+        cfg_dir = NULL;
+    }
+    if (ini_dir && *ini_dir) {
+        cfg_dir = strdup(ini_dir);
+    }
+    zend_long size = OPA_G(spool_segment_size);
+    cfg_segment_size = size < 65536 ? 65536 : (size_t)size;
+    cfg_max_bytes = OPA_G(spool_max_bytes) > 0 ? (uint64_t)OPA_G(spool_max_bytes) : 0;
+
+    const char *dir = spool_dir();
+    if (!dir) {
+        return;
+    }
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        debug_log("[SPOOL] Cannot create spool directory %s: errno=%d", dir, errno);
+        return;
+    }
+    int count = 0;
+    spool_set_dir_bytes(spool_scan_bytes(dir, &count));
+    // Segments left by a previous run are replayed once the agent answers
+    pending = count > 0;
+    if (count > 0) {
+        debug_log("[SPOOL] Found %d segments (%llu bytes) in %s", count, (unsigned long long)spool_dir_bytes(), dir);
+    }
+}
+
+static int segment_open(void) {
+    const char *dir = spool_dir();
+    size_t size = spool_segment_size();
+    char path[1024];
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    // Names sort chronologically, so replay preserves order
+    snprintf(path, sizeof(path), "%s/opa-%013llu-%d-%06u.spool", dir,
+        (unsigned long long)tv.tv_sec * 1000 + (unsigned long long)tv.tv_usec / 1000, (int)getpid(), seg_seq++);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        debug_log("[SPOOL] Cannot create segment %s: errno=%d", path, errno);
+        return -1;
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+
+    // ftruncate zero-fills: write_pos and read_pos start at 0
+    opa_spool_header_t *hdr = p;
+    hdr->version = OPA_SPOOL_VERSION;
+    hdr->header_size = OPA_SPOOL_HEADER_SIZE;
+    hdr->capacity = size - OPA_SPOOL_HEADER_SIZE;
+    hdr->pid = (uint64_t)getpid();
+    memcpy(hdr->magic, OPA_SPOOL_MAGIC, sizeof(hdr->magic));
+
+    seg_fd = fd;
+    seg_hdr = hdr;
+    seg_map_size = size;
+    seg_path = strdup(path);
+    spool_set_dir_bytes(spool_dir_bytes() + size);
+    return 0;
+}
+
+// Trim the current segment to its contents and release it for replay
+static void segment_seal(void) {
+    if (!seg_hdr) {
+        return;
+    }
+    uint64_t used = __atomic_load_n(&seg_hdr->write_pos, __ATOMIC_ACQUIRE);
+    munmap(seg_hdr, seg_map_size);
+    seg_hdr = NULL;
+    if (used == 0) {
+        if (seg_path) {
+            unlink(seg_path);
+        }
+        spool_set_dir_bytes(spool_dir_bytes() - seg_map_size);
+    } else {
+        if (ftruncate(seg_fd, (off_t)(OPA_SPOOL_HEADER_SIZE + used)) == 0) {
+            spool_set_dir_bytes(spool_dir_bytes() - (seg_map_size - (OPA_SPOOL_HEADER_SIZE + used)));
+        }
+        pending = 1;
+    }
+    flock(seg_fd, LOCK_UN);
+    close(seg_fd);
+    seg_fd = -1;
+    if (seg_path) {
+        free(seg_path);
+        seg_path = NULL;
+    }
+}
+
+void opa_spool_shutdown(void) {
+    segment_seal();
+    if (cfg_dir) {
+        free(cfg_dir);
+        cfg_dir = NULL;
+    }
+}
+
+// The mapping and descriptor belong to the parent: unmap our view only.
+// Closing our copy of the descriptor keeps the parent's flock.
+void opa_spool_atfork_child(void) {
+    if (seg_hdr) {
+        munmap(seg_hdr, seg_map_size);
+        seg_hdr = NULL;
+    }
+    if (seg_fd >= 0) {
+        close(seg_fd);
+        seg_fd = -1;
+    }
+    if (seg_path) {
+        free(seg_path);
+        seg_path = NULL;
+    }
+    memset(&spool_stats, 0, sizeof(spool_stats));
+}
+
+int opa_spool_enabled(void) {
+    return spool_dir() != NULL;
+}
+
+int opa_spool_has_room(void) {
+    return spool_dir() != NULL && spool_dir_bytes() + spool_segment_size() <= cfg_max_bytes;
+}
+
+int opa_spool_pending(void) {
+    return spool_dir() != NULL && (pending || time(NULL) - last_replay >= OPA_SPOOL_RESCAN_SEC);
+}
+
+int opa_spool_append(const struct iovec *iov, int iovcnt, size_t len) {
+    if (!spool_dir()) {
+        return -1;
+    }
+    if (len > spool_segment_size() - OPA_SPOOL_HEADER_SIZE) {
+        spool_stats.dropped++;
+        return -1;
+    }
+    if (seg_hdr && seg_hdr->write_pos + len > seg_hdr->capacity) {
+        segment_seal();
+    }
+    if (!seg_hdr) {
+        // Rotation is rare - refresh the estimate, other workers may have replayed segments
+        spool_set_dir_bytes(spool_scan_bytes(spool_dir(), NULL));
+        if (spool_dir_bytes() + spool_segment_size() > cfg_max_bytes) {
+            spool_stats.dropped++;
+            debug_log("[SPOOL] Spool full (%llu bytes), dropping %zu bytes", (unsigned long long)spool_dir_bytes(), len);
+            return -1;
+        }
+        if (segment_open() != 0) {
+            spool_stats.dropped++;
+            return -1;
+        }
+    }
+
+    // Sequential copy into the mapping; write_pos commits the frame
+    uint64_t pos = seg_hdr->write_pos;
+    unsigned char *dst = (unsigned char *)seg_hdr + OPA_SPOOL_HEADER_SIZE + pos;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+    __atomic_store_n(&seg_hdr->write_pos, pos + len, __ATOMIC_RELEASE);
+    spool_stats.spooled++;
+    pending = 1;
+    return 0;
+}
+
+// Replay one closed segment and delete it.
+// Returns frames replayed, 0 if the segment is held by its writer, -1 if the sink failed.
+static long replay_segment(const char *path, opa_spool_sink_t sink, void *ctx) {
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+    // Still being written, or another worker is replaying it
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        close(fd);
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_nlink == 0) {
+        // Replayed and deleted by another worker in the meantime
+        close(fd);
+        return 0;
+    }
+    if ((size_t)st.st_size <= OPA_SPOOL_HEADER_SIZE) {
+        // Writer died before the segment was set up
+        unlink(path);
+        close(fd);
+        return 0;
+    }
+
+    void *p = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        close(fd);
+        return 0;
+    }
+    opa_spool_header_t *hdr = p;
+    const unsigned char *data = (const unsigned char *)p + OPA_SPOOL_HEADER_SIZE;
+    uint64_t end = hdr->write_pos;
+    uint64_t limit = (uint64_t)st.st_size - OPA_SPOOL_HEADER_SIZE;
+    if (memcmp(hdr->magic, OPA_SPOOL_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version != OPA_SPOOL_VERSION ||
+        hdr->header_size != OPA_SPOOL_HEADER_SIZE) {
+        debug_log("[SPOOL] Discarding invalid segment %s", path);
+        end = 0;
+    }
+    if (end > limit) {
+        end = limit;
+    }
+
+    long frames = 0;
+    uint64_t pos = hdr->read_pos;
+    while (pos < end) {
+        // Gather whole frames into one write
+        uint64_t chunk_end = pos;
+        long chunk_frames = 0;
+        while (chunk_end < end && chunk_end - pos < SPOOL_REPLAY_CHUNK) {
+            uint32_t be_len;
+            if (end - chunk_end < OPA_FRAME_HEADER_SIZE || memcmp(data + chunk_end, OPA_FRAME_MAGIC, 4) != 0) {
+                break;
+            }
+            memcpy(&be_len, data + chunk_end + 4, 4);
+            uint64_t frame_len = OPA_FRAME_HEADER_SIZE + (uint64_t)ntohl(be_len);
+            if (frame_len > end - chunk_end) {
+                break;
+            }
+            chunk_end += frame_len;
+            chunk_frames++;
+        }
+        if (chunk_end == pos) {
+            // Torn or corrupt tail - nothing after it can be trusted
+            debug_log("[SPOOL] Corrupt frame at offset %llu in %s, discarding the rest", (unsigned long long)pos, path);
+            break;
+        }
+        if (sink(ctx, data + pos, (size_t)(chunk_end - pos)) != 0) {
+            // Keep the progress so the next replay resumes here
+            __atomic_store_n(&hdr->read_pos, pos, __ATOMIC_RELEASE);
+            munmap(p, (size_t)st.st_size);
+            close(fd);
+            return -1;
+        }
+        pos = chunk_end;
+        frames += chunk_frames;
+    }
+
+    unlink(path);
+    munmap(p, (size_t)st.st_size);
+    close(fd);
+    uint64_t bytes = spool_dir_bytes();
+    spool_set_dir_bytes(bytes > (uint64_t)st.st_size ? bytes - (uint64_t)st.st_size : 0);
+    return frames;
+}
+
+long opa_spool_replay(opa_spool_sink_t sink, void *ctx, int max_segments) {
+    const char *dir = spool_dir();
+    if (!dir) {
+        return 0;
+    }
+    // Our own segment becomes replayable too
+    segment_seal();
+    last_replay = time(NULL);
+
+    struct dirent **names = NULL;
+    int n = scandir(dir, &names, segment_filter, alphasort);
+    if (n < 0) {
+        return 0;
+    }
+
+    long total = 0;
+    int done = 0;
+    int failed = 0;
+    char path[1024];
+    for (int i = 0; i < n; i++) {
+        if (!failed && (max_segments <= 0 || done < max_segments)) {
+            snprintf(path, sizeof(path), "%s/%s", dir, names[i]->d_name);
+            long frames = replay_segment(path, sink, ctx);
+            if (frames < 0) {
+                failed = 1;
+            } else {
+                total += frames;
+                done++;
+            }
+        }
+        free(names[i]);
+    }
+    free(names);
+
+    // More segments than this call was allowed to replay: try again after the next send
+    pending = failed || (max_segments > 0 && done >= max_segments && n > done);
+    spool_stats.replayed += (uint64_t)total;
+    if (total > 0) {
+        debug_log("[SPOOL] Replayed %ld frames from %d segments", total, done);
+    }
+    return failed ? -1 : total;
+}
+
+void opa_spool_get_stats(opa_spool_stats_t *stats) {
+    *stats = spool_stats;
+    stats->bytes = spool_dir_bytes();
+}
@@ -0,0 +1,61 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include "opa.h"
+#include <sys/uio.h>
+
+// Local disk spool (opa.spool_dir)
+// Frames that cannot be delivered are appended to a memory-mapped segment file
+// owned by the worker, exactly as they would have been written to the socket.
+// Segments rotate at opa.spool_segment_size, and the directory is capped at
+// opa.spool_max_bytes. Once the agent is reachable again, closed segments are
+// replayed in bulk and deleted. Any worker may replay any closed segment,
+// including those left by dead workers; an flock() on the file claims it.
+//
+// Segment file: <dir>/opa-<ms timestamp>-<pid>-<seq>.spool
+// 64-byte header followed by frames ("OPAF" + BE uint32 length + payload)
+
+#define OPA_SPOOL_MAGIC "OPASPL1"
+#define OPA_SPOOL_VERSION 1
+#define OPA_SPOOL_HEADER_SIZE 64
+// Segments replayed after each successful send, within that send's deadline
+// (opa_spool_replay() replays everything)
+#define OPA_SPOOL_REPLAY_SEGMENTS 4
+// Look for segments left by other workers at most this often (seconds)
+#define OPA_SPOOL_RESCAN_SEC 30
+
+typedef struct {
+    char magic[8];         // OPA_SPOOL_MAGIC
+    uint32_t version;
+    uint32_t header_size;  // OPA_SPOOL_HEADER_SIZE
+    uint64_t capacity;     // Bytes available for frames
+    uint64_t write_pos;    // Frame bytes committed (updated after each append)
+    uint64_t read_pos;     // Frame bytes already replayed
+    uint64_t pid;          // Writer
+    char reserved[16];
+} opa_spool_header_t;
+
+// Counters reported by opa_transport_stats()
+typedef struct {
+    uint64_t spooled;      // Frames written to the spool
+    uint64_t dropped;      // Frames dropped because the spool was full or unwritable
+    uint64_t replayed;     // Frames replayed to the agent by this process
+    uint64_t bytes;        // Approximate size of the spool directory
+} opa_spool_stats_t;
+
+// Writes len bytes to the agent; 0 on success
+typedef int (*opa_spool_sink_t)(void *ctx, const void *data, size_t len);
+
+// Spool functions (callers serialize access; the transport holds its connection mutex.
+// Settings are copied at MINIT, so the sender thread can call in without OPA_G)
+void opa_spool_init(void); // Create the directory and look for segments to replay (MINIT)
+void opa_spool_shutdown(void); // Seal the current segment (MSHUTDOWN)
+void opa_spool_atfork_child(void); // Drop the parent's segment without touching it
+int opa_spool_enabled(void);
+int opa_spool_has_room(void);
+int opa_spool_pending(void); // Whether closed or open segments may be waiting for replay
+int opa_spool_append(const struct iovec *iov, int iovcnt, size_t len); // One complete frame; -1 if dropped
+long opa_spool_replay(opa_spool_sink_t sink, void *ctx, int max_segments); // Frames replayed, -1 if the sink failed (max_segments 0 = all)
+void opa_spool_get_stats(opa_spool_stats_t *stats);
+
+#endif /* SPOOL_H */
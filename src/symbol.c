@@ -0,0 +1,197 @@
+#include "symbol.h"
+#include "arena.h"
+
+typedef struct {
+    zend_string *key;
+    uint32_t id;
+    unsigned int generation; // Slot is live only in the current generation
+} symbol_slot_t;
+
+// Symbols of the current request, id = position + 1 (malloc'd, reused across requests)
+static opa_symbol_t *symbols = NULL;
+static uint32_t symbol_count = 0;
+static uint32_t symbol_capacity = 0;
+
+// Open addressing, capacity is a power of two, kept at most half full.
+// Reset bumps the generation instead of clearing the slots.
+static symbol_slot_t *slots = NULL;
+static size_t capacity = 0;
+static size_t count = 0;
+static unsigned int generation = 1;
+
+static size_t slot_index(const zend_string *key, size_t mask) {
+    uint64_t h = (uint64_t)(uintptr_t)key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h & mask;
+}
+
+static uint32_t new_symbol(const char *name, size_t len) {
+    if (symbol_count == symbol_capacity) {
+        uint32_t new_capacity = symbol_capacity ? symbol_capacity * 2 : OPA_SYMBOL_TABLE_MIN;
+        opa_symbol_t *new_symbols = realloc(symbols, new_capacity * sizeof(opa_symbol_t));
+        if (!new_symbols) {
+            return 0;
+        }
+        symbols = new_symbols;
+        symbol_capacity = new_capacity;
+    }
+    opa_symbol_t *sym = &symbols[symbol_count++];
+    sym->name = name;
+    sym->len = len;
+    sym->json = NULL;
+    sym->json_len = 0;
+    return symbol_count;
+}
+
+static int grow(void) {
+    size_t new_capacity = capacity ? capacity * 2 : OPA_SYMBOL_TABLE_MIN;
+    symbol_slot_t *new_slots = calloc(new_capacity, sizeof(symbol_slot_t));
+    if (!new_slots) {
+        return -1;
+    }
+    size_t mask = new_capacity - 1;
+    for (size_t i = 0; i < capacity; i++) {
+        if (slots[i].generation != generation) {
+            continue;
+        }
+        size_t j = slot_index(slots[i].key, mask);
+        while (new_slots[j].generation == generation) {
+            j = (j + 1) & mask;
+        }
+        new_slots[j] = slots[i];
+    }
+    free(slots);
+    slots = new_slots;
+    capacity = new_capacity;
+    return 0;
+}
+
+uint32_t opa_symbol_intern(zend_string *str) {
+    if (!str) {
+        return 0;
+    }
+    if (!ZSTR_IS_INTERNED(str)) {
+        // May be released (and its address reused) before the request ends
+        char *copy = opa_arena_alloc(&opa_request_arena, ZSTR_LEN(str) + 1);
+        if (!copy) {
+            return 0;
+        }
+        memcpy(copy, ZSTR_VAL(str), ZSTR_LEN(str) + 1);
+        return new_symbol(copy, ZSTR_LEN(str));
+    }
+
+    if ((count + 1) * 2 > capacity && grow() < 0 && count + 1 >= capacity) {
+        return new_symbol(ZSTR_VAL(str), ZSTR_LEN(str)); // Table full, serve it uncached
+    }
+    size_t mask = capacity - 1;
+    size_t i = slot_index(str, mask);
+    while (slots[i].generation == generation) {
+        if (slots[i].key == str) {
+            return slots[i].id;
+        }
+        i = (i + 1) & mask;
+    }
+
+    uint32_t id = new_symbol(ZSTR_VAL(str), ZSTR_LEN(str));
+    if (id) {
+        slots[i].key = str;
+        slots[i].id = id;
+        slots[i].generation = generation;
+        count++;
+    }
+    return id;
+}
+
+uint32_t opa_symbol_from_cstr(const char *str) {
+    if (!str) {
+        return 0;
+    }
+    char *copy = opa_arena_strdup(&opa_request_arena, str);
+    return copy ? new_symbol(copy, strlen(copy)) : 0;
+}
+
+opa_symbol_t *opa_symbol_get(uint32_t id) {
+    return (id > 0 && id <= symbol_count) ? &symbols[id - 1] : NULL;
+}
+
+const char *opa_symbol_json(uint32_t id, size_t *len) {
+    opa_symbol_t *sym = opa_symbol_get(id);
+    if (!sym) {
+        *len = 0;
+        return "";
+    }
+    if (!sym->json) {
+        // Same escaping as json_escape_string()
+        size_t escaped_len = 0;
+        for (size_t i = 0; i < sym->len; i++) {
+            unsigned char c = (unsigned char)sym->name[i];
+            if (c == '"' || c == '\\' || c == '\b' || c == '\f' || c == '\n' || c == '\r' || c == '\t') {
+                escaped_len += 2;
+            } else if (c < 0x20) {
+                escaped_len += 6;
+            } else {
+                escaped_len++;
+            }
+        }
+        if (escaped_len == sym->len) {
+            sym->json = sym->name;
+        } else {
+            char *out = opa_arena_alloc(&opa_request_arena, escaped_len + 1);
+            if (!out) {
+                *len = 0;
+                return "";
+            }
+            char *p = out;
+            for (size_t i = 0; i < sym->len; i++) {
+                unsigned char c = (unsigned char)sym->name[i];
+                switch (c) {
+                    case '"': *p++ = '\\'; *p++ = '"'; break;
+                    case '\\': *p++ = '\\'; *p++ = '\\'; break;
+                    case '\b': *p++ = '\\'; *p++ = 'b'; break;
+                    case '\f': *p++ = '\\'; *p++ = 'f'; break;
+                    case '\n': *p++ = '\\'; *p++ = 'n'; break;
+                    case '\r': *p++ = '\\'; *p++ = 'r'; break;
+                    case '\t': *p++ = '\\'; *p++ = 't'; break;
+                    default:
+                        if (c < 0x20) {
+                            snprintf(p, 7, "\\u%04x", c);
+                            p += 6;
+                        } else {
+                            *p++ = (char)c;
+                        }
+                        break;
+                }
+            }
+            *p = '\0';
+            sym->json = out;
+        }
+        sym->json_len = escaped_len;
+    }
+    *len = sym->json_len;
+    return sym->json;
+}
+
+void opa_symbol_reset(void) {
+    count = 0;
+    symbol_count = 0;
+    if (++generation == 0) {
+        // Wrapped: stale slots could look live again
+        if (slots) {
+            memset(slots, 0, capacity * sizeof(symbol_slot_t));
+        }
+        generation = 1;
+    }
+}
+
+void opa_symbol_shutdown(void) {
+    free(slots);
+    slots = NULL;
+    capacity = 0;
+    count = 0;
+    free(symbols);
+    symbols = NULL;
+    symbol_count = 0;
+    symbol_capacity = 0;
+}
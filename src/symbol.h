@@ -0,0 +1,32 @@
+#ifndef SYMBOL_H
+#define SYMBOL_H
+
+#include "opa.h"
+
+// Per-request symbol table
+// Call records reference function, class and file names by symbol id instead
+// of copying them. The names come from zend_strings that are interned (by the
+// compiler or opcache) and outlive the request, so the table is keyed by the
+// zend_string pointer and each symbol borrows the string's bytes. The
+// JSON-escaped form is built once per symbol, on first serialization. Strings
+// that are not interned are copied into the request arena and not cached.
+// Ids are only valid until the end of the request.
+
+#define OPA_SYMBOL_TABLE_MIN 256
+
+typedef struct opa_symbol {
+    const char *name;  // NUL-terminated; borrowed from an interned zend_string or copied to the request arena
+    size_t len;
+    const char *json;  // JSON-escaped name without quotes, built on first serialization
+    size_t json_len;
+} opa_symbol_t;
+
+// Symbol functions
+uint32_t opa_symbol_intern(zend_string *str); // 0 for NULL or on allocation failure
+uint32_t opa_symbol_from_cstr(const char *str); // Uncached arena copy
+opa_symbol_t *opa_symbol_get(uint32_t id); // NULL for 0; valid until the next intern
+const char *opa_symbol_json(uint32_t id, size_t *len); // Escaped name without quotes
+void opa_symbol_reset(void); // End of request, before the arena is reset
+void opa_symbol_shutdown(void);
+
+#endif /* SYMBOL_H */
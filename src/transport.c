@@ -1,13 +1,12 @@
 #include "transport.h"
+#include "sender.h"
+#include "shm_ring.h"
+#include "compress.h"
+#include "spool.h"
+#include "resolver.h"
 
-// Cached agent address to avoid repeated DNS lookups (thread-safe with mutex)
-static struct sockaddr_in cached_agent_addr = {0};
-static char *cached_agent_host = NULL;
-static int cached_agent_port = 0;
-static pthread_mutex_t agent_addr_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
-static int agent_addr_cached = 0;
-
-// Pre-resolve agent address in RINIT (before observer callbacks) to avoid DNS calls from unsafe contexts
+// Resolve the TCP agent address in RINIT (before observer callbacks) so DNS is
+// never called from unsafe contexts. Free while the resolver cache is fresh.
 void pre_resolve_agent_address(void) {
     if (!OPA_G(enabled) || !OPA_G(socket_path)) {
         return;
@@ -16,94 +15,12 @@ void pre_resolve_agent_address(void) {
     const char *sock_path = OPA_G(socket_path);
     int is_unix_socket = (sock_path[0] == '/');
     
-    if (is_unix_socket) {
-        // Unix socket - no DNS resolution needed
-        return;
-    }
-    
-    // Parse host:port
-    char *path_copy = estrdup(sock_path);
-    char *colon = strchr(path_copy, ':');
-    if (!colon) {
-        efree(path_copy);
-        return;
-    }
-    
-    *colon = '\0';
-    char *host = path_copy;
-    char *port_str = colon + 1;
-    int port = atoi(port_str);
-    
-    if (port <= 0 || port > 65535) {
-        efree(path_copy);
+    if (is_unix_socket || strncmp(sock_path, OPA_SHM_PREFIX, sizeof(OPA_SHM_PREFIX) - 1) == 0) {
+        // Unix socket or shared-memory ring - no DNS resolution needed
         return;
     }
     
-    // Check if already cached
-    pthread_mutex_lock(&agent_addr_cache_mutex);
-    if (agent_addr_cached && cached_agent_host && 
-        strcmp(cached_agent_host, host) == 0 && cached_agent_port == port) {
-        pthread_mutex_unlock(&agent_addr_cache_mutex);
-        efree(path_copy);
-        return; // Already cached
-    }
-    pthread_mutex_unlock(&agent_addr_cache_mutex);
-    
-    // Try to parse as IP address first
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    
-    if (inet_aton(host, &addr.sin_addr) == 0) {
-        // Not an IP address, resolve hostname using getaddrinfo (safe in RINIT context)
-        struct addrinfo hints, *result, *rp;
-        memset(&hints, 0, sizeof(struct addrinfo));
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_STREAM;
-        
-        char port_str_buf[16];
-        snprintf(port_str_buf, sizeof(port_str_buf), "%d", port);
-        
-        int gai_result = getaddrinfo(host, port_str_buf, &hints, &result);
-        if (gai_result == 0) {
-            // Use first result
-            for (rp = result; rp != NULL; rp = rp->ai_next) {
-                if (rp->ai_family == AF_INET) {
-                    struct sockaddr_in *sin = (struct sockaddr_in *)rp->ai_addr;
-                    memcpy(&addr.sin_addr, &sin->sin_addr, sizeof(addr.sin_addr));
-                    break;
-                }
-            }
-            freeaddrinfo(result);
-            
-            if (rp != NULL) {
-                // Cache the resolved address
-                pthread_mutex_lock(&agent_addr_cache_mutex);
-                if (cached_agent_host) {
-                    efree(cached_agent_host);
-                }
-                cached_agent_host = estrdup(host);
-                cached_agent_port = port;
-                memcpy(&cached_agent_addr.sin_addr, &addr.sin_addr, sizeof(cached_agent_addr.sin_addr));
-                agent_addr_cached = 1;
-                pthread_mutex_unlock(&agent_addr_cache_mutex);
-            }
-        }
-    } else {
-        // IP address parsed successfully, cache it
-        pthread_mutex_lock(&agent_addr_cache_mutex);
-        if (cached_agent_host) {
-            efree(cached_agent_host);
-        }
-        cached_agent_host = estrdup(host);
-        cached_agent_port = port;
-        memcpy(&cached_agent_addr.sin_addr, &addr.sin_addr, sizeof(cached_agent_addr.sin_addr));
-        agent_addr_cached = 1;
-        pthread_mutex_unlock(&agent_addr_cache_mutex);
-    }
-    
-    efree(path_copy);
+    opa_resolver_refresh(sock_path);
 }
 
 // Finish request to client BEFORE sending data
@@ -142,50 +59,236 @@ void opa_finish_request(void) {
     zval_dtor(&function);
 }
 
-// Send message directly to socket (synchronous, no threads)
-void send_message_direct(char *msg, int compress) {
-    if (!OPA_G(enabled)) {
-        debug_log("[SEND] Extension disabled, not sending");
-        if (msg) efree(msg);
-        return;
+// Persistent agent connection, one per worker process.
+// Opened lazily on the first send, reused across requests and re-established
+// when the agent goes away. Guarded by a mutex because error/log messages can
+// be sent from any context, and reset in the child after fork() so a forked
+// worker never shares a stream with its parent.
+static int agent_sock = -1;
+static char *agent_sock_target = NULL; // malloc'd copy of the socket_path the connection was opened for
+static pthread_mutex_t agent_sock_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Shared-memory ring (opa.socket_path=shm:/name), mapped once per process.
+// The mapping stays valid across fork(), and writes need no syscalls or locks.
+static opa_shm_ring_t *shm_ring = NULL;
+static char *shm_ring_name = NULL; // malloc'd
+static pthread_mutex_t shm_ring_mutex = PTHREAD_MUTEX_INITIALIZER; // Guards (re)mapping only
+static uint64_t shm_dropped = 0;
+
+// Circuit breaker: after opa.breaker_threshold consecutive failed sends the
+// circuit opens and nothing is collected or sent until the backoff expires.
+// The backoff doubles on every failed probe up to opa.breaker_max_backoff_ms.
+// Transitions happen under agent_sock_mutex; the state is read without it.
+static int breaker_state = OPA_BREAKER_CLOSED;
+static int breaker_failures = 0;
+static long breaker_backoff_ms = 0;
+static uint64_t breaker_retry_at_ms = 0; // Monotonic time the circuit may be probed again
+static uint64_t breaker_trips = 0;
+static uint64_t breaker_rejected = 0;
+
+// Frames given up on (timed out, failed or rejected) that could not be spooled
+static uint64_t dropped_bytes = 0;
+static uint64_t send_timeouts = 0;
+
+// INI settings used by the sender thread, copied at MINIT (all PHP_INI_SYSTEM).
+// OPA_G must not be read off the PHP thread.
+static long cfg_send_timeout_ms = 0;
+static long cfg_breaker_threshold = 0;
+static long cfg_breaker_backoff_ms = 0;
+static long cfg_breaker_max_backoff_ms = 0;
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// Deadline for one message (connect + write) from opa.send_timeout_ms; 0 = none
+static uint64_t send_deadline(void) {
+    long timeout = cfg_send_timeout_ms;
+    return timeout > 0 ? monotonic_ms() + (uint64_t)timeout : 0;
+}
+
+// Wait until the socket is writable or the deadline passes (errno = ETIMEDOUT)
+static int wait_writable(int sock, uint64_t deadline_ms) {
+    for (;;) {
+        int timeout = -1;
+        if (deadline_ms) {
+            uint64_t now = monotonic_ms();
+            if (now >= deadline_ms) {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            timeout = (int)(deadline_ms - now);
+        }
+        struct pollfd pfd;
+        pfd.fd = sock;
+        pfd.events = POLLOUT;
+        pfd.revents = 0;
+        int r = poll(&pfd, 1, timeout);
+        if (r > 0) {
+            return 0;
+        }
+        if (r == 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        if (errno != EINTR) {
+            return -1;
+        }
     }
-    if (!msg) {
-        debug_log("[SEND] Message is NULL, not sending");
-        return;
+}
+
+// connect() on a non-blocking socket, bounded by the deadline
+static int connect_with_deadline(int sock, const struct sockaddr *addr, socklen_t addr_len, uint64_t deadline_ms) {
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+        return -1;
     }
-    
-    // Apply sampling rate
-    double rate = OPA_G(sampling_rate);
-    if (rate < 1.0 && ((double)rand() / RAND_MAX) > rate) {
-        efree(msg);
+    if (connect(sock, addr, addr_len) == 0) {
+        return 0;
+    }
+    if (errno != EINPROGRESS && errno != EINTR) {
+        return -1;
+    }
+    if (wait_writable(sock, deadline_ms) != 0) {
+        return -1;
+    }
+    int err = 0;
+    socklen_t err_len = sizeof(err);
+    if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &err_len) != 0) {
+        return -1;
+    }
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+// Whether a connection attempt may be made now. An open circuit whose backoff
+// has expired goes half-open and lets the caller probe. Caller holds agent_sock_mutex.
+static int breaker_try_acquire(void) {
+    int state = __atomic_load_n(&breaker_state, __ATOMIC_RELAXED);
+    if (state == OPA_BREAKER_OPEN) {
+        if (monotonic_ms() < breaker_retry_at_ms) {
+            return 0;
+        }
+        __atomic_store_n(&breaker_state, OPA_BREAKER_HALF_OPEN, __ATOMIC_RELAXED);
+        debug_log("[BREAKER] Backoff expired, probing agent");
+    }
+    return 1;
+}
+
+// Caller holds agent_sock_mutex
+static void breaker_record_success(void) {
+    if (__atomic_load_n(&breaker_state, __ATOMIC_RELAXED) != OPA_BREAKER_CLOSED) {
+        debug_log("[BREAKER] Agent reachable again, closing circuit");
+    }
+    __atomic_store_n(&breaker_state, OPA_BREAKER_CLOSED, __ATOMIC_RELAXED);
+    breaker_failures = 0;
+    breaker_backoff_ms = 0;
+}
+
+// Caller holds agent_sock_mutex
+static void breaker_record_failure(void) {
+    int state = __atomic_load_n(&breaker_state, __ATOMIC_RELAXED);
+    long threshold = cfg_breaker_threshold;
+    if (threshold <= 0) {
+        return; // Breaker disabled
+    }
+    if (state == OPA_BREAKER_HALF_OPEN) {
+        long max_backoff = cfg_breaker_max_backoff_ms;
+        breaker_backoff_ms *= 2;
+        if (max_backoff > 0 && breaker_backoff_ms > max_backoff) {
+            breaker_backoff_ms = max_backoff;
+        }
+    } else if (++breaker_failures >= threshold) {
+        breaker_backoff_ms = cfg_breaker_backoff_ms > 0 ? cfg_breaker_backoff_ms : 1000;
+        __atomic_add_fetch(&breaker_trips, 1, __ATOMIC_RELAXED);
+    } else {
         return;
     }
+    __atomic_store_n(&breaker_retry_at_ms, monotonic_ms() + (uint64_t)breaker_backoff_ms, __ATOMIC_RELAXED);
+    __atomic_store_n(&breaker_state, OPA_BREAKER_OPEN, __ATOMIC_RELAXED);
+    debug_log("[BREAKER] Agent unreachable, circuit open for %ld ms", breaker_backoff_ms);
+}
+
+// Child side of fork(): drop the inherited descriptor (the parent keeps its own copy)
+// and reinitialize the mutex, which may have been held by another thread at fork time
+static void transport_atfork_child(void) {
+    if (agent_sock >= 0) {
+        close(agent_sock);
+        agent_sock = -1;
+    }
+    if (agent_sock_target) {
+        free(agent_sock_target);
+        agent_sock_target = NULL;
+    }
+    opa_spool_atfork_child();
+    pthread_mutex_init(&agent_sock_mutex, NULL);
+    pthread_mutex_init(&shm_ring_mutex, NULL);
+}
+
+// Called from MINIT
+void opa_transport_init(void) {
+    cfg_send_timeout_ms = (long)OPA_G(send_timeout_ms);
+    cfg_breaker_threshold = (long)OPA_G(breaker_threshold);
+    cfg_breaker_backoff_ms = (long)OPA_G(breaker_backoff_ms);
+    cfg_breaker_max_backoff_ms = (long)OPA_G(breaker_max_backoff_ms);
+    opa_resolver_init();
+    static int atfork_registered = 0;
+    if (!atfork_registered) {
+        pthread_atfork(NULL, NULL, transport_atfork_child);
+        atfork_registered = 1;
+    }
+    opa_spool_init();
+}
+
+// Called from MSHUTDOWN
+void opa_transport_shutdown(void) {
+    opa_resolver_shutdown();
     
-    size_t msg_len = strlen(msg);
-    char *final_msg = msg;
-    size_t final_len = msg_len;
-    
-#if LZ4_ENABLED
-    // Compress if enabled and message is large enough
-    if (compress && msg_len > 1024) {
-        int max_compressed = LZ4_compressBound(msg_len);
-        char *compressed = emalloc(max_compressed + strlen(COMPRESSION_HEADER) + sizeof(size_t) + 1);
-        memcpy(compressed, COMPRESSION_HEADER, strlen(COMPRESSION_HEADER));
-        memcpy(compressed + strlen(COMPRESSION_HEADER), &msg_len, sizeof(size_t));
-        
-        int compressed_size = LZ4_compress_HC(msg, compressed + strlen(COMPRESSION_HEADER) + sizeof(size_t), msg_len, max_compressed, LZ4HC_CLEVEL_DEFAULT);
-        if (compressed_size > 0) {
-            efree(msg);
-            final_msg = compressed;
-            final_len = strlen(COMPRESSION_HEADER) + sizeof(size_t) + compressed_size;
-        } else {
-            efree(compressed);
-        }
+    pthread_mutex_lock(&agent_sock_mutex);
+    if (agent_sock >= 0) {
+        close(agent_sock);
+        agent_sock = -1;
     }
-#endif
+    if (agent_sock_target) {
+        free(agent_sock_target);
+        agent_sock_target = NULL;
+    }
+    opa_spool_shutdown();
+    pthread_mutex_unlock(&agent_sock_mutex);
     
+    pthread_mutex_lock(&shm_ring_mutex);
+    if (shm_ring) {
+        opa_shm_ring_close(shm_ring);
+        shm_ring = NULL;
+    }
+    if (shm_ring_name) {
+        free(shm_ring_name);
+        shm_ring_name = NULL;
+    }
+    pthread_mutex_unlock(&shm_ring_mutex);
+}
+
+void opa_transport_get_stats(opa_transport_stats_t *stats) {
+    stats->shm_dropped = __atomic_load_n(&shm_dropped, __ATOMIC_RELAXED);
+    stats->breaker_state = __atomic_load_n(&breaker_state, __ATOMIC_RELAXED);
+    stats->breaker_trips = __atomic_load_n(&breaker_trips, __ATOMIC_RELAXED);
+    stats->breaker_rejected = __atomic_load_n(&breaker_rejected, __ATOMIC_RELAXED);
+    stats->dropped_bytes = __atomic_load_n(&dropped_bytes, __ATOMIC_RELAXED);
+    stats->send_timeouts = __atomic_load_n(&send_timeouts, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&agent_sock_mutex);
+    opa_spool_get_stats(&stats->spool);
+    pthread_mutex_unlock(&agent_sock_mutex);
+}
+
+// Open a new non-blocking connection to the agent, giving up at deadline_ms (0 = no deadline).
+// Returns the socket or -1.
+static int agent_connect(const char *sock_path, uint64_t deadline_ms) {
     // Detect transport type: Unix socket if path starts with '/', otherwise TCP/IP
-    const char *sock_path = OPA_G(socket_path) ? OPA_G(socket_path) : "/var/run/opa.sock";
     int is_unix_socket = (sock_path[0] == '/');
     
     int sock = -1;
@@ -199,163 +302,442 @@ void send_message_direct(char *msg, int compress) {
             memset(&addr, 0, sizeof(addr));
             addr.sun_family = AF_UNIX;
             strncpy(addr.sun_path, sock_path, sizeof(addr.sun_path)-1);
-            conn_result = connect(sock, (struct sockaddr*)&addr, sizeof(addr));
+            conn_result = connect_with_deadline(sock, (struct sockaddr*)&addr, sizeof(addr), deadline_ms);
         }
     } else {
-        // TCP/IP transport (format: host:port)
-        char *host = NULL;
-        char *port_str = NULL;
-        int port = 0;
-        
-        // Parse host:port
-        char *path_copy = estrdup(sock_path);
-        char *colon = strchr(path_copy, ':');
-        if (colon != NULL) {
-            *colon = '\0';
-            host = path_copy;
-            port_str = colon + 1;
-            port = atoi(port_str);
-        } else {
-            // If no colon, assume it's just a port (default to localhost)
-            port_str = path_copy;
-            port = atoi(port_str);
-            host = "127.0.0.1";
+        // TCP/IP transport (format: host:port or [v6addr]:port)
+        // Try every cached address of the agent, starting with the last one that worked
+        opa_agent_addr_t addrs[OPA_AGENT_MAX_ADDRS];
+        int count = opa_resolver_get(sock_path, addrs, OPA_AGENT_MAX_ADDRS);
+        for (int i = 0; i < count; i++) {
+            sock = socket(addrs[i].addr.ss_family, SOCK_STREAM, 0);
+            if (sock < 0) {
+                continue;
+            }
+            // Frames are written in one call, so don't let Nagle hold back small ones
+            int one = 1;
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            conn_result = connect_with_deadline(sock, (struct sockaddr *)&addrs[i].addr, addrs[i].len, deadline_ms);
+            if (conn_result == 0) {
+                opa_resolver_mark_good(&addrs[i]);
+                break;
+            }
+            // The deadline covers all addresses; the last failure is reported below
+            if (errno == ETIMEDOUT || i == count - 1) {
+                break;
+            }
+            debug_log("[SEND] Failed to connect to address %d of %s (errno=%d), trying next", i + 1, sock_path, errno);
+            close(sock);
+            sock = -1;
         }
-        
-        if (port > 0 && port <= 65535) {
-            sock = socket(AF_INET, SOCK_STREAM, 0);
-            if (sock >= 0) {
-                struct sockaddr_in addr;
-                memset(&addr, 0, sizeof(addr));
-                addr.sin_family = AF_INET;
-                addr.sin_port = htons(port);
-                
-                // Parse host address
-                // First check cache to avoid repeated DNS lookups (which can crash in observer callbacks)
-                int use_cached = 0;
-                pthread_mutex_lock(&agent_addr_cache_mutex);
-                if (agent_addr_cached && cached_agent_host && 
-                    strcmp(cached_agent_host, host) == 0 && cached_agent_port == port) {
-                    // Use cached address
-                    memcpy(&addr.sin_addr, &cached_agent_addr.sin_addr, sizeof(addr.sin_addr));
-                    use_cached = 1;
-                }
-                pthread_mutex_unlock(&agent_addr_cache_mutex);
-                
-                if (!use_cached) {
-                    // Try to parse as IP address first
-                    if (inet_aton(host, &addr.sin_addr) == 0) {
-                        // If inet_aton fails, check if we have a cached address (pre-resolved in RINIT)
-                        // If no cache, fail gracefully instead of calling getaddrinfo from unsafe context
-                        pthread_mutex_lock(&agent_addr_cache_mutex);
-                        int cache_available = agent_addr_cached && cached_agent_host;
-                        pthread_mutex_unlock(&agent_addr_cache_mutex);
-                        
-                        if (!cache_available) {
-                            // No cache available - this might be called from unsafe context
-                            // Fail gracefully instead of calling getaddrinfo
-                            debug_log("[SEND] Cannot resolve host (no cache, unsafe context): %s", host);
-                            close(sock);
-                            efree(path_copy);
-                            if (msg) efree(msg);
-                            return;
-                        }
-                        
-                        // Cache exists - use it (should be for same host/port if pre-resolved correctly)
-                        pthread_mutex_lock(&agent_addr_cache_mutex);
-                        if (cached_agent_host) {
-                            memcpy(&addr.sin_addr, &cached_agent_addr.sin_addr, sizeof(addr.sin_addr));
-                        } else {
-                            pthread_mutex_unlock(&agent_addr_cache_mutex);
-                            debug_log("[SEND] Cache corrupted - cannot resolve host: %s", host);
-                            close(sock);
-                            efree(path_copy);
-                            if (msg) efree(msg);
-                            return;
-                        }
-                        pthread_mutex_unlock(&agent_addr_cache_mutex);
-                    } else {
-                        // IP address parsed successfully, cache it
-                        pthread_mutex_lock(&agent_addr_cache_mutex);
-                        if (cached_agent_host) {
-                            efree(cached_agent_host);
-                        }
-                        cached_agent_host = estrdup(host);
-                        cached_agent_port = port;
-                        memcpy(&cached_agent_addr.sin_addr, &addr.sin_addr, sizeof(cached_agent_addr.sin_addr));
-                        agent_addr_cached = 1;
-                        pthread_mutex_unlock(&agent_addr_cache_mutex);
-                    }
-                }
-                
-                // Check if address resolution succeeded
-                if (addr.sin_addr.s_addr == 0) {
-                    debug_log("[SEND] Failed to resolve host address: %s", host);
-                    close(sock);
-                    sock = -1;
-                }
-                
-                if (sock >= 0) {
-                    conn_result = connect(sock, (struct sockaddr*)&addr, sizeof(addr));
+        if (count == 0) {
+            debug_log("[SEND] Failed to resolve host address: %s", sock_path);
+        }
+    }
+    
+    if (sock >= 0 && conn_result == 0) {
+#ifdef SO_NOSIGPIPE
+        // No MSG_NOSIGNAL on macOS/BSD - suppress SIGPIPE on the socket instead
+        int nosigpipe = 1;
+        setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &nosigpipe, sizeof(nosigpipe));
+#endif
+        debug_log("[SEND] Connected to %s: %s", is_unix_socket ? "Unix socket" : "TCP", sock_path);
+        return sock;
+    }
+    
+    if (sock >= 0) {
+        // NOTE: Do NOT call log_error() here - it would cause infinite recursion since log_error calls send_message_direct
+        debug_log("[SEND] Failed to connect to %s: %s (errno=%d)", is_unix_socket ? "Unix socket" : "TCP", sock_path, errno);
+        close(sock);
+    } else {
+        debug_log("[SEND] Failed to create socket for %s: %s", is_unix_socket ? "Unix socket" : "TCP", sock_path);
+    }
+    return -1;
+}
+
+// Check whether an idle persistent connection is still usable.
+// The agent never writes to us, so any readable state means EOF or a reset.
+static int agent_socket_is_alive(int sock) {
+    struct pollfd pfd;
+    pfd.fd = sock;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, 0) == 0) {
+        return 1;
+    }
+    if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) {
+        return 0;
+    }
+    char c;
+    ssize_t r = recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return r > 0 || (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+// Write an iovec array completely, advancing over partial writes and waiting
+// in poll() while the socket buffer is full. Returns 0 on success, -1 with
+// errno set on failure (ETIMEDOUT once deadline_ms has passed).
+static int agent_send_iov(int sock, struct iovec *iov, int iovcnt, uint64_t deadline_ms) {
+    while (iovcnt > 0) {
+        struct msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = iov;
+        mh.msg_iovlen = iovcnt > OPA_IOV_MAX ? OPA_IOV_MAX : iovcnt;
+        ssize_t w = sendmsg(sock, &mh, OPA_SEND_FLAGS);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                if (wait_writable(sock, deadline_ms) != 0) {
+                    return -1;
                 }
+                continue;
             }
-        } else {
-            debug_log("[SEND] Invalid port number: %d", port);
+            return -1;
         }
-        
-        if (path_copy) {
-            efree(path_copy);
+        if (w == 0) {
+            errno = EPIPE;
+            return -1;
         }
+        while (iovcnt > 0 && (size_t)w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return 0;
+}
+
+// Spool replay writes straight to the persistent connection. Caller holds agent_sock_mutex.
+// ctx points to a shared deadline (uint64_t ms) that bounds the whole replay;
+// NULL gives every chunk its own opa.send_timeout_ms.
+static int spool_sink(void *ctx, const void *data, size_t len) {
+    uint64_t deadline_ms = ctx ? *(const uint64_t *)ctx : send_deadline();
+    if (deadline_ms && monotonic_ms() >= deadline_ms) {
+        // Out of time between chunks: the connection is still clean, resume after the next send
+        errno = ETIMEDOUT;
+        return -1;
+    }
+    struct iovec iov;
+    iov.iov_base = (void *)data;
+    iov.iov_len = len;
+    if (agent_sock < 0 || agent_send_iov(agent_sock, &iov, 1, deadline_ms) != 0) {
+        debug_log("[SPOOL] Replay write failed: errno=%d", errno);
+        if (agent_sock >= 0) {
+            close(agent_sock);
+            agent_sock = -1;
+        }
+        return -1;
     }
+    return 0;
+}
+
+// Send one framed message over the persistent connection, connecting lazily.
+// The payload is given as an iovec array so batched messages can be written
+// without first being copied into one buffer.
+// If the connection turns out to be broken (agent restarted), it is
+// re-established once and the whole frame is written again; the agent
+// discards any partial frame left on the dead connection.
+// Frames that cannot be delivered go to the disk spool (opa.spool_dir), which
+// is replayed after the next successful send, within what is left of that
+// send's deadline.
+static int agent_send_frame(const char *sock_path, const struct iovec *payload, int payload_cnt, size_t len) {
+    unsigned char header[OPA_FRAME_HEADER_SIZE];
+    uint32_t be_len = htonl((uint32_t)len);
+    memcpy(header, OPA_FRAME_MAGIC, 4);
+    memcpy(header + 4, &be_len, 4);
     
-    if (sock >= 0 && conn_result == 0) {
-        debug_log("[SEND] Connected to %s, sending %zu bytes", is_unix_socket ? "Unix socket" : "TCP", final_len);
-        // NOTE: Do NOT call log_info() here - it would cause infinite recursion since log_info calls send_message_direct
-        size_t sent = 0;
-        while (sent < final_len) {
-            ssize_t w = write(sock, final_msg + sent, final_len - sent);
-            if (w <= 0) {
-                debug_log("[SEND] Write failed or incomplete: w=%zd, sent=%zu/%zu", w, sent, final_len);
-                char error_msg[256];
-                char fields[512];
-                snprintf(error_msg, sizeof(error_msg), "Socket write failed: w=%zd, sent=%zu/%zu", w, sent, final_len);
-                if (is_unix_socket) {
-                    snprintf(fields, sizeof(fields), "{\"bytes_written\":%zd,\"bytes_sent\":%zu,\"bytes_total\":%zu,\"errno\":%d,\"transport\":\"unix\"}", 
-                            w, sent, final_len, errno);
-                } else {
-                    snprintf(fields, sizeof(fields), "{\"bytes_written\":%zd,\"bytes_sent\":%zu,\"bytes_total\":%zu,\"errno\":%d,\"transport\":\"tcp\"}", 
-                            w, sent, final_len, errno);
+    // agent_send_iov() advances the iovecs in place, so each attempt works on a fresh copy
+    struct iovec iov_buf[8];
+    struct iovec *iov = iov_buf;
+    int iovcnt = payload_cnt + 1;
+    if (iovcnt > (int)(sizeof(iov_buf) / sizeof(iov_buf[0]))) {
+        iov = malloc(sizeof(struct iovec) * iovcnt);
+        if (!iov) {
+            return -1;
+        }
+    }
+    
+    int result = -1;
+    pthread_mutex_lock(&agent_sock_mutex);
+    // One deadline for the whole message, reconnect included
+    uint64_t deadline_ms = send_deadline();
+    
+    // Circuit open: spool or drop without touching the network
+    if (!breaker_try_acquire()) {
+        iov[0].iov_base = header;
+        iov[0].iov_len = sizeof(header);
+        memcpy(iov + 1, payload, sizeof(struct iovec) * payload_cnt);
+        if (opa_spool_append(iov, iovcnt, sizeof(header) + len) != 0) {
+            __atomic_add_fetch(&breaker_rejected, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&dropped_bytes, sizeof(header) + len, __ATOMIC_RELAXED);
+        }
+        pthread_mutex_unlock(&agent_sock_mutex);
+        if (iov != iov_buf) {
+            free(iov);
+        }
+        return -1;
+    }
+    
+    // Reconnect if the socket path changed (opa.socket_path is PHP_INI_ALL)
+    if (agent_sock >= 0 && (!agent_sock_target || strcmp(agent_sock_target, sock_path) != 0)) {
+        close(agent_sock);
+        agent_sock = -1;
+    }
+    // Drop an idle connection the agent has already closed
+    if (agent_sock >= 0 && !agent_socket_is_alive(agent_sock)) {
+        debug_log("[SEND] Persistent connection closed by agent, reconnecting");
+        close(agent_sock);
+        agent_sock = -1;
+    }
+    
+    for (int attempt = 0; attempt < 2; attempt++) {
+        if (agent_sock < 0) {
+            agent_sock = agent_connect(sock_path, deadline_ms);
+            if (agent_sock < 0) {
+                if (errno == ETIMEDOUT) {
+                    __atomic_add_fetch(&send_timeouts, 1, __ATOMIC_RELAXED);
                 }
-                // NOTE: Do NOT call log_error() here - it would cause infinite recursion since log_error calls send_message_direct
-                debug_log("[SEND] Error: %s", error_msg);
                 break;
             }
-            sent += w;
+            if (agent_sock_target) {
+                free(agent_sock_target);
+            }
+            agent_sock_target = strdup(sock_path);
+        }
+        
+        iov[0].iov_base = header;
+        iov[0].iov_len = sizeof(header);
+        memcpy(iov + 1, payload, sizeof(struct iovec) * payload_cnt);
+        if (agent_send_iov(agent_sock, iov, iovcnt, deadline_ms) == 0) {
+            result = 0;
+            break;
+        }
+        
+        // Timed out or failed mid-frame: the stream can't be reused
+        int err = errno;
+        if (err == ETIMEDOUT) {
+            __atomic_add_fetch(&send_timeouts, 1, __ATOMIC_RELAXED);
+        }
+        // NOTE: Do NOT call log_error() here - it would cause infinite recursion since log_error calls send_message_direct
+        debug_log("[SEND] Write failed on persistent connection: errno=%d (%s)", err, strerror(err));
+        close(agent_sock);
+        agent_sock = -1;
+        if (err != EPIPE && err != ECONNRESET && err != ENOTCONN) {
+            break;
+        }
+    }
+    
+    if (result == 0) {
+        breaker_record_success();
+        // Agent is back: catch up on what was spooled while it was away, sharing
+        // this message's deadline so a slow agent can't hold the request longer
+        if (opa_spool_pending()) {
+            opa_spool_replay(spool_sink, &deadline_ms, OPA_SPOOL_REPLAY_SEGMENTS);
         }
-        debug_log("[SEND] Sent %zu/%zu bytes", sent, final_len);
     } else {
-        if (sock >= 0) {
-            debug_log("[SEND] Failed to connect to %s: %s (errno=%d)", is_unix_socket ? "Unix socket" : "TCP", sock_path, errno);
-            char error_msg[256];
-            char fields[512];
-            snprintf(error_msg, sizeof(error_msg), "Failed to connect to %s: %s (errno=%d)", is_unix_socket ? "Unix socket" : "TCP", sock_path, errno);
-            if (is_unix_socket) {
-                snprintf(fields, sizeof(fields), "{\"socket_path\":\"%s\",\"errno\":%d,\"errno_str\":\"%s\",\"transport\":\"unix\"}", 
-                        sock_path, errno, strerror(errno));
-            } else {
-                snprintf(fields, sizeof(fields), "{\"tcp_address\":\"%s\",\"errno\":%d,\"errno_str\":\"%s\",\"transport\":\"tcp\"}", 
-                        sock_path, errno, strerror(errno));
+        breaker_record_failure();
+        iov[0].iov_base = header;
+        iov[0].iov_len = sizeof(header);
+        memcpy(iov + 1, payload, sizeof(struct iovec) * payload_cnt);
+        if (opa_spool_append(iov, iovcnt, sizeof(header) + len) != 0) {
+            __atomic_add_fetch(&dropped_bytes, sizeof(header) + len, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&agent_sock_mutex);
+    if (iov != iov_buf) {
+        free(iov);
+    }
+    return result;
+}
+
+// Called from RINIT before the collector is started. While the circuit is
+// open the request is not profiled at all. Once the backoff expires, a
+// connection is attempted here (half-open probe) and kept as the persistent
+// connection if it succeeds, so the probe costs one connect() per backoff period.
+int opa_transport_breaker_allow(void) {
+    if (__atomic_load_n(&breaker_state, __ATOMIC_RELAXED) == OPA_BREAKER_CLOSED) {
+        return 1;
+    }
+    const char *sock_path = OPA_G(socket_path) ? OPA_G(socket_path) : "/var/run/opa.sock";
+    if (strncmp(sock_path, OPA_SHM_PREFIX, sizeof(OPA_SHM_PREFIX) - 1) == 0) {
+        return 1;
+    }
+    
+    pthread_mutex_lock(&agent_sock_mutex);
+    // With room in the spool, keep collecting: the data is replayed later
+    int spool_room = opa_spool_has_room();
+    if (!breaker_try_acquire()) {
+        pthread_mutex_unlock(&agent_sock_mutex);
+        return spool_room;
+    }
+    int allowed = 1;
+    if (__atomic_load_n(&breaker_state, __ATOMIC_RELAXED) == OPA_BREAKER_HALF_OPEN) {
+        if (agent_sock >= 0) {
+            close(agent_sock);
+        }
+        agent_sock = agent_connect(sock_path, send_deadline());
+        if (agent_sock >= 0) {
+            if (agent_sock_target) {
+                free(agent_sock_target);
             }
-            // NOTE: Do NOT call log_error() here - it would cause infinite recursion since log_error calls send_message_direct
-            debug_log("[SEND] Error: %s", error_msg);
-            close(sock);
+            agent_sock_target = strdup(sock_path);
+            breaker_record_success();
         } else {
-            debug_log("[SEND] Failed to create socket for %s: %s", is_unix_socket ? "Unix socket" : "TCP", sock_path);
+            breaker_record_failure();
+            allowed = spool_room;
         }
     }
+    pthread_mutex_unlock(&agent_sock_mutex);
+    return allowed;
+}
+
+// opa_spool_replay(): replay every spooled segment now.
+// Returns frames replayed, or -1 if the agent could not be reached.
+long opa_transport_replay_spool(void) {
+    if (!opa_spool_enabled()) {
+        return 0;
+    }
+    const char *sock_path = OPA_G(socket_path) ? OPA_G(socket_path) : "/var/run/opa.sock";
+    if (strncmp(sock_path, OPA_SHM_PREFIX, sizeof(OPA_SHM_PREFIX) - 1) == 0) {
+        return 0;
+    }
     
-    if (sock >= 0) {
-        close(sock);
+    long replayed = -1;
+    pthread_mutex_lock(&agent_sock_mutex);
+    if (agent_sock >= 0 && (!agent_sock_target || strcmp(agent_sock_target, sock_path) != 0 ||
+        !agent_socket_is_alive(agent_sock))) {
+        close(agent_sock);
+        agent_sock = -1;
+    }
+    if (agent_sock < 0) {
+        agent_sock = agent_connect(sock_path, send_deadline());
+        if (agent_sock >= 0) {
+            if (agent_sock_target) {
+                free(agent_sock_target);
+            }
+            agent_sock_target = strdup(sock_path);
+        }
+    }
+    if (agent_sock >= 0) {
+        breaker_record_success();
+        replayed = opa_spool_replay(spool_sink, NULL, 0);
+    }
+    pthread_mutex_unlock(&agent_sock_mutex);
+    return replayed;
+}
+
+// Used by the background sender thread, which owns the connection in async mode
+int opa_transport_send_payload(const char *sock_path, const char *payload, size_t len) {
+    struct iovec iov;
+    iov.iov_base = (void *)payload;
+    iov.iov_len = len;
+    return agent_send_frame(sock_path, &iov, 1, len);
+}
+
+// Copy a payload into the shared-memory ring, mapping it on first use.
+// The ring is created if the agent has not created it yet.
+static int shm_dispatch(const char *name, const struct iovec *iov, int iovcnt, size_t len) {
+    pthread_mutex_lock(&shm_ring_mutex);
+    if (shm_ring && (!shm_ring_name || strcmp(shm_ring_name, name) != 0)) {
+        opa_shm_ring_close(shm_ring);
+        shm_ring = NULL;
+    }
+    if (!shm_ring) {
+        shm_ring = opa_shm_ring_open(name, (size_t)OPA_G(shm_size), 1);
+        if (!shm_ring) {
+            pthread_mutex_unlock(&shm_ring_mutex);
+            debug_log("[SEND] Failed to map shared-memory ring %s: errno=%d", name, errno);
+            return -1;
+        }
+        if (shm_ring_name) {
+            free(shm_ring_name);
+        }
+        shm_ring_name = strdup(name);
+        debug_log("[SEND] Mapped shared-memory ring %s (%llu bytes)", name, (unsigned long long)shm_ring->hdr->capacity);
+    }
+    opa_shm_ring_t *ring = shm_ring;
+    pthread_mutex_unlock(&shm_ring_mutex);
+    
+    if (opa_shm_ring_write(ring, iov, iovcnt, len) != 0) {
+        __atomic_add_fetch(&shm_dropped, 1, __ATOMIC_RELAXED);
+        debug_log("[SEND] Shared-memory ring full, dropped %zu bytes", len);
+        return -1;
+    }
+    return 0;
+}
+
+// Hand a finished payload to the shared-memory ring (shm:/name), the sender
+// thread (opa.async_send=1) or write it inline
+static int transport_dispatch(const char *sock_path, const struct iovec *iov, int iovcnt, size_t len) {
+    if (strncmp(sock_path, OPA_SHM_PREFIX, sizeof(OPA_SHM_PREFIX) - 1) == 0) {
+        // Already non-blocking - never worth a thread hop
+        return shm_dispatch(sock_path + sizeof(OPA_SHM_PREFIX) - 1, iov, iovcnt, len);
+    }
+    if (OPA_G(async_send)) {
+        return opa_sender_enqueue(sock_path, iov, iovcnt, len);
+    }
+    return agent_send_frame(sock_path, iov, iovcnt, len);
+}
+
+// Common checks before anything is sent (sampling is decided per request in RINIT)
+static int transport_should_send(void) {
+    if (!OPA_G(enabled)) {
+        debug_log("[SEND] Extension disabled, not sending");
+        return 0;
+    }
+    
+    // Skip serialization and compression while the circuit is open (the send would be dropped anyway)
+    if (__atomic_load_n(&breaker_state, __ATOMIC_RELAXED) == OPA_BREAKER_OPEN &&
+        monotonic_ms() < __atomic_load_n(&breaker_retry_at_ms, __ATOMIC_RELAXED) && !opa_spool_has_room()) {
+        __atomic_add_fetch(&breaker_rejected, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    return 1;
+}
+
+// Send message to the agent over the persistent per-worker connection
+// (or queue it for the sender thread in async mode)
+void send_message_direct(char *msg, int compress) {
+    if (!msg) {
+        debug_log("[SEND] Message is NULL, not sending");
+        return;
+    }
+    if (!transport_should_send()) {
+        efree(msg);
+        return;
+    }
+    
+    size_t msg_len = strlen(msg);
+    char *final_msg = msg;
+    size_t final_len = msg_len;
+    
+    struct iovec iov;
+    iov.iov_base = msg;
+    iov.iov_len = msg_len;
+    
+    // Compress with the configured codec (skipped for small or poorly compressible messages)
+    if (compress) {
+        char *compressed = opa_compress_iov(&iov, 1, msg_len, &final_len);
+        if (compressed) {
+            efree(msg);
+            final_msg = compressed;
+        } else {
+            final_len = msg_len;
+        }
+    }
+    
+    const char *sock_path = OPA_G(socket_path) ? OPA_G(socket_path) : "/var/run/opa.sock";
+    iov.iov_base = final_msg;
+    iov.iov_len = final_len;
+    if (transport_dispatch(sock_path, &iov, 1, final_len) == 0) {
+        debug_log("[SEND] %s %zu bytes", OPA_G(async_send) ? "Queued" : "Sent", final_len);
+    } else {
+        debug_log("[SEND] Failed to send %zu bytes to %s", final_len, sock_path);
     }
     
     // Free the message
@@ -369,3 +751,122 @@ void send_message_direct(char *msg, int compress) {
     }
 }
 
+// Trace batch: root span and child spans of one request, sent as a single message
+void opa_trace_batch_init(opa_trace_batch_t *batch) {
+    memset(batch, 0, sizeof(*batch));
+}
+
+// Add a malloc'd span JSON string; the batch takes ownership
+void opa_trace_batch_add(opa_trace_batch_t *batch, char *span_json) {
+    if (!span_json) {
+        return;
+    }
+    size_t len = strlen(span_json);
+    // Spans are produced as NDJSON lines - the envelope supplies its own separators
+    while (len > 0 && span_json[len - 1] == '\n') {
+        len--;
+    }
+    if (len == 0) {
+        free(span_json);
+        return;
+    }
+    if (batch->count == batch->capacity) {
+        int new_capacity = batch->capacity ? batch->capacity * 2 : 16;
+        char **spans = realloc(batch->spans, sizeof(char *) * new_capacity);
+        size_t *lens = spans ? realloc(batch->lens, sizeof(size_t) * new_capacity) : NULL;
+        if (spans) {
+            batch->spans = spans;
+        }
+        if (!spans || !lens) {
+            free(span_json);
+            return;
+        }
+        batch->lens = lens;
+        batch->capacity = new_capacity;
+    }
+    batch->spans[batch->count] = span_json;
+    batch->lens[batch->count] = len;
+    batch->count++;
+    batch->total_len += len;
+}
+
+void opa_trace_batch_free(opa_trace_batch_t *batch) {
+    for (int i = 0; i < batch->count; i++) {
+        free(batch->spans[i]);
+    }
+    free(batch->spans);
+    free(batch->lens);
+    memset(batch, 0, sizeof(*batch));
+}
+
+// Send all spans of a trace as one envelope:
+// {"type":"trace","trace_id":"...","span_count":N,"spans":[<root>,<child>,...]}\n
+// Framed once and written with a single gathered write; when compressed, the
+// envelope is compressed once instead of once per span.
+void send_trace_batch(opa_trace_batch_t *batch, const char *trace_id, int compress) {
+    if (!batch || batch->count == 0) {
+        return;
+    }
+    if (!transport_should_send()) {
+        return;
+    }
+    
+    char prefix[160];
+    int prefix_len = snprintf(prefix, sizeof(prefix),
+        "{\"type\":\"trace\",\"trace_id\":\"%s\",\"span_count\":%d,\"spans\":[",
+        trace_id ? trace_id : "", batch->count);
+    if (prefix_len <= 0 || prefix_len >= (int)sizeof(prefix)) {
+        return;
+    }
+    static const char suffix[] = "]}\n";
+    static const char comma[] = ",";
+    
+    // prefix, span0, ",", span1, ..., spanN-1, suffix
+    int iovcnt = batch->count * 2 + 1;
+    struct iovec *iov = malloc(sizeof(struct iovec) * iovcnt);
+    if (!iov) {
+        return;
+    }
+    int n = 0;
+    iov[n].iov_base = prefix;
+    iov[n].iov_len = prefix_len;
+    n++;
+    for (int i = 0; i < batch->count; i++) {
+        if (i > 0) {
+            iov[n].iov_base = (void *)comma;
+            iov[n].iov_len = 1;
+            n++;
+        }
+        iov[n].iov_base = batch->spans[i];
+        iov[n].iov_len = batch->lens[i];
+        n++;
+    }
+    iov[n].iov_base = (void *)suffix;
+    iov[n].iov_len = sizeof(suffix) - 1;
+    n++;
+    
+    size_t total_len = prefix_len + batch->total_len + (batch->count - 1) + (sizeof(suffix) - 1);
+    const char *sock_path = OPA_G(socket_path) ? OPA_G(socket_path) : "/var/run/opa.sock";
+    int result;
+    
+    char *compressed = NULL;
+    size_t compressed_len = 0;
+    if (compress) {
+        // Streams the envelope segments through one LZ4 frame - no flattening
+        compressed = opa_compress_iov(iov, n, total_len, &compressed_len);
+    }
+    
+    if (compressed) {
+        struct iovec ciov;
+        ciov.iov_base = compressed;
+        ciov.iov_len = compressed_len;
+        result = transport_dispatch(sock_path, &ciov, 1, compressed_len);
+        efree(compressed);
+    } else {
+        result = transport_dispatch(sock_path, iov, n, total_len);
+    }
+    free(iov);
+    
+    debug_log("[SEND] Trace batch: %d spans, %zu bytes%s", batch->count, total_len,
+        result == 0 ? "" : " (send failed)");
+}
@@ -2,11 +2,73 @@
 #define TRANSPORT_H
 
 #include "opa.h"
+#include "spool.h"
+#include <poll.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <netinet/tcp.h>
+
+// Every message on the agent connection is preceded by an 8-byte frame header:
+// 4-byte magic "OPAF" followed by the payload length as a big-endian uint32
+#define OPA_FRAME_MAGIC "OPAF"
+#define OPA_FRAME_HEADER_SIZE 8
+
+// opa.socket_path prefix selecting the shared-memory ring transport (shm:/name)
+#define OPA_SHM_PREFIX "shm:"
+
+// Suppress SIGPIPE when the agent closes the connection (SO_NOSIGPIPE is used where MSG_NOSIGNAL is missing)
+#ifdef MSG_NOSIGNAL
+#define OPA_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define OPA_SEND_FLAGS 0
+#endif
+
+// Writes are gathered in chunks of at most this many iovecs
+#ifdef IOV_MAX
+#define OPA_IOV_MAX IOV_MAX
+#else
+#define OPA_IOV_MAX 1024
+#endif
+
+// Circuit breaker states (per worker process, socket transports only)
+#define OPA_BREAKER_CLOSED 0    // Sending normally
+#define OPA_BREAKER_OPEN 1      // Agent unreachable: collection and sends suspended until the backoff expires
+#define OPA_BREAKER_HALF_OPEN 2 // Backoff expired: the next connection attempt decides
+
+// Spans of one trace collected in RSHUTDOWN and sent as a single message
+// (malloc'd span JSON strings, owned by the batch)
+typedef struct {
+    char **spans;
+    size_t *lens;
+    int count;
+    int capacity;
+    size_t total_len; // Sum of lens
+} opa_trace_batch_t;
+
+// Per-process transport counters reported by opa_transport_stats()
+typedef struct {
+    uint64_t shm_dropped; // Payloads rejected because the shared-memory ring was full
+    int breaker_state; // OPA_BREAKER_*
+    uint64_t breaker_trips; // Times the circuit opened
+    uint64_t breaker_rejected; // Payloads dropped without a connection attempt while open
+    uint64_t dropped_bytes; // Frame bytes given up on (timeout, error or open breaker) and not spooled
+    uint64_t send_timeouts; // Connects or writes abandoned at opa.send_timeout_ms
+    opa_spool_stats_t spool; // Disk spool (opa.spool_dir)
+} opa_transport_stats_t;
 
 // Transport functions
+void opa_transport_init(void); // Register fork handler (MINIT)
+void opa_transport_shutdown(void); // Close the persistent agent connection (MSHUTDOWN)
+void opa_transport_get_stats(opa_transport_stats_t *stats);
+long opa_transport_replay_spool(void); // opa_spool_replay(): frames replayed, -1 if the agent is unreachable
+int opa_transport_breaker_allow(void); // RINIT: 0 while the agent is known to be unreachable (probes when the backoff expires)
 void opa_finish_request(void);
 void send_message_direct(char *msg, int compress);
+int opa_transport_send_payload(const char *sock_path, const char *payload, size_t len); // Frame and write on the calling thread
+void opa_trace_batch_init(opa_trace_batch_t *batch);
+void opa_trace_batch_add(opa_trace_batch_t *batch, char *span_json);
+void opa_trace_batch_free(opa_trace_batch_t *batch);
+void send_trace_batch(opa_trace_batch_t *batch, const char *trace_id, int compress);
 void pre_resolve_agent_address(void); // Pre-resolve agent address in RINIT to avoid DNS calls from unsafe contexts
 
 #endif /* TRANSPORT_H */
-